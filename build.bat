@@ -6,16 +6,27 @@ pushd build
 set SRC=
 set FLAGS=
 
-for /R ..\src\ %%f in (*.c) do call set SRC=%%SRC%% "%%f"
+for /R ..\src\ %%f in (*.c) do if /I not "%%~nxf"=="bake.c" call set SRC=%%SRC%% "%%f"
+
+:: magic-bake is headless, so it leaves out the renderer, the chunk cache and
+:: the simulation, and does not link glad or glfw.
+set BAKE_SRC=
+set BAKE_FLAGS=
+set BAKE_EXCLUDE= main.c render.c chunk_mesher.c chunk_cache.c sim.c sim_thread.c 
+for /R ..\src\ %%f in (*.c) do call :add_bake_src "%%f" %%~nxf
 
 for /R ..\vendor\mathc\ %%f in (*.c) do call set SRC=%%SRC%% "%%f"
 set FLAGS=%FLAGS% /I ..\vendor\mathc\
+for /R ..\vendor\mathc\ %%f in (*.c) do call set BAKE_SRC=%%BAKE_SRC%% "%%f"
+set BAKE_FLAGS=%BAKE_FLAGS% /I ..\vendor\mathc\
 
 for /R ..\vendor\glad\src\ %%f in (*.c) do call set SRC=%%SRC%% "%%f"
 set FLAGS=%FLAGS% /I ..\vendor\glad\include\
 
 set SRC=%SRC% "..\vendor\tracy\TracyClient.cpp"
 set FLAGS=%FLAGS% /I ..\vendor\tracy\ -DTRACY_ENABLE
+set BAKE_SRC=%BAKE_SRC% "..\vendor\tracy\TracyClient.cpp"
+set BAKE_FLAGS=%BAKE_FLAGS% /I ..\vendor\tracy\ -DTRACY_ENABLE shlwapi.lib kernel32.lib
 
 :: set SRC=%SRC% "..\vendor\glfw\src\context.c" "..\vendor\glfw\patches\init.c" "..\vendor\glfw\patches\input.c" "..\vendor\glfw\patches\monitor.c" "..\vendor\glfw\src\vulkan.c" "..\vendor\glfw\patches\window.c" "..\vendor\glfw\src\win32_init.c" "..\vendor\glfw\src\win32_joystick.c" "..\vendor\glfw\src\win32_monitor.c" "..\vendor\glfw\src\win32_thread.c" "..\vendor\glfw\src\win32_time.c" "..\vendor\glfw\src\win32_window.c" "..\vendor\glfw\src\wgl_context.c"
 set SRC=%SRC% "..\vendor\glfw\src\context.c" "..\vendor\glfw\src\init.c" "..\vendor\glfw\src\input.c" "..\vendor\glfw\src\monitor.c" "..\vendor\glfw\src\vulkan.c" "..\vendor\glfw\src\window.c" "..\vendor\glfw\src\win32_init.c" "..\vendor\glfw\src\win32_joystick.c" "..\vendor\glfw\src\win32_monitor.c" "..\vendor\glfw\src\win32_thread.c" "..\vendor\glfw\src\win32_time.c" "..\vendor\glfw\src\win32_window.c" "..\vendor\glfw\src\wgl_context.c" "..\vendor\glfw\src\egl_context.c" "..\vendor\glfw\src\osmesa_context.c"
@@ -23,5 +34,11 @@ set FLAGS=%FLAGS% /I ..\vendor\glfw\include\ /D_GLFW_WIN32=1 gdi32.lib user32.li
 
 mkdir .\obj\
 cl /O2 /Zi /Fe"..\magic.exe" %FLAGS% %SRC%
+cl /O2 /Zi /Fe"..\magic-bake.exe" %BAKE_FLAGS% %BAKE_SRC%
 
 popd
+goto :eof
+
+:add_bake_src
+echo %BAKE_EXCLUDE% | findstr /I /C:" %2 " >nul || set BAKE_SRC=%BAKE_SRC% %1
+goto :eof
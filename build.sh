@@ -8,9 +8,20 @@ PROFILE=true
 
 mkdir -p build/
 
-SRC=$(find src/ -name "*.c")
+SRC=$(find src/ -name "*.c" ! -name "bake.c")
 FLAGS=""
 
+# magic-bake is headless, so it leaves out the renderer, the chunk cache and
+# the simulation, and does not link glad or glfw.
+BAKE_SRC=$(find src/ -name "*.c" \
+	! -name "main.c" \
+	! -name "render.c" \
+	! -name "chunk_mesher.c" \
+	! -name "chunk_cache.c" \
+	! -name "sim.c" \
+	! -name "sim_thread.c")
+BAKE_FLAGS=""
+
 # glad
 SRC+=" $(find vendor/glad/src/ -name "*.c")"
 FLAGS+=" -Ivendor/glad/include"
@@ -18,6 +29,8 @@ FLAGS+=" -Ivendor/glad/include"
 # mathc
 SRC+=" $(find vendor/mathc/ -name "*.c")"
 FLAGS+=" -Ivendor/mathc"
+BAKE_SRC+=" $(find vendor/mathc/ -name "*.c")"
+BAKE_FLAGS+=" -Ivendor/mathc"
 
 # tracy
 FLAGS+=" -Ivendor/tracy"
@@ -30,6 +43,11 @@ if [[ $PROFILE = true ]]; then
 		$CXX -c -std=c++11 -O2 -DTRACY_ENABLE $TRACY_CLIENT_CPP -o $TRACY_CLIENT_OUT
 	fi
 	SRC+=" $TRACY_CLIENT_OUT"
+	BAKE_SRC+=" $TRACY_CLIENT_OUT"
+fi
+BAKE_FLAGS+=" -Ivendor/tracy"
+if [[ $PROFILE = true ]]; then
+	BAKE_FLAGS+=" -lstdc++ -DTRACY_ENABLE"
 fi
 
 # glfw
@@ -67,8 +85,54 @@ else
 	fi
 fi
 
+# The programs in check/ link the engine without the window and the
+# renderer's GL context. `./build.sh check` builds and runs them instead of
+# magic.
+CHECK_SRC=$(find src/ -name "*.c" ! -name "main.c" ! -name "bake.c")
+CHECK_SRC+=" $(find vendor/glad/src/ -name "*.c")"
+CHECK_SRC+=" $(find vendor/mathc/ -name "*.c")"
+CHECK_FLAGS="-iquote src -Ivendor/glad/include -Ivendor/mathc -Ivendor/tracy"
+
+# Builds check/$1.c with the extra flags $2 into build/$3.
+build_check() {
+	$CC -g -std=gnu11 -O2 -Wall -pedantic $CHECK_FLAGS $2 ${CHECK_SRC[*]} check/$1.c -lm -ldl -pthread -o build/$3
+}
+
+# Builds and runs check/$1.c, which fails by exiting with an error.
+run_check() {
+	echo "Checking $1"
+	build_check $1 "" check-$1 || return 1
+	./build/check-$1 || return 1
+}
+
+# Builds check/$1.c once with the flags $2 and once with the flags $3, runs
+# both, and fails if they print anything different.
+compare_builds() {
+	echo "Checking $1 ($2 vs $3)"
+	build_check $1 "$2" check-$1-a || return 1
+	build_check $1 "$3" check-$1-b || return 1
+	./build/check-$1-a > build/check-$1-a.out || return 1
+	./build/check-$1-b > build/check-$1-b.out || return 1
+	if ! cmp -s build/check-$1-a.out build/check-$1-b.out; then
+		echo "$1: the builds differ"
+		diff build/check-$1-a.out build/check-$1-b.out | head -n 10
+		return 1
+	fi
+}
+
+if [[ $1 = check ]]; then
+	run_check chunk_index || exit 1
+	compare_builds sim_gravity "-DMGC_SIM_FAST_GRAVITY=0" "-DMGC_SIM_FAST_GRAVITY=1" || exit 1
+	compare_builds chunk_layout "-DMGC_CHUNK_SOA=0" "-DMGC_CHUNK_SOA=1" || exit 1
+	echo "All checks passed"
+	exit
+fi
+
 # ASan
 # FLAGS="$FLAGS -fsanitize=address -fno-omit-frame-pointer"
 
 echo "Compiling"
 $CC -g -std=gnu11 -O2 -Wall -pedantic -lm -ldl -pthread $FLAGS ${SRC[*]} -o magic || exit
+
+echo "Compiling magic-bake"
+$CC -g -std=gnu11 -O2 -Wall -pedantic -lm -ldl -pthread $BAKE_FLAGS ${BAKE_SRC[*]} -o magic-bake || exit
@@ -0,0 +1,316 @@
+// Runs random inserts, removes and lookups against mgc_chunk_spatial_index and
+// a dense array of the same coordinates, and fails if they ever disagree.
+// Then times lookups with the 27-neighbour pattern of mgc_sim_tick on a full
+// chunk cache, for both the hash map and the octree it replaced.
+
+#include "chunk_cache.h"
+#include "arena.h"
+#include "thread.h"
+
+#include <string.h>
+
+#define NUM_OPS (2*1000*1000)
+#define NUM_LOOKUP_ROUNDS 2000
+
+// The coordinates are drawn from cubes of this width placed at the middle and
+// at the edges of the index's range.
+#define CUBE_WIDTH 16
+#define CUBE_NUM_COORDS (CUBE_WIDTH*CUBE_WIDTH*CUBE_WIDTH)
+#define COORD_LIMIT (1 << 20)
+
+static const v3i cube_origins[] = {
+	{.x = -CUBE_WIDTH/2, .y = -CUBE_WIDTH/2, .z = -CUBE_WIDTH/2},
+	{.x = -COORD_LIMIT, .y = -COORD_LIMIT, .z = -COORD_LIMIT},
+	{.x = COORD_LIMIT-CUBE_WIDTH, .y = COORD_LIMIT-CUBE_WIDTH, .z = COORD_LIMIT-CUBE_WIDTH},
+	{.x = COORD_LIMIT-CUBE_WIDTH, .y = -COORD_LIMIT, .z = -CUBE_WIDTH/2},
+};
+#define NUM_CUBES (sizeof(cube_origins) / sizeof(cube_origins[0]))
+
+static u32 reference[NUM_CUBES*CUBE_NUM_COORDS];
+
+static u64
+check_rand(u64 *state)
+{
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+// The octree that mgc_chunk_spatial_index replaced, kept here to time the two
+// against each other. Coordinates are offset by OCTREE_COORD_OFFSET so that
+// they are never negative.
+#define OCTREE_WIDTH_LOG2 (1)
+#define OCTREE_WIDTH (1 << OCTREE_WIDTH_LOG2)
+#define OCTREE_CHILDREN (OCTREE_WIDTH*OCTREE_WIDTH*OCTREE_WIDTH)
+#define OCTREE_COORD_OFFSET 100
+
+struct check_octree_node {
+	v3u coord;
+	unsigned int level;
+	union {
+		u32 chunks[OCTREE_CHILDREN];
+		struct check_octree_node *children[OCTREE_CHILDREN];
+	};
+};
+
+struct check_octree {
+	struct check_octree_node *root;
+	struct paged_list nodes;
+};
+
+static struct check_octree_node *
+check_octree_alloc(struct check_octree *tree, unsigned int level, v3u coord)
+{
+	size_t id = paged_list_push(&tree->nodes);
+	struct check_octree_node *node = paged_list_get(&tree->nodes, id);
+	memset(node, 0, sizeof(struct check_octree_node));
+	node->level = level;
+	node->coord = coord;
+
+	if (level == 0) {
+		for (size_t i = 0; i < OCTREE_CHILDREN; i++) {
+			node->chunks[i] = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+		}
+	}
+
+	return node;
+}
+
+static inline v3u
+check_octree_coord(v3i c)
+{
+	return V3u(
+		c.x + OCTREE_COORD_OFFSET,
+		c.y + OCTREE_COORD_OFFSET,
+		c.z + OCTREE_COORD_OFFSET
+	);
+}
+
+static inline v3u
+check_octree_level(v3u c, unsigned int level)
+{
+	return V3u(
+		c.x >> (OCTREE_WIDTH_LOG2*level),
+		c.y >> (OCTREE_WIDTH_LOG2*level),
+		c.z >> (OCTREE_WIDTH_LOG2*level)
+	);
+}
+
+static inline int
+check_octree_child_id(v3u c)
+{
+	return
+		(c.x % OCTREE_WIDTH) +
+		(c.y % OCTREE_WIDTH) * OCTREE_WIDTH +
+		(c.z % OCTREE_WIDTH) * OCTREE_WIDTH * OCTREE_WIDTH;
+}
+
+static void
+check_octree_insert(struct check_octree *tree, v3i chunk_coord, u32 chunk_id)
+{
+	v3u chunk = check_octree_coord(chunk_coord);
+
+	if (!tree->root) {
+		tree->root = check_octree_alloc(tree, 0, check_octree_level(chunk, 1));
+	}
+
+	while (!v3u_equal(tree->root->coord, check_octree_level(chunk, tree->root->level+1))) {
+		struct check_octree_node *new_root;
+		new_root = check_octree_alloc(tree,
+			tree->root->level + 1, check_octree_level(tree->root->coord, 1));
+		new_root->children[check_octree_child_id(tree->root->coord)] = tree->root;
+		tree->root = new_root;
+	}
+
+	struct check_octree_node *node = tree->root;
+	while (node->level > 0) {
+		v3u child_coord = check_octree_level(chunk, node->level);
+		int child_id = check_octree_child_id(child_coord);
+
+		if (!node->children[child_id]) {
+			node->children[child_id] = check_octree_alloc(tree, node->level - 1, child_coord);
+		}
+
+		node = node->children[child_id];
+	}
+
+	node->chunks[check_octree_child_id(chunk)] = chunk_id;
+}
+
+static inline u32
+check_octree_get(struct check_octree *tree, v3i chunk_coord)
+{
+	v3u chunk = check_octree_coord(chunk_coord);
+
+	struct check_octree_node *node = tree->root;
+	while (node && node->level > 0) {
+		v3u child_coord = check_octree_level(chunk, node->level);
+		node = node->children[check_octree_child_id(child_coord)];
+	}
+
+	if (!node || !v3u_equal(node->coord, check_octree_level(chunk, 1))) {
+		return MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+	}
+
+	return node->chunks[check_octree_child_id(chunk)];
+}
+
+static size_t
+check_random_ops(void)
+{
+	struct mgc_chunk_spatial_index idx;
+	mgc_chunk_spatial_index_init(&idx, 16);
+
+	for (size_t i = 0; i < NUM_CUBES*CUBE_NUM_COORDS; i++) {
+		reference[i] = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+	}
+
+	u64 rng = 0x6d61676963ULL;
+	size_t num_entries = 0;
+	size_t num_errors = 0;
+
+	for (size_t op_i = 0; op_i < NUM_OPS; op_i++) {
+		u64 r = check_rand(&rng);
+		size_t ref_i = (r >> 8) % (NUM_CUBES*CUBE_NUM_COORDS);
+		size_t cube_i = ref_i / CUBE_NUM_COORDS;
+		size_t tile_i = ref_i % CUBE_NUM_COORDS;
+		v3i coord = v3i_add(cube_origins[cube_i], V3i(
+			tile_i % CUBE_WIDTH,
+			(tile_i / CUBE_WIDTH) % CUBE_WIDTH,
+			tile_i / (CUBE_WIDTH*CUBE_WIDTH)
+		));
+
+		bool present = reference[ref_i] != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+
+		switch (r % 3) {
+			case 0: {
+				u32 chunk_id = (u32)(r >> 40);
+				int err = mgc_chunk_spatial_index_insert(&idx, coord, chunk_id);
+				if (err != (present ? -1 : 0)) {
+					num_errors += 1;
+				}
+				if (!present) {
+					reference[ref_i] = chunk_id;
+					num_entries += 1;
+				}
+			} break;
+
+			case 1: {
+				int err = mgc_chunk_spatial_index_remove(&idx, coord);
+				if (err != (present ? 0 : -1)) {
+					num_errors += 1;
+				}
+				if (present) {
+					reference[ref_i] = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+					num_entries -= 1;
+				}
+			} break;
+
+			case 2:
+				if (mgc_chunk_spatial_index_get(&idx, coord) != reference[ref_i]) {
+					num_errors += 1;
+				}
+				break;
+		}
+
+		if (idx.num_entries != num_entries) {
+			num_errors += 1;
+		}
+	}
+
+	// Every coordinate, not just the ones the random lookups happened to hit.
+	for (size_t ref_i = 0; ref_i < NUM_CUBES*CUBE_NUM_COORDS; ref_i++) {
+		size_t cube_i = ref_i / CUBE_NUM_COORDS;
+		size_t tile_i = ref_i % CUBE_NUM_COORDS;
+		v3i coord = v3i_add(cube_origins[cube_i], V3i(
+			tile_i % CUBE_WIDTH,
+			(tile_i / CUBE_WIDTH) % CUBE_WIDTH,
+			tile_i / (CUBE_WIDTH*CUBE_WIDTH)
+		));
+		if (mgc_chunk_spatial_index_get(&idx, coord) != reference[ref_i]) {
+			num_errors += 1;
+		}
+	}
+
+	printf("%i random operations, %zu entries left, %zu errors\n",
+		NUM_OPS, num_entries, num_errors);
+
+	mgc_chunk_spatial_index_destroy(&idx);
+
+	return num_errors;
+}
+
+// Calls lookup with the 27 neighbours of every chunk that has all of them in
+// the cache, NUM_LOOKUP_ROUNDS times over, and prints the time per lookup. A
+// macro rather than a function taking a callback, so that both lookups are
+// inlined into the loop the way they are in their callers.
+#define CHECK_LOOKUP_TIME(name, lookup) do { \
+	int half_width = MGC_CHUNK_CACHE_WIDTH / 2; \
+	u64 sum = 0; \
+	size_t num_lookups = 0; \
+	u64 begin = mgc_time_ns(); \
+	for (size_t round = 0; round < NUM_LOOKUP_ROUNDS; round++) { \
+		for (int z = -half_width+1; z < MGC_CHUNK_CACHE_WIDTH - half_width-1; z++) { \
+			for (int y = -half_width+1; y < MGC_CHUNK_CACHE_WIDTH - half_width-1; y++) { \
+				for (int x = -half_width+1; x < MGC_CHUNK_CACHE_WIDTH - half_width-1; x++) { \
+					for (int n = 0; n < 27; n++) { \
+						v3i coord = V3i(x + n%3 - 1, y + (n/3)%3 - 1, z + n/9 - 1); \
+						sum += (lookup); \
+						num_lookups += 1; \
+					} \
+				} \
+			} \
+		} \
+	} \
+	u64 end = mgc_time_ns(); \
+	printf("%s: %zu lookups, checksum %llx\n", name, \
+		num_lookups, (unsigned long long)sum); \
+	fprintf(stderr, "%s: %.1f ns per lookup\n", name, \
+		(double)(end - begin) / (double)num_lookups); \
+} while (0)
+
+static void
+check_lookup_time(void)
+{
+	struct mgc_memory mem;
+	mgc_memory_init(&mem);
+
+	struct mgc_chunk_spatial_index idx;
+	mgc_chunk_spatial_index_init(&idx, MGC_CHUNK_CACHE_SIZE);
+
+	struct check_octree tree = {0};
+	paged_list_init(&tree.nodes, &mem, sizeof(struct check_octree_node));
+
+	int half_width = MGC_CHUNK_CACHE_WIDTH / 2;
+	u32 chunk_id = 0;
+	for (int z = -half_width; z < MGC_CHUNK_CACHE_WIDTH - half_width; z++) {
+		for (int y = -half_width; y < MGC_CHUNK_CACHE_WIDTH - half_width; y++) {
+			for (int x = -half_width; x < MGC_CHUNK_CACHE_WIDTH - half_width; x++) {
+				mgc_chunk_spatial_index_insert(&idx, V3i(x, y, z), chunk_id);
+				check_octree_insert(&tree, V3i(x, y, z), chunk_id);
+				chunk_id += 1;
+			}
+		}
+	}
+
+	CHECK_LOOKUP_TIME("hash map", mgc_chunk_spatial_index_get(&idx, coord));
+	CHECK_LOOKUP_TIME("octree", check_octree_get(&tree, coord));
+
+	paged_list_destroy(&tree.nodes);
+	mgc_chunk_spatial_index_destroy(&idx);
+	mgc_memory_destroy(&mem);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (check_random_ops() != 0) {
+		return 1;
+	}
+
+	check_lookup_time();
+
+	return 0;
+}
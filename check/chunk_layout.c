@@ -0,0 +1,172 @@
+// Times a material-only scan and a fully awake sim tick, and prints the
+// results of both. `./build.sh check` builds this with and without
+// MGC_CHUNK_SOA, and fails if the two layouts give different results. The
+// timings are printed to stderr, as they differ between runs.
+
+#include "sim.h"
+#include "material.h"
+#include "thread.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define NUM_SCAN_CHUNKS 512
+#define NUM_RUNS 10
+#define NUM_TICKS 96
+
+#if MGC_CHUNK_SOA
+#define LAYOUT_NAME "SoA"
+#else
+#define LAYOUT_NAME "AoS"
+#endif
+
+static struct mgc_chunk_awake awake[NEIGHBOURHOOD_SIZE];
+static struct mgc_chunk_cache_entry entries[NEIGHBOURHOOD_SIZE];
+
+static u64
+check_rand(u64 *state)
+{
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+check_seed_chunk(struct mgc_chunk *chunk, u64 *rng)
+{
+	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+		v3i coord = mgc_chunk_index_to_coord(i);
+		u64 r = check_rand(rng) % 100;
+
+		u16 material = MAT_AIR;
+		u16 data = 0;
+		if (coord.z % 11 == 0 && r < 70) {
+			material = MAT_METAL;
+		} else if (r < 25) {
+			material = MAT_SAND;
+			data = (r % 2);
+		} else if (r < 40) {
+			material = MAT_WATER;
+		}
+
+		*mgc_chunk_material(chunk, i) = material;
+		*mgc_chunk_data(chunk, i) = data;
+	}
+}
+
+// Hashes the tiles through the accessors, so that both layouts give the same
+// hash for the same tiles.
+static u64
+check_hash_chunk(u64 h, struct mgc_chunk *chunk)
+{
+	// FNV-1a
+	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+		u16 tile[2] = {*mgc_chunk_material(chunk, i), *mgc_chunk_data(chunk, i)};
+		u8 *p = (u8 *)tile;
+		for (size_t j = 0; j < sizeof(tile); j++) {
+			h ^= p[j];
+			h *= 1099511628211ULL;
+		}
+	}
+	return h;
+}
+
+static size_t
+check_count_solid(struct mgc_chunk *chunks, struct mgc_material_props *props)
+{
+	size_t num_solid = 0;
+	for (size_t chunk_i = 0; chunk_i < NUM_SCAN_CHUNKS; chunk_i++) {
+		for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+			u16 material = *mgc_chunk_material(&chunks[chunk_i], i);
+			num_solid += (props[material].flags & MGC_MAT_SOLID) != 0;
+		}
+	}
+	return num_solid;
+}
+
+static void
+check_sim_tick(struct mgc_sim_chunk *sim_chunk, struct mgc_material_table *materials, bool clock)
+{
+	for (size_t z = 0; z < CHUNK_HEIGHT; z += SIM_CHUNK_BATCH_SIZE_LAYERS) {
+		mgc_sim_update_tiles(
+			sim_chunk, materials,
+			z, SIM_CHUNK_BATCH_SIZE_LAYERS, clock);
+	}
+
+	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+		memset(awake[i].tiles[clock], 0, sizeof(awake[i].tiles[clock]));
+		awake[i].render_chunks[clock] = 0;
+		memset(awake[i].updated[!clock], 0, sizeof(awake[i].updated[!clock]));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mgc_material_table materials;
+	mgc_material_table_init(&materials);
+	struct mgc_material_props *props = materials.props;
+
+	struct mgc_chunk *chunks = calloc(NUM_SCAN_CHUNKS, sizeof(struct mgc_chunk));
+	struct mgc_chunk *seeded = calloc(NEIGHBOURHOOD_SIZE, sizeof(struct mgc_chunk));
+	if (!chunks || !seeded) {
+		panic("Failed to allocate the chunks.");
+	}
+
+	u64 rng = 0x6d61676963ULL;
+	for (size_t i = 0; i < NUM_SCAN_CHUNKS; i++) {
+		check_seed_chunk(&chunks[i], &rng);
+	}
+	memcpy(seeded, chunks, NEIGHBOURHOOD_SIZE * sizeof(struct mgc_chunk));
+
+	u64 best_ns = UINT64_MAX;
+	size_t num_solid = 0;
+	for (size_t run = 0; run < NUM_RUNS; run++) {
+		u64 begin = mgc_time_ns();
+		num_solid = check_count_solid(chunks, props);
+		u64 time = mgc_time_ns() - begin;
+		best_ns = time < best_ns ? time : best_ns;
+	}
+	printf("material scan: %zu solid tiles\n", num_solid);
+	fprintf(stderr, LAYOUT_NAME " material scan of %i chunks: %.2f ms\n",
+		NUM_SCAN_CHUNKS, (double)best_ns / 1000000.0);
+
+	struct mgc_sim_chunk sim_chunk = {0};
+	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+		entries[i].chunk = &chunks[i];
+		entries[i].awake = &awake[i];
+		sim_chunk.cache_entry[i] = &entries[i];
+		sim_chunk.neighbours[i] = mgc_chunk_make_ref(&chunks[i]);
+	}
+
+	best_ns = UINT64_MAX;
+	for (size_t run = 0; run < NUM_RUNS; run++) {
+		memcpy(chunks, seeded, NEIGHBOURHOOD_SIZE * sizeof(struct mgc_chunk));
+		memset(awake, 0, sizeof(awake));
+		mgc_chunk_awake_wake_all(&awake[NEIGHBOURHOOD_CENTER_IDX]);
+
+		u64 begin = mgc_time_ns();
+		check_sim_tick(&sim_chunk, &materials, false);
+		u64 time = mgc_time_ns() - begin;
+		best_ns = time < best_ns ? time : best_ns;
+	}
+	fprintf(stderr, LAYOUT_NAME " fully awake sim tick: %.2f ms\n",
+		(double)best_ns / 1000000.0);
+
+	for (size_t tick = 1; tick < NUM_TICKS; tick++) {
+		check_sim_tick(&sim_chunk, &materials, (tick % 2) == 1);
+	}
+
+	u64 h = 14695981039346656037ULL;
+	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+		h = check_hash_chunk(h, &chunks[i]);
+	}
+	printf("sim: %016llx after %i ticks\n", (unsigned long long)h, NUM_TICKS);
+
+	free(seeded);
+	free(chunks);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+// Runs a seeded neighbourhood of chunks through the sim and prints the state
+// of every chunk after each tick. `./build.sh check` builds this with and
+// without MGC_SIM_FAST_GRAVITY, and fails if the two print anything
+// different.
+
+#include "sim.h"
+#include "material.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define NUM_TICKS 96
+
+static struct mgc_chunk chunks[NEIGHBOURHOOD_SIZE];
+static struct mgc_chunk_awake awake[NEIGHBOURHOOD_SIZE];
+static struct mgc_chunk_cache_entry entries[NEIGHBOURHOOD_SIZE];
+
+static u64
+check_rand(u64 *state)
+{
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+// Mostly air, so that sand and water have room to fall and slide, with some
+// floors of metal to land on. Sand is sometimes already sliding.
+static void
+check_seed_chunk(struct mgc_chunk *chunk, u64 *rng)
+{
+	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+		v3i coord = mgc_chunk_index_to_coord(i);
+		u64 r = check_rand(rng) % 100;
+
+		u16 material = MAT_AIR;
+		u16 data = 0;
+		if (coord.z % 11 == 0 && r < 70) {
+			material = MAT_METAL;
+		} else if (r < 25) {
+			material = MAT_SAND;
+			data = (r % 2);
+		} else if (r < 40) {
+			material = MAT_WATER;
+		}
+
+		*mgc_chunk_material(chunk, i) = material;
+		*mgc_chunk_data(chunk, i) = data;
+	}
+}
+
+static u64
+check_hash(u64 h, const void *data, size_t size)
+{
+	// FNV-1a
+	const u8 *p = data;
+	for (size_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mgc_material_table materials;
+	mgc_material_table_init(&materials);
+
+	struct mgc_sim_chunk sim_chunk = {0};
+	u64 rng = 0x6d61676963ULL;
+
+	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+		check_seed_chunk(&chunks[i], &rng);
+		entries[i].chunk = &chunks[i];
+		entries[i].awake = &awake[i];
+		sim_chunk.cache_entry[i] = &entries[i];
+		sim_chunk.neighbours[i] = mgc_chunk_make_ref(&chunks[i]);
+	}
+
+	mgc_chunk_awake_wake_all(&awake[NEIGHBOURHOOD_CENTER_IDX]);
+
+	for (size_t tick = 0; tick < NUM_TICKS; tick++) {
+		bool clock = (tick % 2) == 1;
+
+		for (size_t z = 0; z < CHUNK_HEIGHT; z += SIM_CHUNK_BATCH_SIZE_LAYERS) {
+			mgc_sim_update_tiles(
+				&sim_chunk, &materials,
+				z, SIM_CHUNK_BATCH_SIZE_LAYERS, clock);
+		}
+
+		u64 h = 14695981039346656037ULL;
+		for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+			h = check_hash(h, &chunks[i], sizeof(chunks[i]));
+			h = check_hash(h, &awake[i], sizeof(awake[i]));
+			h = check_hash(h, &entries[i].dirty_mask, sizeof(entries[i].dirty_mask));
+		}
+		printf("tick %zu: %016llx\n", tick, (unsigned long long)h);
+
+		// Only the center chunk is simulated. Clear the masks of every chunk
+		// as mgc_sim_tick would after simulating them.
+		for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+			memset(awake[i].tiles[clock], 0, sizeof(awake[i].tiles[clock]));
+			awake[i].render_chunks[clock] = 0;
+			memset(awake[i].updated[!clock], 0, sizeof(awake[i].updated[!clock]));
+		}
+	}
+
+	return 0;
+}
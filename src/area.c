@@ -1,8 +1,12 @@
 #include "area.h"
 
-void
-mgc_area_apply(struct mgc_area *area, struct mgc_chunk *chunk)
+bool
+mgc_area_apply(struct mgc_area *area, struct mgc_chunk *chunk, struct mgc_tile *uniform)
 {
+	// Chunks start out as air.
+	struct mgc_tile tile = {MAT_AIR, 0};
+	bool is_uniform = true;
+
 	for (size_t i = 0; i < area->num_ops; i++) {
 		struct mgc_area_op *op = &area->ops[i];
 
@@ -25,9 +29,23 @@ mgc_area_apply(struct mgc_area *area, struct mgc_chunk *chunk)
 						op->add.shape
 					);
 
+					if (is_uniform) {
+						if (mgc_chunk_mask_is_empty(&mask)) {
+							break;
+						}
+
+						if (mgc_chunk_mask_is_full(&mask)) {
+							tile = (struct mgc_tile){op->add.material, 0};
+							break;
+						}
+
+						mgc_chunk_fill(chunk, tile);
+						is_uniform = false;
+					}
+
 					for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
 						if (mgc_chunk_mask_geti(&mask, i)) {
-							chunk->tiles[i].material = op->add.material;
+							*mgc_chunk_material(chunk, i) = op->add.material;
 						}
 					}
 				}
@@ -47,4 +65,7 @@ mgc_area_apply(struct mgc_area *area, struct mgc_chunk *chunk)
 				break;
 		}
 	}
+
+	*uniform = tile;
+	return is_uniform;
 }
@@ -31,7 +31,10 @@ struct mgc_area {
 	size_t num_ops;
 };
 
-void
-mgc_area_apply(struct mgc_area *, struct mgc_chunk *);
+// Writes the area's tiles to the chunk at chunk->location. While every tile
+// of the chunk is the same, only *uniform is updated. Returns true, without
+// having written any of the chunk's tiles, if that held to the end.
+bool
+mgc_area_apply(struct mgc_area *, struct mgc_chunk *, struct mgc_tile *uniform);
 
 #endif
@@ -194,6 +194,39 @@ mgc_memory_init(struct mgc_memory *mem)
 	return 0;
 }
 
+void
+mgc_memory_discard(void *data, size_t size)
+{
+#ifdef linux
+	size_t page_size = sysconf(_SC_PAGESIZE);
+#elif _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t page_size = info.dwPageSize;
+#else
+	size_t page_size = 0;
+#endif
+
+	if (page_size == 0) {
+		return;
+	}
+
+	// Only whole pages, as the rest of a partial page might be in use.
+	uintptr_t begin = ((uintptr_t)data + page_size - 1) & ~(uintptr_t)(page_size - 1);
+	uintptr_t end = ((uintptr_t)data + size) & ~(uintptr_t)(page_size - 1);
+	if (end <= begin) {
+		return;
+	}
+
+#ifdef linux
+	if (madvise((void *)begin, end - begin, MADV_DONTNEED)) {
+		perror("madvise");
+	}
+#elif _WIN32
+	VirtualAlloc((void *)begin, end - begin, MEM_RESET, PAGE_READWRITE);
+#endif
+}
+
 void
 mgc_memory_destroy(struct mgc_memory *mem)
 {
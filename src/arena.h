@@ -34,6 +34,11 @@ mgc_memory_init(struct mgc_memory *mem);
 void
 mgc_memory_destroy(struct mgc_memory *mem);
 
+// Returns the whole pages within [data, data+size) to the system while
+// keeping them mapped. Their contents are undefined until written again.
+void
+mgc_memory_discard(void *data, size_t size);
+
 struct paged_list {
 	struct mgc_memory *mem;
 	struct mgc_memory_page **pages;
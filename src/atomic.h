@@ -0,0 +1,190 @@
+#ifndef MAGIC_ATOMIC_H
+#define MAGIC_ATOMIC_H
+
+#include "types.h"
+
+// Loads have acquire semantics, stores have release semantics and
+// read-modify-write operations are sequentially consistent.
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+
+static inline int
+mgc_atomic_load_int(volatile int *ptr)
+{
+	int result = *ptr;
+	_ReadWriteBarrier();
+	return result;
+}
+
+static inline void
+mgc_atomic_store_int(volatile int *ptr, int value)
+{
+	_ReadWriteBarrier();
+	*ptr = value;
+}
+
+static inline u32
+mgc_atomic_load_u32(volatile u32 *ptr)
+{
+	u32 result = *ptr;
+	_ReadWriteBarrier();
+	return result;
+}
+
+static inline void
+mgc_atomic_store_u32(volatile u32 *ptr, u32 value)
+{
+	_ReadWriteBarrier();
+	*ptr = value;
+}
+
+static inline u64
+mgc_atomic_load_u64(volatile u64 *ptr)
+{
+	u64 result = *ptr;
+	_ReadWriteBarrier();
+	return result;
+}
+
+static inline void
+mgc_atomic_store_u64(volatile u64 *ptr, u64 value)
+{
+	_ReadWriteBarrier();
+	*ptr = value;
+}
+
+static inline u32
+mgc_atomic_fetch_add_u32(volatile u32 *ptr, u32 value)
+{
+	return (u32)InterlockedExchangeAdd((volatile LONG *)ptr, (LONG)value);
+}
+
+static inline u64
+mgc_atomic_fetch_add_u64(volatile u64 *ptr, u64 value)
+{
+	return (u64)InterlockedExchangeAdd64((volatile LONG64 *)ptr, (LONG64)value);
+}
+
+static inline u32
+mgc_atomic_fetch_sub_u32(volatile u32 *ptr, u32 value)
+{
+	return (u32)InterlockedExchangeAdd((volatile LONG *)ptr, -(LONG)value);
+}
+
+static inline u64
+mgc_atomic_fetch_or_u64(volatile u64 *ptr, u64 value)
+{
+	return (u64)InterlockedOr64((volatile LONG64 *)ptr, (LONG64)value);
+}
+
+static inline u64
+mgc_atomic_fetch_and_u64(volatile u64 *ptr, u64 value)
+{
+	return (u64)InterlockedAnd64((volatile LONG64 *)ptr, (LONG64)value);
+}
+
+static inline u64
+mgc_atomic_exchange_u64(volatile u64 *ptr, u64 value)
+{
+	return (u64)InterlockedExchange64((volatile LONG64 *)ptr, (LONG64)value);
+}
+
+static inline bool
+mgc_atomic_cas_u32(volatile u32 *ptr, u32 *expected, u32 desired)
+{
+	u32 prev = (u32)InterlockedCompareExchange(
+		(volatile LONG *)ptr, (LONG)desired, (LONG)*expected);
+	if (prev == *expected) {
+		return true;
+	}
+	*expected = prev;
+	return false;
+}
+
+#else
+
+static inline int
+mgc_atomic_load_int(volatile int *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+mgc_atomic_store_int(volatile int *ptr, int value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline u32
+mgc_atomic_load_u32(volatile u32 *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+mgc_atomic_store_u32(volatile u32 *ptr, u32 value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline u64
+mgc_atomic_load_u64(volatile u64 *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+mgc_atomic_store_u64(volatile u64 *ptr, u64 value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline u32
+mgc_atomic_fetch_add_u32(volatile u32 *ptr, u32 value)
+{
+	return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline u64
+mgc_atomic_fetch_add_u64(volatile u64 *ptr, u64 value)
+{
+	return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline u32
+mgc_atomic_fetch_sub_u32(volatile u32 *ptr, u32 value)
+{
+	return __atomic_fetch_sub(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline u64
+mgc_atomic_fetch_or_u64(volatile u64 *ptr, u64 value)
+{
+	return __atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline u64
+mgc_atomic_fetch_and_u64(volatile u64 *ptr, u64 value)
+{
+	return __atomic_fetch_and(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline u64
+mgc_atomic_exchange_u64(volatile u64 *ptr, u64 value)
+{
+	return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline bool
+mgc_atomic_cas_u32(volatile u32 *ptr, u32 *expected, u32 desired)
+{
+	return __atomic_compare_exchange_n(
+		ptr, expected, desired, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif
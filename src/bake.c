@@ -0,0 +1,223 @@
+// magic-bake generates the chunks of a world definition and writes them to a
+// chunk archive, which the game can load with --archive. It does not use
+// GLFW or OpenGL.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+#include "world.h"
+#include "registry.h"
+#include "chunk_archive.h"
+#include "thread.h"
+#include "arena.h"
+#include "atom.h"
+#include "errors.h"
+#include "utils.h"
+
+// The number of chunks generated per worker before they are written out.
+#define MGC_BAKE_CHUNKS_PER_WORKER 8
+
+struct mgc_bake_job_data {
+	struct mgc_world *world;
+	struct mgc_aabbi bounds;
+
+	size_t first_chunk;
+	struct mgc_chunk *chunks;
+	int *errs;
+};
+
+static v3i
+mgc_bake_chunk_coord(struct mgc_aabbi bounds, size_t chunk_i)
+{
+	size_t width = bounds.max.x - bounds.min.x;
+	size_t depth = bounds.max.y - bounds.min.y;
+
+	return V3i(
+		bounds.min.x + (chunk_i % width),
+		bounds.min.y + ((chunk_i / width) % depth),
+		bounds.min.z + (chunk_i / (width * depth))
+	);
+}
+
+static void
+mgc_bake_job(void *data, size_t job_i, size_t worker_i)
+{
+	struct mgc_bake_job_data *job = data;
+	struct mgc_chunk *chunk = &job->chunks[job_i];
+
+	memset(chunk, 0, sizeof(struct mgc_chunk));
+
+	v3i coord = mgc_bake_chunk_coord(job->bounds, job->first_chunk + job_i);
+
+	struct mgc_tile uniform;
+	int err = mgc_world_load_chunk(job->world, chunk, coord, &uniform);
+	if (err == MGC_WORLD_LOAD_UNIFORM) {
+		mgc_chunk_fill(chunk, uniform);
+		err = 0;
+	}
+	job->errs[job_i] = err;
+}
+
+static bool
+mgc_bake_parse_int(const char *str, int *out)
+{
+	char *end;
+	long value = strtol(str, &end, 10);
+	if (end == str || *end != '\0') {
+		return false;
+	}
+
+	*out = (int)value;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 8) {
+		fprintf(stderr,
+			"usage: %s <archive> <x0> <y0> <z0> <x1> <y1> <z1>\n"
+			"Bakes the chunks from (x0, y0, z0) to (x1, y1, z1), inclusive, in chunk\n"
+			"coordinates.\n", argv[0]);
+		return -1;
+	}
+
+	const char *archive_path = argv[1];
+
+	int extents[6];
+	for (size_t i = 0; i < 6; i++) {
+		if (!mgc_bake_parse_int(argv[2 + i], &extents[i])) {
+			fprintf(stderr, "Invalid chunk coordinate '%s'.\n", argv[2 + i]);
+			return -1;
+		}
+	}
+
+	struct mgc_aabbi bounds = mgc_aabbi_from_extents(
+		V3i(extents[0], extents[1], extents[2]),
+		V3i(extents[3], extents[4], extents[5]));
+
+	size_t num_chunks =
+		(size_t)(bounds.max.x - bounds.min.x) *
+		(size_t)(bounds.max.y - bounds.min.y) *
+		(size_t)(bounds.max.z - bounds.min.z);
+
+	struct mgc_memory memory = {0};
+	mgc_memory_init(&memory);
+
+	struct arena arena = {0};
+	arena_init(&arena, &memory);
+
+	struct arena transient = {0};
+	arena_init(&transient, &memory);
+
+	struct mgc_error_context err_ctx = {0};
+	err_ctx.string_arena = &arena;
+	err_ctx.transient_arena = &transient;
+
+	struct arena atom_arena = {0};
+	arena_init(&atom_arena, &memory);
+
+	struct atom_table atom_table = {0};
+	atom_table.string_arena = &atom_arena;
+	atom_table_rehash(&atom_table, 64);
+
+	struct mgc_registry reg = {0};
+	mgc_material_table_init(&reg.materials);
+
+	struct mgc_world_init_context world_init_context = {0};
+	world_init_context.atom_table = &atom_table;
+	world_init_context.memory = &memory;
+	world_init_context.world_arena = &arena;
+	world_init_context.transient_arena = &transient;
+	world_init_context.registry = &reg;
+	world_init_context.err = &err_ctx;
+
+	struct mgc_world world = {0};
+	mgc_world_init_world_def(&world, &world_init_context);
+
+	// Loads and evaluates /world/world.
+	mgc_world_tick(&world);
+	if (!world.world_def.terrain) {
+		fprintf(stderr, "Failed to load the world definition.\n");
+		return -1;
+	}
+
+	size_t num_cpus = mgc_num_cpus();
+	struct mgc_job_pool pool = {0};
+	if (mgc_job_pool_init(&pool, num_cpus > 1 ? num_cpus - 1 : 0)) {
+		print_error("bake", "Failed to start the worker threads.");
+		return -1;
+	}
+
+	size_t batch_cap = mgc_job_pool_num_workers(&pool) * MGC_BAKE_CHUNKS_PER_WORKER;
+
+	struct mgc_bake_job_data job = {0};
+	job.world = &world;
+	job.bounds = bounds;
+	job.chunks = calloc(batch_cap, sizeof(struct mgc_chunk));
+	job.errs = calloc(batch_cap, sizeof(int));
+	if (!job.chunks || !job.errs) {
+		panic("Failed to allocate the chunk batch.");
+	}
+
+	struct mgc_chunk_archive_writer writer;
+	if (mgc_chunk_archive_writer_open(&writer, archive_path)) {
+		return -1;
+	}
+
+	printf("Baking %zu chunks on %zu threads.\n",
+		num_chunks, mgc_job_pool_num_workers(&pool));
+
+	u64 time_begin = mgc_time_ns();
+	int err = 0;
+
+	for (size_t first = 0; first < num_chunks && !err; first += batch_cap) {
+		TracyCZoneN(trace_batch, "bake batch", true);
+
+		size_t batch_length = min(batch_cap, num_chunks - first);
+		job.first_chunk = first;
+		mgc_job_pool_run(&pool, mgc_bake_job, &job, batch_length);
+
+		for (size_t i = 0; i < batch_length; i++) {
+			if (job.errs[i] != 0) {
+				v3i coord = mgc_bake_chunk_coord(bounds, first + i);
+				print_error("bake", "Failed to generate chunk %i,%i,%i.",
+					coord.x, coord.y, coord.z);
+				err = -1;
+				break;
+			}
+
+			if (mgc_chunk_archive_writer_add(&writer, &job.chunks[i])) {
+				err = -1;
+				break;
+			}
+		}
+
+		printf("\r%zu/%zu chunks", first + batch_length, num_chunks);
+		fflush(stdout);
+
+		TracyCZoneEnd(trace_batch);
+	}
+	printf("\n");
+
+	size_t num_written = writer.num_chunks;
+	if (mgc_chunk_archive_writer_close(&writer, &reg.materials)) {
+		err = -1;
+	}
+
+	if (!err) {
+		printf("Wrote %zu non-empty chunks to '%s' in %.2fs.\n",
+			num_written, archive_path, (double)(mgc_time_ns() - time_begin) / 1e9);
+	}
+
+	free(job.chunks);
+	free(job.errs);
+	mgc_job_pool_destroy(&pool);
+	mgc_world_destroy(&world);
+	atom_table_destroy(&atom_table);
+	mgc_memory_destroy(&memory);
+
+	return err;
+}
@@ -0,0 +1,188 @@
+#include "buddy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static u32
+mgc_buddy_order(u32 num_units)
+{
+	u32 order = 0;
+	while (((u32)1 << order) < num_units) {
+		order += 1;
+	}
+	return order;
+}
+
+static void
+mgc_buddy_link(struct mgc_buddy *buddy, u32 offset, u32 order)
+{
+	u32 next = buddy->free_head[order];
+
+	buddy->free_order[offset] = order + 1;
+	buddy->free_prev[offset] = MGC_BUDDY_NONE;
+	buddy->free_next[offset] = next;
+	if (next != MGC_BUDDY_NONE) {
+		buddy->free_prev[next] = offset;
+	}
+	buddy->free_head[order] = offset;
+}
+
+static void
+mgc_buddy_unlink(struct mgc_buddy *buddy, u32 offset, u32 order)
+{
+	u32 prev = buddy->free_prev[offset];
+	u32 next = buddy->free_next[offset];
+
+	if (prev != MGC_BUDDY_NONE) {
+		buddy->free_next[prev] = next;
+	} else {
+		buddy->free_head[order] = next;
+	}
+	if (next != MGC_BUDDY_NONE) {
+		buddy->free_prev[next] = prev;
+	}
+	buddy->free_order[offset] = 0;
+}
+
+// Frees the block, merging it with its buddy for as long as the buddy is
+// free as well.
+static void
+mgc_buddy_insert(struct mgc_buddy *buddy, u32 offset, u32 order)
+{
+	while (order + 1 < buddy->num_orders) {
+		u32 other = offset ^ ((u32)1 << order);
+		if (buddy->free_order[other] != order + 1) {
+			break;
+		}
+
+		mgc_buddy_unlink(buddy, other, order);
+		offset &= ~((u32)1 << order);
+		order += 1;
+	}
+
+	mgc_buddy_link(buddy, offset, order);
+}
+
+static int
+mgc_buddy_resize(struct mgc_buddy *buddy, u32 num_units)
+{
+	u8 *free_order = realloc(buddy->free_order, num_units * sizeof(u8));
+	if (!free_order) {
+		return -1;
+	}
+	buddy->free_order = free_order;
+
+	u32 *free_next = realloc(buddy->free_next, num_units * sizeof(u32));
+	if (!free_next) {
+		return -1;
+	}
+	buddy->free_next = free_next;
+
+	u32 *free_prev = realloc(buddy->free_prev, num_units * sizeof(u32));
+	if (!free_prev) {
+		return -1;
+	}
+	buddy->free_prev = free_prev;
+
+	return 0;
+}
+
+int
+mgc_buddy_init(struct mgc_buddy *buddy, u32 log_num_units)
+{
+	assert(log_num_units + 1 < MGC_BUDDY_MAX_ORDERS);
+
+	memset(buddy, 0, sizeof(struct mgc_buddy));
+	for (size_t i = 0; i < MGC_BUDDY_MAX_ORDERS; i++) {
+		buddy->free_head[i] = MGC_BUDDY_NONE;
+	}
+
+	u32 num_units = (u32)1 << log_num_units;
+	if (mgc_buddy_resize(buddy, num_units)) {
+		mgc_buddy_destroy(buddy);
+		return -1;
+	}
+	memset(buddy->free_order, 0, num_units * sizeof(u8));
+
+	buddy->num_orders = log_num_units + 1;
+	mgc_buddy_link(buddy, 0, log_num_units);
+
+	return 0;
+}
+
+void
+mgc_buddy_destroy(struct mgc_buddy *buddy)
+{
+	free(buddy->free_order);
+	free(buddy->free_next);
+	free(buddy->free_prev);
+	buddy->free_order = NULL;
+	buddy->free_next = NULL;
+	buddy->free_prev = NULL;
+	buddy->num_orders = 0;
+}
+
+int
+mgc_buddy_alloc(struct mgc_buddy *buddy, u32 num_units, u32 *out_offset)
+{
+	assert(num_units > 0);
+
+	u32 order = mgc_buddy_order(num_units);
+
+	u32 block_order = order;
+	while (block_order < buddy->num_orders &&
+		buddy->free_head[block_order] == MGC_BUDDY_NONE) {
+		block_order += 1;
+	}
+
+	if (block_order >= buddy->num_orders) {
+		return -1;
+	}
+
+	u32 offset = buddy->free_head[block_order];
+	mgc_buddy_unlink(buddy, offset, block_order);
+
+	// Give back the upper halves until the block is of the right size.
+	while (block_order > order) {
+		block_order -= 1;
+		mgc_buddy_link(buddy, offset + ((u32)1 << block_order), block_order);
+	}
+
+	buddy->num_units_used += (u32)1 << order;
+	*out_offset = offset;
+	return 0;
+}
+
+void
+mgc_buddy_free(struct mgc_buddy *buddy, u32 offset, u32 num_units)
+{
+	u32 order = mgc_buddy_order(num_units);
+	assert(offset % ((u32)1 << order) == 0);
+	assert(buddy->free_order[offset] == 0);
+
+	buddy->num_units_used -= (u32)1 << order;
+	mgc_buddy_insert(buddy, offset, order);
+}
+
+int
+mgc_buddy_grow(struct mgc_buddy *buddy)
+{
+	if (buddy->num_orders + 1 >= MGC_BUDDY_MAX_ORDERS) {
+		return -1;
+	}
+
+	u32 old_num_units = mgc_buddy_num_units(buddy);
+	if (mgc_buddy_resize(buddy, old_num_units * 2)) {
+		return -1;
+	}
+	memset(&buddy->free_order[old_num_units], 0, old_num_units * sizeof(u8));
+
+	// The new upper half is the buddy of the old space, so it merges with
+	// it if nothing is allocated.
+	u32 old_order = buddy->num_orders - 1;
+	buddy->num_orders += 1;
+	mgc_buddy_insert(buddy, old_num_units, old_order);
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef MAGIC_BUDDY_H
+#define MAGIC_BUDDY_H
+
+#include "types.h"
+
+#define MGC_BUDDY_MAX_ORDERS (32)
+#define MGC_BUDDY_NONE ((u32)-1)
+
+// A buddy allocator of ranges of units within a power-of-two sized space.
+// It only keeps track of offsets, so it can manage memory it does not own,
+// like a GPU buffer. Blocks of order k are (1 << k) units long and start at
+// a multiple of their length.
+struct mgc_buddy {
+	// The largest block is of order num_orders-1 and covers the whole space.
+	u32 num_orders;
+	u32 num_units_used;
+
+	// The first free block of each order, or MGC_BUDDY_NONE.
+	u32 free_head[MGC_BUDDY_MAX_ORDERS];
+
+	// Indexed by unit. Only set for the first unit of each free block.
+	// free_order is the block's order + 1, and 0 for every other unit.
+	u8  *free_order;
+	u32 *free_next;
+	u32 *free_prev;
+};
+
+int
+mgc_buddy_init(struct mgc_buddy *, u32 log_num_units);
+
+void
+mgc_buddy_destroy(struct mgc_buddy *);
+
+static inline u32
+mgc_buddy_num_units(struct mgc_buddy *buddy)
+{
+	return (u32)1 << (buddy->num_orders - 1);
+}
+
+// Allocates a block of at least num_units units. Returns -1 if there is no
+// free block that is large enough.
+int
+mgc_buddy_alloc(struct mgc_buddy *, u32 num_units, u32 *out_offset);
+
+// num_units must be the same as the block was allocated with.
+void
+mgc_buddy_free(struct mgc_buddy *, u32 offset, u32 num_units);
+
+// Doubles the number of units. Blocks that are already allocated keep their
+// offsets.
+int
+mgc_buddy_grow(struct mgc_buddy *);
+
+#endif
@@ -6,10 +6,20 @@ mgc_chunk_make_ref(struct mgc_chunk *chunk)
 {
 	struct mgc_chunk_ref result = {0};
 	result.location = chunk->location;
-	result.tiles = chunk->tiles;
+	result.materials = mgc_chunk_material(chunk, 0);
+	result.data = mgc_chunk_data(chunk, 0);
 	return result;
 }
 
+void
+mgc_chunk_fill(struct mgc_chunk *chunk, struct mgc_tile tile)
+{
+	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+		*mgc_chunk_material(chunk, i) = tile.material;
+		*mgc_chunk_data(chunk, i) = tile.data;
+	}
+}
+
 size_t
 chunkCoordToIndex(v3i coord)
 {
@@ -24,10 +34,14 @@ mgc_chunk_coord_to_index(v3i coord)
 		+  coord.x;
 }
 
-struct mgc_tile *
+struct mgc_tile
 chunkTile(struct mgc_chunk *cnk, v3i localCoord)
 {
-	return &cnk->tiles[chunkCoordToIndex(localCoord)];
+	size_t i = chunkCoordToIndex(localCoord);
+	struct mgc_tile result = {0};
+	result.material = *mgc_chunk_material(cnk, i);
+	result.data = *mgc_chunk_data(cnk, i);
+	return result;
 }
 
 v3i
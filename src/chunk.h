@@ -36,17 +36,68 @@ struct mgc_chunk {
 	v3i location;
 
 	// column-major
+#if MGC_CHUNK_SOA
+	u16 materials[CHUNK_NUM_TILES];
+	u16 data[CHUNK_NUM_TILES];
+#else
 	struct mgc_tile tiles[CHUNK_NUM_TILES];
+#endif
 };
 
+// The distance in u16s between the materials (or data) of consecutive tiles.
+#if MGC_CHUNK_SOA
+#define MGC_CHUNK_TILE_STRIDE 1
+#else
+#define MGC_CHUNK_TILE_STRIDE 2
+#endif
+
 struct mgc_chunk_ref {
 	v3i location;
-	struct mgc_tile *tiles;
+	// Index with mgc_chunk_ref_material and mgc_chunk_ref_data, as the
+	// arrays might be interleaved.
+	u16 *materials;
+	u16 *data;
 };
 
+static inline u16 *
+mgc_chunk_material(struct mgc_chunk *chunk, size_t i)
+{
+#if MGC_CHUNK_SOA
+	return &chunk->materials[i];
+#else
+	return &chunk->tiles[i].material;
+#endif
+}
+
+static inline u16 *
+mgc_chunk_data(struct mgc_chunk *chunk, size_t i)
+{
+#if MGC_CHUNK_SOA
+	return &chunk->data[i];
+#else
+	return &chunk->tiles[i].data;
+#endif
+}
+
+static inline u16 *
+mgc_chunk_ref_material(struct mgc_chunk_ref ref, size_t i)
+{
+	return &ref.materials[i * MGC_CHUNK_TILE_STRIDE];
+}
+
+static inline u16 *
+mgc_chunk_ref_data(struct mgc_chunk_ref ref, size_t i)
+{
+	return &ref.data[i * MGC_CHUNK_TILE_STRIDE];
+}
+
 struct mgc_chunk_ref
 mgc_chunk_make_ref(struct mgc_chunk *);
 
+// Sets every tile of the chunk to tile.
+void
+mgc_chunk_fill(struct mgc_chunk *, struct mgc_tile tile);
+
 size_t
 chunkCoordToIndex(v3i coord);
 
@@ -71,7 +122,7 @@ mgc_coord_chunk_to_tile(v3i p);
 v3i
 mgc_coord_tile_to_chunk_local(v3i p);
 
-struct mgc_tile *
+struct mgc_tile
 chunkTile(struct mgc_chunk *, v3i localCoord);
 
 #endif
@@ -0,0 +1,622 @@
+#include "chunk_archive.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "profile.h"
+
+#define MGC_CHUNK_ARCHIVE_RAW_SIZE (CHUNK_NUM_TILES * 2 * sizeof(u16))
+
+#ifdef __GNUC__
+_Static_assert(sizeof(struct mgc_chunk_archive_header) == 40,
+	"The archive header must not have padding.");
+_Static_assert(sizeof(struct mgc_chunk_archive_index_entry) == 32,
+	"The archive index entries must not have padding.");
+_Static_assert(CHUNK_NUM_TILES <= 0xffff,
+	"A run must be able to cover a whole chunk.");
+#endif
+
+static int
+mgc_chunk_archive_coord_compare(v3i lhs, v3i rhs)
+{
+	if (lhs.z != rhs.z) {
+		return lhs.z < rhs.z ? -1 : 1;
+	}
+	if (lhs.y != rhs.y) {
+		return lhs.y < rhs.y ? -1 : 1;
+	}
+	if (lhs.x != rhs.x) {
+		return lhs.x < rhs.x ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+mgc_chunk_archive_index_entry_compare(const void *lhs_ptr, const void *rhs_ptr)
+{
+	const struct mgc_chunk_archive_index_entry *lhs = lhs_ptr, *rhs = rhs_ptr;
+	return mgc_chunk_archive_coord_compare(lhs->coord, rhs->coord);
+}
+
+static bool
+mgc_chunk_archive_in_bounds(struct mgc_chunk_archive *archive, u64 offset, u64 size)
+{
+	return offset <= archive->size && size <= archive->size - offset;
+}
+
+static int
+mgc_chunk_archive_map(struct mgc_chunk_archive *archive, const char *path)
+{
+#ifdef _WIN32
+	archive->file = CreateFileA(
+		path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (archive->file == INVALID_HANDLE_VALUE) {
+		print_error("chunk archive", "Failed to open '%s': %i.", path, GetLastError());
+		return -1;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(archive->file, &size) || size.QuadPart == 0) {
+		print_error("chunk archive", "Failed to get the size of '%s'.", path);
+		CloseHandle(archive->file);
+		return -1;
+	}
+
+	archive->mapping = CreateFileMappingA(
+		archive->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!archive->mapping) {
+		print_error("chunk archive", "Failed to map '%s': %i.", path, GetLastError());
+		CloseHandle(archive->file);
+		return -1;
+	}
+
+	archive->data = MapViewOfFile(archive->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!archive->data) {
+		print_error("chunk archive", "Failed to map '%s': %i.", path, GetLastError());
+		CloseHandle(archive->mapping);
+		CloseHandle(archive->file);
+		return -1;
+	}
+	archive->size = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		print_error("chunk archive", "Failed to open '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		print_error("chunk archive", "Failed to get the size of '%s'.", path);
+		close(fd);
+		return -1;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file open.
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		print_error("chunk archive", "Failed to map '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	archive->data = data;
+	archive->size = st.st_size;
+#endif
+
+	return 0;
+}
+
+static void
+mgc_chunk_archive_unmap(struct mgc_chunk_archive *archive)
+{
+	if (!archive->data) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(archive->data);
+	CloseHandle(archive->mapping);
+	CloseHandle(archive->file);
+#else
+	munmap(archive->data, archive->size);
+#endif
+
+	archive->data = NULL;
+	archive->size = 0;
+}
+
+// Builds the map from the archive's material ids to the ids in materials.
+static int
+mgc_chunk_archive_map_materials(
+		struct mgc_chunk_archive *archive,
+		const char *path,
+		struct mgc_material_table *materials)
+{
+	struct mgc_chunk_archive_header *header = archive->header;
+
+	archive->material_map = calloc(header->num_materials + 1, sizeof(mgc_material_id));
+	if (!archive->material_map) {
+		return -1;
+	}
+	archive->material_map_identity = true;
+
+	u64 offset = header->materials_offset;
+	for (u32 i = 0; i < header->num_materials; i++) {
+		u16 length;
+		if (!mgc_chunk_archive_in_bounds(archive, offset, sizeof(u16))) {
+			print_error("chunk archive", "'%s' is truncated.", path);
+			return -1;
+		}
+		memcpy(&length, archive->data + offset, sizeof(u16));
+		offset += sizeof(u16);
+
+		if (!mgc_chunk_archive_in_bounds(archive, offset, length)) {
+			print_error("chunk archive", "'%s' is truncated.", path);
+			return -1;
+		}
+
+		struct string name;
+		name.text = (char *)archive->data + offset;
+		name.length = length;
+		offset += length;
+
+		// Prefer the same id, as some of the default materials are unnamed.
+		mgc_material_id id = i;
+		if ((i >= materials->num_materials ||
+			!string_equal(materials->materials[i].name, name)) &&
+			!mgc_material_lookup(materials, name, &id)) {
+			print_error("chunk archive", "'%s' uses the unknown material '%.*s'.",
+				path, LIT(name));
+			return -1;
+		}
+
+		archive->material_map[i] = id;
+		if (id != i) {
+			archive->material_map_identity = false;
+		}
+	}
+
+	return 0;
+}
+
+int
+mgc_chunk_archive_open(
+		struct mgc_chunk_archive *archive,
+		const char *path,
+		struct mgc_material_table *materials)
+{
+	TracyCZone(trace, true);
+
+	memset(archive, 0, sizeof(struct mgc_chunk_archive));
+
+	if (mgc_chunk_archive_map(archive, path)) {
+		TracyCZoneEnd(trace);
+		return -1;
+	}
+
+	struct mgc_chunk_archive_header *header;
+	header = (struct mgc_chunk_archive_header *)archive->data;
+
+	if (archive->size < sizeof(struct mgc_chunk_archive_header) ||
+		memcmp(header->magic, MGC_CHUNK_ARCHIVE_MAGIC, sizeof(header->magic)) != 0) {
+		print_error("chunk archive", "'%s' is not a chunk archive.", path);
+		goto fail;
+	}
+
+	if (header->version != MGC_CHUNK_ARCHIVE_VERSION) {
+		print_error("chunk archive", "'%s' is version %u, expected %u.",
+			path, header->version, MGC_CHUNK_ARCHIVE_VERSION);
+		goto fail;
+	}
+
+	if (header->chunk_width != CHUNK_WIDTH || header->chunk_height != CHUNK_HEIGHT) {
+		print_error("chunk archive", "'%s' has chunks of %ux%u tiles, expected %ix%i.",
+			path, header->chunk_width, header->chunk_height, CHUNK_WIDTH, CHUNK_HEIGHT);
+		goto fail;
+	}
+
+	if (header->index_offset % 8 != 0 || !mgc_chunk_archive_in_bounds(archive,
+			header->index_offset,
+			(u64)header->num_chunks * sizeof(struct mgc_chunk_archive_index_entry))) {
+		print_error("chunk archive", "'%s' is truncated.", path);
+		goto fail;
+	}
+
+	archive->header = header;
+	archive->index = (struct mgc_chunk_archive_index_entry *)(archive->data + header->index_offset);
+
+	if (mgc_chunk_archive_map_materials(archive, path, materials)) {
+		goto fail;
+	}
+
+	TracyCZoneEnd(trace);
+	return 0;
+
+fail:
+	mgc_chunk_archive_close(archive);
+	TracyCZoneEnd(trace);
+	return -1;
+}
+
+void
+mgc_chunk_archive_close(struct mgc_chunk_archive *archive)
+{
+	free(archive->material_map);
+	mgc_chunk_archive_unmap(archive);
+	memset(archive, 0, sizeof(struct mgc_chunk_archive));
+}
+
+static struct mgc_chunk_archive_index_entry *
+mgc_chunk_archive_find(struct mgc_chunk_archive *archive, v3i coord)
+{
+	size_t lo = 0, hi = archive->header->num_chunks;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = mgc_chunk_archive_coord_compare(archive->index[mid].coord, coord);
+		if (cmp == 0) {
+			return &archive->index[mid];
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+static int
+mgc_chunk_archive_decode_raw(
+		struct mgc_chunk_archive *archive,
+		struct mgc_chunk *chunk,
+		u16 *src)
+{
+	u16 *src_materials = src;
+	u16 *src_data = src + CHUNK_NUM_TILES;
+
+#if MGC_CHUNK_SOA
+	if (archive->material_map_identity) {
+		memcpy(chunk->materials, src_materials, CHUNK_NUM_TILES * sizeof(u16));
+		memcpy(chunk->data, src_data, CHUNK_NUM_TILES * sizeof(u16));
+	} else {
+#endif
+		u32 num_materials = archive->header->num_materials;
+		for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+			if (src_materials[i] >= num_materials) {
+				return -1;
+			}
+			*mgc_chunk_material(chunk, i) = archive->material_map[src_materials[i]];
+			*mgc_chunk_data(chunk, i) = src_data[i];
+		}
+#if MGC_CHUNK_SOA
+	}
+#endif
+
+	return 0;
+}
+
+static int
+mgc_chunk_archive_decode_rle(
+		struct mgc_chunk_archive *archive,
+		struct mgc_chunk *chunk,
+		u16 *src, size_t num_runs)
+{
+	u32 num_materials = archive->header->num_materials;
+	size_t tile_i = 0;
+
+	for (size_t run_i = 0; run_i < num_runs; run_i++) {
+		u16 length = src[run_i*3 + 0];
+		u16 material = src[run_i*3 + 1];
+		u16 data = src[run_i*3 + 2];
+
+		if (material >= num_materials || length > CHUNK_NUM_TILES - tile_i) {
+			return -1;
+		}
+		material = archive->material_map[material];
+
+		for (size_t i = 0; i < length; i++) {
+			*mgc_chunk_material(chunk, tile_i + i) = material;
+			*mgc_chunk_data(chunk, tile_i + i) = data;
+		}
+		tile_i += length;
+	}
+
+	return tile_i == CHUNK_NUM_TILES ? 0 : -1;
+}
+
+int
+mgc_chunk_archive_read_chunk(
+		struct mgc_chunk_archive *archive,
+		struct mgc_chunk *chunk,
+		v3i coord)
+{
+	TracyCZone(trace, true);
+
+	chunk->location = coord;
+
+	struct mgc_chunk_archive_index_entry *entry;
+	entry = mgc_chunk_archive_find(archive, coord);
+	if (!entry) {
+		TracyCZoneEnd(trace);
+		return 0;
+	}
+
+	int err = -1;
+	if (entry->offset % sizeof(u16) == 0 &&
+		mgc_chunk_archive_in_bounds(archive, entry->offset, entry->size)) {
+		u16 *src = (u16 *)(archive->data + entry->offset);
+
+		switch (entry->encoding) {
+			case MGC_CHUNK_ARCHIVE_RAW:
+				if (entry->size == MGC_CHUNK_ARCHIVE_RAW_SIZE) {
+					err = mgc_chunk_archive_decode_raw(archive, chunk, src);
+				}
+				break;
+
+			case MGC_CHUNK_ARCHIVE_RLE:
+				if (entry->size % (3 * sizeof(u16)) == 0) {
+					err = mgc_chunk_archive_decode_rle(
+						archive, chunk, src, entry->size / (3 * sizeof(u16)));
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if (err) {
+		print_error("chunk archive", "Chunk %i,%i,%i is corrupt.",
+			coord.x, coord.y, coord.z);
+	}
+
+	TracyCZoneEnd(trace);
+	return err;
+}
+
+bool
+mgc_chunk_archive_chunk_is_uniform(
+		struct mgc_chunk_archive *archive,
+		v3i coord,
+		struct mgc_tile *uniform)
+{
+	struct mgc_chunk_archive_index_entry *entry;
+	entry = mgc_chunk_archive_find(archive, coord);
+	if (!entry) {
+		*uniform = (struct mgc_tile){MAT_AIR, 0};
+		return true;
+	}
+
+	// A single run that covers the whole chunk.
+	if (entry->encoding != MGC_CHUNK_ARCHIVE_RLE ||
+		entry->size != 3 * sizeof(u16) ||
+		entry->offset % sizeof(u16) != 0 ||
+		!mgc_chunk_archive_in_bounds(archive, entry->offset, entry->size)) {
+		return false;
+	}
+
+	u16 *src = (u16 *)(archive->data + entry->offset);
+	if (src[0] != CHUNK_NUM_TILES || src[1] >= archive->header->num_materials) {
+		return false;
+	}
+
+	*uniform = (struct mgc_tile){archive->material_map[src[1]], src[2]};
+	return true;
+}
+
+static int
+mgc_chunk_archive_writer_write(
+		struct mgc_chunk_archive_writer *writer,
+		const void *data, size_t size)
+{
+	if (size > 0 && fwrite(data, size, 1, writer->fp) != 1) {
+		return -1;
+	}
+	writer->offset += size;
+	return 0;
+}
+
+static int
+mgc_chunk_archive_writer_align(struct mgc_chunk_archive_writer *writer)
+{
+	static const u8 zeros[8] = {0};
+	return mgc_chunk_archive_writer_write(
+		writer, zeros, (8 - writer->offset % 8) % 8);
+}
+
+int
+mgc_chunk_archive_writer_open(
+		struct mgc_chunk_archive_writer *writer,
+		const char *path)
+{
+	memset(writer, 0, sizeof(struct mgc_chunk_archive_writer));
+
+	writer->scratch = malloc(MGC_CHUNK_ARCHIVE_RAW_SIZE);
+	if (!writer->scratch) {
+		return -1;
+	}
+
+	writer->fp = fopen(path, "wb");
+	if (!writer->fp) {
+		print_error("chunk archive", "Failed to open '%s' for writing: %s",
+			path, strerror(errno));
+		free(writer->scratch);
+		writer->scratch = NULL;
+		return -1;
+	}
+
+	// The header is written last, when the offsets are known.
+	struct mgc_chunk_archive_header header = {0};
+	if (mgc_chunk_archive_writer_write(writer, &header, sizeof(header))) {
+		fclose(writer->fp);
+		free(writer->scratch);
+		memset(writer, 0, sizeof(struct mgc_chunk_archive_writer));
+		return -1;
+	}
+
+	return 0;
+}
+
+// Encodes the chunk in the writer's scratch buffer, picking whichever
+// encoding is smaller. Returns the number of bytes used.
+static size_t
+mgc_chunk_archive_encode(
+		struct mgc_chunk_archive_writer *writer,
+		struct mgc_chunk *chunk,
+		enum mgc_chunk_archive_encoding *out_encoding)
+{
+	u16 *dst = writer->scratch;
+	size_t max_runs = MGC_CHUNK_ARCHIVE_RAW_SIZE / (3 * sizeof(u16));
+	size_t num_runs = 0;
+
+	size_t i = 0;
+	while (i < CHUNK_NUM_TILES && num_runs < max_runs) {
+		u16 material = *mgc_chunk_material(chunk, i);
+		u16 data = *mgc_chunk_data(chunk, i);
+
+		size_t length = 1;
+		while (i + length < CHUNK_NUM_TILES &&
+			*mgc_chunk_material(chunk, i + length) == material &&
+			*mgc_chunk_data(chunk, i + length) == data) {
+			length += 1;
+		}
+
+		dst[num_runs*3 + 0] = length;
+		dst[num_runs*3 + 1] = material;
+		dst[num_runs*3 + 2] = data;
+		num_runs += 1;
+		i += length;
+	}
+
+	if (i == CHUNK_NUM_TILES) {
+		*out_encoding = MGC_CHUNK_ARCHIVE_RLE;
+		return num_runs * 3 * sizeof(u16);
+	}
+
+	for (i = 0; i < CHUNK_NUM_TILES; i++) {
+		dst[i] = *mgc_chunk_material(chunk, i);
+		dst[CHUNK_NUM_TILES + i] = *mgc_chunk_data(chunk, i);
+	}
+
+	*out_encoding = MGC_CHUNK_ARCHIVE_RAW;
+	return MGC_CHUNK_ARCHIVE_RAW_SIZE;
+}
+
+int
+mgc_chunk_archive_writer_add(
+		struct mgc_chunk_archive_writer *writer,
+		struct mgc_chunk *chunk)
+{
+	enum mgc_chunk_archive_encoding encoding;
+	size_t size = mgc_chunk_archive_encode(writer, chunk, &encoding);
+
+	// A single run of air is the same as a missing chunk.
+	if (encoding == MGC_CHUNK_ARCHIVE_RLE && size == 3 * sizeof(u16) &&
+		writer->scratch[1] == MAT_AIR && writer->scratch[2] == 0) {
+		return 0;
+	}
+
+	if (writer->num_chunks >= writer->cap_chunks) {
+		size_t new_cap = writer->cap_chunks ? writer->cap_chunks * 2 : 256;
+		struct mgc_chunk_archive_index_entry *new_index;
+		new_index = realloc(writer->index,
+			new_cap * sizeof(struct mgc_chunk_archive_index_entry));
+		if (!new_index) {
+			return -1;
+		}
+		writer->index = new_index;
+		writer->cap_chunks = new_cap;
+	}
+
+	if (mgc_chunk_archive_writer_align(writer)) {
+		return -1;
+	}
+
+	struct mgc_chunk_archive_index_entry *entry;
+	entry = &writer->index[writer->num_chunks];
+	memset(entry, 0, sizeof(struct mgc_chunk_archive_index_entry));
+	entry->coord = chunk->location;
+	entry->encoding = encoding;
+	entry->offset = writer->offset;
+	entry->size = size;
+
+	if (mgc_chunk_archive_writer_write(writer, writer->scratch, size)) {
+		return -1;
+	}
+
+	writer->num_chunks += 1;
+	return 0;
+}
+
+int
+mgc_chunk_archive_writer_close(
+		struct mgc_chunk_archive_writer *writer,
+		struct mgc_material_table *materials)
+{
+	int err = 0;
+
+	struct mgc_chunk_archive_header header = {0};
+	memcpy(header.magic, MGC_CHUNK_ARCHIVE_MAGIC, sizeof(header.magic));
+	header.version = MGC_CHUNK_ARCHIVE_VERSION;
+	header.chunk_width = CHUNK_WIDTH;
+	header.chunk_height = CHUNK_HEIGHT;
+
+	err = err || mgc_chunk_archive_writer_align(writer);
+	header.materials_offset = writer->offset;
+	header.num_materials = materials->num_materials;
+	for (size_t i = 0; i < materials->num_materials && !err; i++) {
+		struct string name = materials->materials[i].name;
+		u16 length = name.length;
+		err = err || mgc_chunk_archive_writer_write(writer, &length, sizeof(length));
+		err = err || mgc_chunk_archive_writer_write(writer, name.text, length);
+	}
+
+	qsort(writer->index, writer->num_chunks,
+		sizeof(struct mgc_chunk_archive_index_entry),
+		mgc_chunk_archive_index_entry_compare);
+
+	for (size_t i = 1; i < writer->num_chunks; i++) {
+		if (mgc_chunk_archive_coord_compare(
+				writer->index[i-1].coord, writer->index[i].coord) == 0) {
+			print_error("chunk archive", "Chunk %i,%i,%i was written twice.",
+				writer->index[i].coord.x, writer->index[i].coord.y, writer->index[i].coord.z);
+			err = -1;
+			break;
+		}
+	}
+
+	err = err || mgc_chunk_archive_writer_align(writer);
+	header.index_offset = writer->offset;
+	header.num_chunks = writer->num_chunks;
+	err = err || mgc_chunk_archive_writer_write(writer, writer->index,
+		writer->num_chunks * sizeof(struct mgc_chunk_archive_index_entry));
+
+	err = err || fseek(writer->fp, 0, SEEK_SET);
+	err = err || fwrite(&header, sizeof(header), 1, writer->fp) != 1;
+
+	if (fclose(writer->fp)) {
+		err = -1;
+	}
+
+	if (err) {
+		print_error("chunk archive", "Failed to write the archive.");
+	}
+
+	free(writer->index);
+	free(writer->scratch);
+	memset(writer, 0, sizeof(struct mgc_chunk_archive_writer));
+
+	return err ? -1 : 0;
+}
@@ -0,0 +1,130 @@
+#ifndef MAGIC_CHUNK_ARCHIVE_H
+#define MAGIC_CHUNK_ARCHIVE_H
+
+#include "intdef.h"
+#include "types.h"
+#include "chunk.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// A file of pre-generated chunks. The file starts with a header, followed by
+// the chunk data, the material names and an index sorted by chunk
+// coordinate. Everything is stored in host byte order, and each section
+// starts at a multiple of 8 bytes.
+//
+// Chunks that are not in the archive are empty (air).
+
+#define MGC_CHUNK_ARCHIVE_MAGIC "MGCA"
+#define MGC_CHUNK_ARCHIVE_VERSION 1
+
+struct mgc_chunk_archive_header {
+	char magic[4];
+	u32 version;
+
+	// Must match CHUNK_WIDTH and CHUNK_HEIGHT.
+	u32 chunk_width;
+	u32 chunk_height;
+
+	// Each name is a u16 length followed by that many bytes. The tiles of
+	// the chunks refer to materials by their position in this list.
+	u64 materials_offset;
+	u32 num_materials;
+
+	u32 num_chunks;
+	u64 index_offset;
+};
+
+enum mgc_chunk_archive_encoding {
+	// CHUNK_NUM_TILES u16 materials followed by CHUNK_NUM_TILES u16 data.
+	MGC_CHUNK_ARCHIVE_RAW = 0,
+	// Runs of (length, material, data) u16 triples.
+	MGC_CHUNK_ARCHIVE_RLE = 1,
+};
+
+struct mgc_chunk_archive_index_entry {
+	v3i coord;
+	u32 encoding;
+	u64 offset;
+	u64 size;
+};
+
+struct mgc_chunk_archive {
+	u8 *data;
+	size_t size;
+
+	struct mgc_chunk_archive_header *header;
+	struct mgc_chunk_archive_index_entry *index;
+
+	// Maps the archive's material ids to the registry's.
+	mgc_material_id *material_map;
+	bool material_map_identity;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+// Maps the archive at path into memory. Returns -1 if the file can not be
+// read, is not a valid archive, or uses materials missing from materials.
+int
+mgc_chunk_archive_open(
+		struct mgc_chunk_archive *,
+		const char *path,
+		struct mgc_material_table *materials);
+
+void
+mgc_chunk_archive_close(struct mgc_chunk_archive *);
+
+// Fills chunk with the tiles of the chunk at coord. The chunk must be
+// cleared beforehand. Returns -1 if the chunk's data is corrupt.
+int
+mgc_chunk_archive_read_chunk(
+		struct mgc_chunk_archive *,
+		struct mgc_chunk *chunk,
+		v3i coord);
+
+// Returns true, and sets *uniform, if every tile of the chunk at coord is
+// the same, without reading the chunk.
+bool
+mgc_chunk_archive_chunk_is_uniform(
+		struct mgc_chunk_archive *,
+		v3i coord,
+		struct mgc_tile *uniform);
+
+struct mgc_chunk_archive_writer {
+	FILE *fp;
+	u64 offset;
+
+	struct mgc_chunk_archive_index_entry *index;
+	size_t num_chunks;
+	size_t cap_chunks;
+
+	// Large enough for a chunk in either encoding.
+	u16 *scratch;
+};
+
+int
+mgc_chunk_archive_writer_open(
+		struct mgc_chunk_archive_writer *,
+		const char *path);
+
+// Appends the chunk at chunk->location. Chunks that only contain air are
+// skipped. Each coordinate may only be written once.
+int
+mgc_chunk_archive_writer_add(
+		struct mgc_chunk_archive_writer *,
+		struct mgc_chunk *chunk);
+
+// Writes the material names, the index and the header, and closes the
+// file. The writer is freed even if this fails.
+int
+mgc_chunk_archive_writer_close(
+		struct mgc_chunk_archive_writer *,
+		struct mgc_material_table *materials);
+
+#endif
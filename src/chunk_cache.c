@@ -4,6 +4,8 @@
 #include "utils.h"
 #include "world.h"
 #include "render.h"
+#include "hexGrid.h"
+#include "chunk_compressed.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,10 @@
 
 #include "profile.h"
 
+#if MGC_CHUNK_MESH_RING_SIZE < RENDER_CHUNKS_PER_CHUNK
+#error "MGC_CHUNK_MESH_RING_SIZE must fit the meshes of at least one chunk"
+#endif
+
 #if MGCD_DEBUG_CHUNK_CACHE
 static void
 mgccc_debug_trace(v3i coord, const char *fmt, ...)
@@ -30,17 +36,173 @@ mgccc_debug_trace(v3i coord, const char *fmt, ...)
 #define mgccc_debug_trace(...)
 #endif
 
+void
+mgc_chunk_awake_wake_all(struct mgc_chunk_awake *awake)
+{
+	memset(awake->tiles, 0xff, sizeof(awake->tiles));
+	memset(awake->render_chunks, 0xff, sizeof(awake->render_chunks));
+	memset(awake->updated, 0, sizeof(awake->updated));
+}
+
+static void
+mgc_chunk_loader_thread(void *data)
+{
+	struct mgc_chunk_loader *loader = data;
+	struct mgc_chunk_cache *cache = loader->cache;
+
+	mgc_mutex_lock(&loader->lock);
+	while (true) {
+		while (loader->queue_length == 0 && !loader->should_quit) {
+			mgc_cond_wait(&loader->cond, &loader->lock);
+		}
+
+		if (loader->should_quit) {
+			break;
+		}
+
+		u32 entry_i = loader->queue[loader->queue_head];
+		loader->queue_head = (loader->queue_head + 1) % loader->queue_cap;
+		loader->queue_length -= 1;
+
+		mgc_mutex_unlock(&loader->lock);
+
+		struct mgc_chunk_cache_entry *entry;
+		entry = &cache->entries[entry_i];
+		assert(mgc_chunk_cache_entry_state(entry) == MGC_CHUNK_CACHE_LOADING);
+
+		struct mgc_chunk_pool_entry *unused_chunk = NULL;
+
+		enum mgc_chunk_cache_entry_state new_state;
+		struct mgc_tile uniform;
+		int err;
+		err = mgc_world_load_chunk(cache->world, entry->chunk, entry->coord, &uniform);
+		if (err == MGC_WORLD_LOAD_UNIFORM) {
+#if MGC_CHUNK_CACHE_UNIFORM_CHUNKS
+			entry->is_uniform = true;
+			entry->uniform = uniform;
+
+			// Only the cache tick may return the chunk to the pool.
+			unused_chunk = (struct mgc_chunk_pool_entry *)(
+				(u8 *)entry->chunk - offsetof(struct mgc_chunk_pool_entry, chunk));
+			entry->chunk = NULL;
+			entry->awake = NULL;
+#else
+			mgc_chunk_fill(entry->chunk, uniform);
+#endif
+			err = 0;
+		}
+
+		// Newly loaded chunks have not settled yet.
+		if (err == 0 && entry->awake) {
+			mgc_chunk_awake_wake_all(entry->awake);
+		}
+
+		if (err < 0) {
+			new_state = MGC_CHUNK_CACHE_FAILED;
+			mgccc_debug_trace(entry->coord, "Loading FAILED");
+		} else if (err > 0) {
+			new_state = MGC_CHUNK_CACHE_UNLOADED;
+			mgccc_debug_trace(entry->coord, "Loading YIELD");
+		} else {
+			new_state = MGC_CHUNK_CACHE_LOADED;
+			mgccc_debug_trace(entry->coord, "Loading OK");
+		}
+
+		mgc_chunk_cache_entry_set_state(entry, new_state);
+		if (new_state == MGC_CHUNK_CACHE_LOADED) {
+			mgc_atomic_fetch_add_u64(&cache->sim_generation, 1);
+		}
+
+		mgc_mutex_lock(&loader->lock);
+
+		if (unused_chunk) {
+			unused_chunk->next = loader->unused_chunks;
+			loader->unused_chunks = unused_chunk;
+		}
+	}
+	mgc_mutex_unlock(&loader->lock);
+}
+
+static void
+mgc_chunk_loader_start(struct mgc_chunk_loader *loader, struct mgc_chunk_cache *cache)
+{
+	loader->cache = cache;
+	loader->queue_cap = cache->cap_entries;
+	loader->queue = calloc(loader->queue_cap, sizeof(u32));
+
+	mgc_mutex_init(&loader->lock);
+	mgc_cond_init(&loader->cond);
+
+	// Leave one core for the render thread and one for the sim thread.
+	size_t num_cpus = mgc_num_cpus();
+	size_t num_threads = num_cpus > 2 ? num_cpus - 2 : 1;
+	num_threads = min(num_threads, MGC_CHUNK_LOADER_MAX_THREADS);
+
+	loader->threads = calloc(num_threads, sizeof(struct mgc_thread));
+	for (size_t i = 0; i < num_threads; i++) {
+		int err;
+		err = mgc_thread_spawn(&loader->threads[i], mgc_chunk_loader_thread, loader);
+		if (err) {
+			break;
+		}
+		loader->num_threads += 1;
+	}
+
+	if (loader->num_threads == 0) {
+		panic("Failed to start any chunk loader threads.");
+	}
+}
+
+static void
+mgc_chunk_loader_stop(struct mgc_chunk_loader *loader)
+{
+	mgc_mutex_lock(&loader->lock);
+	loader->should_quit = true;
+	mgc_cond_broadcast(&loader->cond);
+	mgc_mutex_unlock(&loader->lock);
+
+	for (size_t i = 0; i < loader->num_threads; i++) {
+		mgc_thread_join(&loader->threads[i]);
+	}
+
+	free(loader->threads);
+	loader->threads = NULL;
+	loader->num_threads = 0;
+
+	free(loader->queue);
+	loader->queue = NULL;
+
+	mgc_cond_destroy(&loader->cond);
+	mgc_mutex_destroy(&loader->lock);
+}
+
 void
 mgc_chunk_cache_init(struct mgc_chunk_cache *cache, struct mgc_memory *memory, struct mgc_world *world, struct mgc_material_table *mat_table)
 {
 	memset(cache, 0, sizeof(struct mgc_chunk_cache));
 	cache->world = world;
 	cache->mat_table = mat_table;
+	cache->sim_generation = 1;
 	cache->cap_entries = MGC_CHUNK_CACHE_SIZE;
 	cache->entries = calloc(cache->cap_entries, sizeof(struct mgc_chunk_cache_entry));
+	cache->evict_queue = calloc(cache->cap_entries, sizeof(u32));
+	cache->evict_candidates = calloc(cache->cap_entries, sizeof(struct mgc_chunk_cache_evict_candidate));
+
+	cache->mesh_queue = calloc(cache->cap_entries, sizeof(u32));
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	cache->compress_queue = calloc(MGC_CHUNK_CACHE_COMPRESS_BATCH, sizeof(u32));
+#endif
+	for (size_t i = 0; i < MGC_SIM_MAX_THREADS; i++) {
+		struct mgc_chunk_mesher *mesher = &cache->meshers[i];
+		mesher->scratch = calloc(1, sizeof(struct chunk_gen_mesh_buffer));
+		mesher->uniform_chunk = calloc(1, sizeof(struct mgc_chunk));
+		chunk_gen_mesh_buffer_init(&mesher->out);
+	}
 
-	cache->gen_mesh_buffer = calloc(1, sizeof(struct chunk_gen_mesh_buffer));
-	chunk_gen_mesh_buffer_init(&cache->gen_mesh_out_buffer);
+	mgc_mutex_init(&cache->structure_lock);
+	mgc_mutex_init(&cache->handoff.lock);
+	mgc_cond_init(&cache->handoff.cond);
+	chunk_mesh_ring_init(&cache->handoff.ring, MGC_CHUNK_MESH_RING_SIZE);
 
 	paged_list_init(
 		&cache->chunk_pool,
@@ -48,30 +210,224 @@ mgc_chunk_cache_init(struct mgc_chunk_cache *cache, struct mgc_memory *memory, s
 		sizeof(struct mgc_chunk_pool_entry)
 	);
 
-	mgc_chunk_spatial_index_init(&cache->index, memory);
+	mgc_chunk_spatial_index_init(&cache->index, cache->cap_entries);
 
-	size_t vbo_pool_mem_cap = 512;
-	struct mgc_chunk_vbo_pool_entry *vbo_pool_mem;
-	vbo_pool_mem = calloc(sizeof(struct mgc_chunk_vbo_pool_entry), vbo_pool_mem_cap);
-	mgc_chunk_vbo_pool_init(&cache->vbo_pool, vbo_pool_mem, vbo_pool_mem_cap);
+	mgc_chunk_vbo_pool_init(&cache->vbo_pool);
+
+	mgc_chunk_loader_start(&cache->loader, cache);
 }
 
-static struct mgc_chunk *
-mgc_chunk_cache_alloc_chunk(struct mgc_chunk_cache *cache)
+void
+mgc_chunk_cache_destroy(struct mgc_chunk_cache *cache)
+{
+	mgc_chunk_loader_stop(&cache->loader);
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	for (size_t entry_i = 0; entry_i < cache->head; entry_i++) {
+		free(cache->entries[entry_i].compressed);
+	}
+	free(cache->compress_queue);
+#endif
+
+	free(cache->entries);
+	free(cache->evict_queue);
+	free(cache->evict_candidates);
+	mgc_chunk_spatial_index_destroy(&cache->index);
+
+	free(cache->mesh_queue);
+	for (size_t i = 0; i < MGC_SIM_MAX_THREADS; i++) {
+		struct mgc_chunk_mesher *mesher = &cache->meshers[i];
+		free(mesher->scratch);
+		free(mesher->uniform_chunk);
+		chunk_gen_mesh_buffer_destroy(&mesher->out);
+	}
+
+	chunk_mesh_ring_destroy(&cache->handoff.ring);
+	mgc_chunk_vbo_pool_destroy(&cache->vbo_pool);
+	mgc_cond_destroy(&cache->handoff.cond);
+	mgc_mutex_destroy(&cache->handoff.lock);
+	mgc_mutex_destroy(&cache->structure_lock);
+
+	cache->entries = NULL;
+	cache->evict_queue = NULL;
+	cache->evict_candidates = NULL;
+	cache->cap_entries = 0;
+	cache->head = 0;
+}
+
+static void
+mgc_chunk_cache_alloc_chunk(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *cache_entry)
 {
 	struct mgc_chunk_pool_entry *entry;
 	entry = cache->chunk_pool_free_list;
 	if (entry) {
 		cache->chunk_pool_free_list = entry->next;
 		entry->next = NULL;
-		return &entry->chunk;
+	} else {
+		size_t id = paged_list_push(&cache->chunk_pool);
+		entry = paged_list_get(&cache->chunk_pool, id);
+		entry->id = id;
+	}
+
+	cache_entry->chunk = &entry->chunk;
+	cache_entry->awake = &entry->awake;
+	cache->num_expanded += 1;
+}
+
+static void
+mgc_chunk_cache_free_chunk(struct mgc_chunk_cache *cache, struct mgc_chunk *chunk)
+{
+	struct mgc_chunk_pool_entry *entry;
+	entry = (struct mgc_chunk_pool_entry *)(
+		(u8 *)chunk - offsetof(struct mgc_chunk_pool_entry, chunk));
+
+	entry->next = cache->chunk_pool_free_list;
+	cache->chunk_pool_free_list = entry;
+
+	assert(cache->num_expanded > 0);
+	cache->num_expanded -= 1;
+}
+
+void
+mgc_chunk_cache_materialise(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *entry)
+{
+	if (entry->chunk) {
+		return;
+	}
+
+	assert(entry->is_uniform);
+
+	TracyCZone(trace, true);
+
+	mgc_chunk_cache_alloc_chunk(cache, entry);
+	mgc_chunk_fill(entry->chunk, entry->uniform);
+	entry->chunk->location = entry->coord;
+
+	// None of the tiles have anything to do until something next to them
+	// changes, which wakes them.
+	memset(entry->awake, 0, sizeof(struct mgc_chunk_awake));
+
+	TracyCZoneEnd(trace);
+}
+
+static struct mgc_chunk_cache_entry *
+mgc_chunk_cache_alloc_entry(struct mgc_chunk_cache *cache)
+{
+	struct mgc_chunk_cache_entry *entry;
+	entry = cache->free_list;
+	if (entry) {
+		cache->free_list = entry->free_list_next;
+	} else if (cache->head < cache->cap_entries) {
+		entry = &cache->entries[cache->head];
+		cache->head += 1;
+	} else {
+		return NULL;
+	}
+
+	memset(entry, 0, sizeof(struct mgc_chunk_cache_entry));
+	cache->num_used_entries += 1;
+
+	return entry;
+}
+
+// Returns the render chunks of a chunk that have tiles next to the chunk at
+// the given offset from it.
+static u64
+mgc_chunk_cache_border_render_chunks(v3i offset)
+{
+	v3i other_min = V3i(
+		offset.x * CHUNK_WIDTH,
+		offset.y * CHUNK_WIDTH,
+		offset.z * CHUNK_HEIGHT
+	);
+	v3i other_max = V3i(
+		other_min.x + CHUNK_WIDTH,
+		other_min.y + CHUNK_WIDTH,
+		other_min.z + CHUNK_HEIGHT
+	);
+
+	u64 result = 0;
+	for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
+		int x = (rchunk_i % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH;
+		int y = ((rchunk_i / RENDER_CHUNKS_PER_CHUNK_WIDTH) % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH;
+		int z = (rchunk_i / RENDER_CHUNKS_PER_CHUNK_LAYER) * RENDER_CHUNK_HEIGHT;
+
+		// The render chunk grown by one tile in every direction.
+		if (x - 1 < other_max.x && x + RENDER_CHUNK_WIDTH  + 1 > other_min.x &&
+			y - 1 < other_max.y && y + RENDER_CHUNK_WIDTH  + 1 > other_min.y &&
+			z - 1 < other_max.z && z + RENDER_CHUNK_HEIGHT + 1 > other_min.z) {
+			result |= 1ULL << rchunk_i;
+		}
 	}
 
-	size_t id = paged_list_push(&cache->chunk_pool);
-	entry = paged_list_get(&cache->chunk_pool, id);
-	entry->id = id;
+	return result;
+}
+
+// Marks the border of the meshed chunks next to coord as dirty, as their
+// meshes cull faces against the tiles at coord. Must be called when those
+// tiles appear or disappear.
+static void
+mgc_chunk_cache_dirty_neighbours(struct mgc_chunk_cache *cache, v3i coord)
+{
+	for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+		v3i offset = chunk_mesh_neighbour_offsets[n];
 
-	return &entry->chunk;
+		isize neighbour_i;
+		neighbour_i = mgc_chunk_cache_find(cache, v3i_add(coord, offset));
+		if (neighbour_i < 0) {
+			continue;
+		}
+
+		// Loaded and dirty chunks are meshed in full anyway.
+		struct mgc_chunk_cache_entry *neighbour = &cache->entries[neighbour_i];
+		if (mgc_chunk_cache_entry_state(neighbour) != MGC_CHUNK_CACHE_MESHED) {
+			continue;
+		}
+
+		mgc_atomic_fetch_or_u64(&neighbour->dirty_mask,
+			mgc_chunk_cache_border_render_chunks(
+				V3i(-offset.x, -offset.y, -offset.z)));
+	}
+}
+
+static void
+mgc_chunk_cache_evict_entry(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *entry)
+{
+	mgccc_debug_trace(entry->coord, "Evicting");
+
+	mgc_chunk_cache_dirty_neighbours(cache, entry->coord);
+
+	for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
+		mgc_chunk_vbo_pool_release(&cache->vbo_pool, entry->mesh[rchunk_i]);
+		entry->mesh[rchunk_i] = (struct mgc_chunk_vbo_alloc){0};
+	}
+
+	if (entry->chunk) {
+		mgc_chunk_cache_free_chunk(cache, entry->chunk);
+		entry->chunk = NULL;
+		entry->awake = NULL;
+	}
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	if (entry->compressed) {
+		cache->num_compressed -= 1;
+		cache->compressed_bytes -= mgc_chunk_compressed_size(entry->compressed);
+		free(entry->compressed);
+		entry->compressed = NULL;
+	}
+#endif
+
+	int err;
+	err = mgc_chunk_spatial_index_remove(&cache->index, entry->coord);
+	assert(!err);
+
+	entry->state = MGC_CHUNK_CACHE_UNUSED;
+	entry->free_list_next = cache->free_list;
+	mgc_atomic_fetch_add_u64(&cache->sim_generation, 1);
+	cache->free_list = entry;
+
+	assert(cache->num_used_entries > 0);
+	cache->num_used_entries -= 1;
 }
 
 isize
@@ -92,30 +448,36 @@ mgc_chunk_cache_find(struct mgc_chunk_cache *cache, v3i coord)
 	return result;
 }
 
-void
+int
 mgc_chunk_cache_request(struct mgc_chunk_cache *cache, v3i coord)
 {
 	isize chunk_i;
 	chunk_i = mgc_chunk_cache_find(cache, coord);
 
 	if (chunk_i >= 0) {
-		return;
+		return 0;
 	}
 
-	// TODO: Implement an eviction strategy.
-	assert(cache->head < cache->cap_entries);
-
-	chunk_i = cache->head;
-	cache->head += 1;
-
 	struct mgc_chunk_cache_entry *entry;
-	entry = &cache->entries[chunk_i];
-	memset(&cache->entries[chunk_i], 0, sizeof(struct mgc_chunk_cache_entry));
+	entry = mgc_chunk_cache_alloc_entry(cache);
+	if (!entry) {
+		// The cache is full. The request is retried the next time the sim
+		// center is set, after the cache tick has had a chance to evict
+		// chunks.
+		return -1;
+	}
+
+	chunk_i = entry - cache->entries;
 
 	entry->state = MGC_CHUNK_CACHE_UNLOADED;
 	entry->coord = coord;
 
+	cache->last_load_id += 1;
+	entry->load_id = cache->last_load_id;
+
 	mgc_chunk_spatial_index_insert(&cache->index, coord, chunk_i);
+
+	return 0;
 }
 
 void
@@ -129,33 +491,97 @@ mgc_chunk_cache_invalidate(struct mgc_chunk_cache *cache, v3i coord)
 	struct mgc_chunk_cache_entry *entry;
 	entry = &cache->entries[chunk_i];
 
-	assert(entry->state != MGC_CHUNK_CACHE_UNUSED);
+	enum mgc_chunk_cache_entry_state state;
+	state = mgc_chunk_cache_entry_state(entry);
+
+	assert(state != MGC_CHUNK_CACHE_UNUSED);
 
-	if (entry->state == MGC_CHUNK_CACHE_MESHED) {
-		entry->state = MGC_CHUNK_CACHE_DIRTY;
+	if (state == MGC_CHUNK_CACHE_MESHED) {
+		mgc_chunk_cache_entry_set_state(entry, MGC_CHUNK_CACHE_DIRTY);
 	}
 }
 
+static void
+mgc_chunk_cache_evict_queue_push(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *entry)
+{
+	// Entries are only queued once, so the queue can not overflow.
+	assert(cache->evict_queue_length < cache->cap_entries);
+
+	cache->evict_queue[cache->evict_queue_length] = entry - cache->entries;
+	cache->evict_queue_length += 1;
+	entry->evict_queued = true;
+	entry->last_touched = cache->tick;
+}
+
 void
 mgc_chunk_cache_set_sim_center(struct mgc_chunk_cache *cache, v3i sim_center)
 {
+	TracyCZone(trace, true);
+
+	if (cache->sim_center.x != sim_center.x ||
+		cache->sim_center.y != sim_center.y ||
+		cache->sim_center.z != sim_center.z) {
+		mgc_atomic_fetch_add_u64(&cache->sim_generation, 1);
+	}
 	cache->sim_center = sim_center;
 
-	struct mgc_aabbi sim_bounds, skirt_bounds;
-	sim_bounds = mgc_aabbi_from_radius(sim_center, MGC_SIM_RADIUS);
+	struct mgc_aabbi skirt_bounds;
 	skirt_bounds = mgc_aabbi_from_radius(sim_center, MGC_SIM_RADIUS+MGC_SIM_SKIRT_RADIUS);
 
-	struct mgc_aabbi load_chunk_bounds, sim_chunk_bounds;
+	struct mgc_aabbi load_chunk_bounds, prev_load_chunk_bounds;
 	load_chunk_bounds = mgc_coord_bounds_tile_to_chunk(skirt_bounds);
-	sim_chunk_bounds = mgc_coord_bounds_tile_to_chunk(sim_bounds);
+	prev_load_chunk_bounds = cache->load_chunk_bounds;
+
+	cache->load_chunk_bounds = load_chunk_bounds;
+
+	// Only the chunks that entered the load bounds have to be requested,
+	// unless some of the previous requests did not fit.
+	struct mgc_aabbi requested_bounds = prev_load_chunk_bounds;
+	if (cache->load_bounds_incomplete) {
+		requested_bounds = (struct mgc_aabbi){0};
+		cache->load_bounds_incomplete = false;
+	}
+
+	struct mgc_aabbi boxes[6];
+	size_t num_boxes;
+	size_t num_requested = 0;
+
+	num_boxes = mgc_aabbi_subtract(load_chunk_bounds, requested_bounds, boxes);
+	for (size_t box_i = 0; box_i < num_boxes; box_i++) {
+		struct mgc_aabbi box = boxes[box_i];
+		for (int z = box.min.z; z < box.max.z; z++) {
+			for (int y = box.min.y; y < box.max.y; y++) {
+				for (int x = box.min.x; x < box.max.x; x++) {
+					if (mgc_chunk_cache_request(cache, V3i(x, y, z))) {
+						cache->load_bounds_incomplete = true;
+					}
+					num_requested += 1;
+				}
+			}
+		}
+	}
+
+	num_boxes = mgc_aabbi_subtract(prev_load_chunk_bounds, load_chunk_bounds, boxes);
+	for (size_t box_i = 0; box_i < num_boxes; box_i++) {
+		struct mgc_aabbi box = boxes[box_i];
+		for (int z = box.min.z; z < box.max.z; z++) {
+			for (int y = box.min.y; y < box.max.y; y++) {
+				for (int x = box.min.x; x < box.max.x; x++) {
+					isize entry_i = mgc_chunk_cache_find(cache, V3i(x, y, z));
+					if (entry_i < 0 || cache->entries[entry_i].evict_queued) {
+						continue;
+					}
 
-	for (int z = load_chunk_bounds.min.z; z < load_chunk_bounds.max.z; z++) {
-		for (int y = load_chunk_bounds.min.y; y < load_chunk_bounds.max.y; y++) {
-			for (int x = load_chunk_bounds.min.x; x < load_chunk_bounds.max.x; x++) {
-				mgc_chunk_cache_request(cache, V3i(x, y, z));
+					mgc_chunk_cache_evict_queue_push(cache, &cache->entries[entry_i]);
+				}
 			}
 		}
 	}
+
+	TracyCPlot("requested chunks", (double)num_requested);
+	TracyCPlot("evict queue length", (double)cache->evict_queue_length);
+
+	TracyCZoneEnd(trace);
 }
 
 void
@@ -163,59 +589,393 @@ mgc_chunk_cache_tick(struct mgc_chunk_cache *cache)
 {
 	TracyCZone(trace, true);
 
+	cache->tick += 1;
+
 	mgc_world_tick(cache->world);
 
+	size_t num_free = cache->cap_entries - cache->num_used_entries;
+	if (num_free < MGC_CHUNK_CACHE_MIN_FREE) {
+		mgc_chunk_cache_evict(cache, MGC_CHUNK_CACHE_EVICT_BATCH);
+	}
+
+	struct mgc_chunk_loader *loader = &cache->loader;
+	size_t num_queued = 0;
+
+	mgc_mutex_lock(&loader->lock);
+
+	while (loader->unused_chunks) {
+		struct mgc_chunk_pool_entry *unused = loader->unused_chunks;
+		loader->unused_chunks = unused->next;
+		mgc_chunk_cache_free_chunk(cache, &unused->chunk);
+	}
 	for (size_t entry_i = 0; entry_i < cache->head; entry_i++) {
 		struct mgc_chunk_cache_entry *entry = &cache->entries[entry_i];
 
-		int err;
+		if (mgc_chunk_cache_entry_state(entry) != MGC_CHUNK_CACHE_UNLOADED) {
+			continue;
+		}
 
-		switch (entry->state) {
-			case MGC_CHUNK_CACHE_UNUSED:
-				break;
+		mgccc_debug_trace(entry->coord, "Loading...");
 
-			case MGC_CHUNK_CACHE_UNLOADED:
-				mgccc_debug_trace(entry->coord, "Loading...");
-				assert(entry->chunk == NULL);
-				entry->chunk = mgc_chunk_cache_alloc_chunk(cache);
-				err = mgc_world_load_chunk(cache->world, entry->chunk, entry->coord);
-				if (err < 0) {
-					entry->state = MGC_CHUNK_CACHE_FAILED;
-					mgccc_debug_trace(entry->coord, "Loading FAILED");
-					break;
-				} else if (err > 0) {
-					entry->state = MGC_CHUNK_CACHE_UNLOADED;
-					mgccc_debug_trace(entry->coord, "Loading YIELD");
-					break;
-				}
-				entry->state = MGC_CHUNK_CACHE_LOADED;
-				mgccc_debug_trace(entry->coord, "Loading OK");
-				break;
+		// Entries that yielded keep their chunk.
+		if (!entry->chunk) {
+			mgc_chunk_cache_alloc_chunk(cache, entry);
+		}
+
+		assert(loader->queue_length < loader->queue_cap);
+		size_t tail = (loader->queue_head + loader->queue_length) % loader->queue_cap;
+		loader->queue[tail] = entry_i;
+		loader->queue_length += 1;
+		num_queued += 1;
+
+		mgc_chunk_cache_entry_set_state(entry, MGC_CHUNK_CACHE_LOADING);
+	}
+
+	if (num_queued > 0) {
+		mgc_cond_broadcast(&loader->cond);
+	}
+	mgc_mutex_unlock(&loader->lock);
+
+	TracyCZoneEnd(trace);
+}
+
+struct mgc_chunk_cache_mesh_job_data {
+	struct mgc_chunk_cache *cache;
+	u32 *entry_ids;
+	// The number of chunks that yielded with render chunks left dirty.
+	volatile u32 num_yielded;
+};
+
+static void
+mgc_chunk_cache_mesh_job(void *data, size_t job_i, size_t worker_i)
+{
+	struct mgc_chunk_cache_mesh_job_data *job = data;
+	struct mgc_chunk_cache *cache = job->cache;
 
+	struct mgc_chunk_cache_entry *entry;
+	entry = &cache->entries[job->entry_ids[job_i]];
+
+	struct mgc_chunk_mesher *mesher = &cache->meshers[worker_i];
+	struct chunk_gen_mesh_ring *ring = &cache->handoff.ring;
+
+	// Chunks that are still loading are treated as empty. They mark this
+	// chunk's border dirty once they are loaded.
+	struct mgc_chunk *neighbours[NUM_LAYER_NEIGHBOURS] = {0};
+	u8 solid_neighbours = 0;
+	for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+		isize neighbour_i;
+		neighbour_i = mgc_chunk_cache_find(cache,
+			v3i_add(entry->coord, chunk_mesh_neighbour_offsets[n]));
+		if (neighbour_i < 0) {
+			continue;
+		}
+
+		struct mgc_chunk_cache_entry *neighbour = &cache->entries[neighbour_i];
+		switch (mgc_chunk_cache_entry_state(neighbour)) {
 			case MGC_CHUNK_CACHE_LOADED:
-			case MGC_CHUNK_CACHE_DIRTY:
 			case MGC_CHUNK_CACHE_MESHED:
+			case MGC_CHUNK_CACHE_DIRTY:
+				neighbours[n] = neighbour->chunk;
+				if (neighbour->is_uniform &&
+					(mgc_mat_props(cache->mat_table, neighbour->uniform.material).flags & MGC_MAT_SOLID)) {
+					solid_neighbours |= 1 << n;
+				}
+				break;
+
+			default:
 				break;
+		}
+	}
+
+	struct mgc_chunk *chunk = entry->chunk;
+	assert(chunk || entry->is_uniform);
+
+	// The render thread sets bits of dirty_mask when it fails to upload a
+	// mesh, so only the bits meshed here are cleared.
+	u64 dirty_mask = mgc_atomic_load_u64(&entry->dirty_mask);
+
+	if (entry->is_uniform) {
+		// Uniform chunks only have faces where they are solid and border
+		// tiles that are not. Their render chunks can be skipped if their
+		// last meshes were empty too.
+		bool is_solid = (mgc_mat_props(cache->mat_table, entry->uniform.material).flags & MGC_MAT_SOLID) != 0;
+		bool is_hidden = !is_solid || solid_neighbours == (1 << NUM_LAYER_NEIGHBOURS) - 1;
+		if (is_hidden && (dirty_mask & entry->visible_mask) == 0) {
+			mgccc_debug_trace(entry->coord, "Meshing SKIPPED (uniform)");
+			mgc_chunk_cache_entry_set_state(entry, MGC_CHUNK_CACHE_MESHED);
+			mgc_atomic_fetch_and_u64(&entry->dirty_mask, ~dirty_mask);
+			return;
+		}
+	}
+
+	if (!chunk) {
+		chunk = mesher->uniform_chunk;
+		mgc_chunk_fill(chunk, entry->uniform);
+		chunk->location = entry->coord;
+	}
+
+	// Every dirty render chunk gets a mesh, even an empty one, so that the
+	// old mesh is removed.
+	u32 num_meshes = 0;
+	for (size_t i = 0; i < RENDER_CHUNKS_PER_CHUNK; i++) {
+		num_meshes += (dirty_mask >> i) & 1;
+	}
+
+	if (!chunk_mesh_ring_reserve(ring, num_meshes)) {
+		mgccc_debug_trace(entry->coord, "Meshing YIELDED (ring full)");
+		mgc_atomic_fetch_add_u32(&job->num_yielded, 1);
+		return;
+	}
+
+	mgccc_debug_trace(entry->coord, "Meshing...");
+	struct mgc_chunk_gen_mesh_result res = {0};
+	res = chunk_gen_mesh(
+		mesher->scratch,
+		&mesher->out,
+		cache->mat_table,
+		chunk,
+		neighbours,
+		solid_neighbours,
+		dirty_mask
+	);
+
+	if (res.err < 0) {
+		chunk_mesh_ring_unreserve(ring, num_meshes);
+		mgccc_debug_trace(entry->coord, "Meshing FAILED");
+		mgc_chunk_cache_entry_set_state(entry, MGC_CHUNK_CACHE_FAILED);
+		mgc_atomic_fetch_add_u64(&cache->sim_generation, 1);
+		return;
+	}
+
+	// Push in allocation order, as the render thread releases the meshes
+	// in the order it pops them. Even if the out buffer filled up, the
+	// meshes that were made are handed over.
+	u32 num_pushed = 0;
+	for (size_t i = 0; i < RENDER_CHUNKS_PER_CHUNK; i++) {
+		if (res.buffer[i]) {
+			if (res.buffer[i]->num_verts > 0) {
+				entry->visible_mask |= 1ULL << i;
+			} else {
+				entry->visible_mask &= ~(1ULL << i);
+			}
+
+			res.buffer[i]->load_id = entry->load_id;
+			chunk_mesh_ring_push(ring, res.buffer[i]);
+			num_pushed += 1;
+		}
+	}
+
+	if (num_pushed < num_meshes) {
+		chunk_mesh_ring_unreserve(ring, num_meshes - num_pushed);
+	}
+
+	// The entry is MESHED even if some render chunks are left, so that
+	// only those are meshed when it is resumed.
+	mgc_chunk_cache_entry_set_state(entry, MGC_CHUNK_CACHE_MESHED);
+
+	if (res.err > 0) {
+		mgc_atomic_fetch_and_u64(&entry->dirty_mask, ~res.meshed_mask);
+		mgccc_debug_trace(entry->coord, "Meshing YIELDED");
+		mgc_atomic_fetch_add_u32(&job->num_yielded, 1);
+		return;
+	}
+
+	mgc_atomic_fetch_and_u64(&entry->dirty_mask, ~dirty_mask);
+	mgccc_debug_trace(entry->coord, "Meshing OK");
+}
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+void
+mgc_chunk_cache_expand(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *entry)
+{
+	if (!entry->compressed) {
+		return;
+	}
+
+	TracyCZone(trace, true);
+
+	mgccc_debug_trace(entry->coord, "Expanding");
+
+	mgc_chunk_cache_alloc_chunk(cache, entry);
+	mgc_chunk_decompress(entry->compressed, entry->chunk);
+
+	// The awake masks are not kept while compressed.
+	mgc_chunk_awake_wake_all(entry->awake);
+	entry->sim_epoch = 0;
+
+	cache->num_compressed -= 1;
+	cache->compressed_bytes -= mgc_chunk_compressed_size(entry->compressed);
+	free(entry->compressed);
+	entry->compressed = NULL;
+
+	TracyCZoneEnd(trace);
+}
 
+// Returns true if neither the sim nor the mesher is going to read the
+// entry's tiles any time soon.
+static bool
+mgc_chunk_cache_is_idle(
+		struct mgc_chunk_cache *cache,
+		struct mgc_chunk_cache_entry *entry,
+		struct mgc_aabbi sim_reach)
+{
+	if (!entry->chunk || entry->incompressible ||
+		mgc_chunk_cache_entry_state(entry) != MGC_CHUNK_CACHE_MESHED ||
+		entry->dirty_mask != 0 ||
+		mgc_aabbi_contains(sim_reach, entry->coord)) {
+		return false;
+	}
+
+	// Neighbours that are going to be meshed read this chunk's border.
+	for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+		isize neighbour_i;
+		neighbour_i = mgc_chunk_cache_find(cache,
+			v3i_add(entry->coord, chunk_mesh_neighbour_offsets[n]));
+		if (neighbour_i < 0) {
+			continue;
+		}
+
+		struct mgc_chunk_cache_entry *neighbour = &cache->entries[neighbour_i];
+		switch (mgc_chunk_cache_entry_state(neighbour)) {
 			case MGC_CHUNK_CACHE_FAILED:
 				break;
+
+			case MGC_CHUNK_CACHE_MESHED:
+				if (neighbour->dirty_mask != 0) {
+					return false;
+				}
+				break;
+
+			default:
+				return false;
 		}
 	}
 
+	return true;
+}
+
+// Returns the entry's chunk to the pool, and its pages to the system.
+static void
+mgc_chunk_cache_discard_chunk(struct mgc_chunk_cache *cache, struct mgc_chunk_cache_entry *entry)
+{
+	struct mgc_chunk_pool_entry *pool_entry;
+	pool_entry = (struct mgc_chunk_pool_entry *)(
+		(u8 *)entry->chunk - offsetof(struct mgc_chunk_pool_entry, chunk));
+	mgc_memory_discard(&pool_entry->chunk,
+		sizeof(struct mgc_chunk_pool_entry) - offsetof(struct mgc_chunk_pool_entry, chunk));
+
+	mgc_chunk_cache_free_chunk(cache, entry->chunk);
+	entry->chunk = NULL;
+	entry->awake = NULL;
+}
+
+struct mgc_chunk_cache_compress_job_data {
+	struct mgc_chunk_cache *cache;
+	u32 *entry_ids;
+};
+
+static void
+mgc_chunk_cache_compress_job(void *data, size_t job_i, size_t worker_i)
+{
+	struct mgc_chunk_cache_compress_job_data *job = data;
+	struct mgc_chunk_cache_entry *entry;
+	entry = &job->cache->entries[job->entry_ids[job_i]];
+
+	entry->compressed = mgc_chunk_compress(entry->chunk);
+	if (!entry->compressed) {
+		entry->incompressible = true;
+	}
+}
+
+// Compresses the chunks that are out of the sim's reach and fully meshed, and
+// gives the pages of their tiles back to the system.
+static void
+mgc_chunk_cache_compress_idle(struct mgc_chunk_cache *cache, struct mgc_job_pool *pool)
+{
+	TracyCZone(trace, true);
+
+	// The chunks the sim reads from, as in mgc_sim_find_chunks.
+	struct mgc_aabbi sim_bounds, sim_reach;
+	sim_bounds = mgc_aabbi_from_radius(cache->sim_center, MGC_SIM_RADIUS);
+	sim_reach = mgc_coord_bounds_tile_to_chunk(sim_bounds);
+	sim_reach.min = v3i_add(sim_reach.min, V3i(-1, -1, -1));
+	sim_reach.max = v3i_add(sim_reach.max, V3i(1, 1, 1));
+
+	size_t num_queued = 0;
+	for (size_t entry_i = 0; entry_i < cache->head &&
+			num_queued < MGC_CHUNK_CACHE_COMPRESS_BATCH; entry_i++) {
+		struct mgc_chunk_cache_entry *entry = &cache->entries[entry_i];
+		if (!mgc_chunk_cache_is_idle(cache, entry, sim_reach)) {
+			continue;
+		}
+
+		// Uniform chunks can just drop their tiles.
+		if (entry->is_uniform) {
+			mgc_chunk_cache_discard_chunk(cache, entry);
+			continue;
+		}
+
+		cache->compress_queue[num_queued] = entry_i;
+		num_queued += 1;
+	}
+
+	struct mgc_chunk_cache_compress_job_data job = {0};
+	job.cache = cache;
+	job.entry_ids = cache->compress_queue;
+
+	mgc_job_pool_run(pool, mgc_chunk_cache_compress_job, &job, num_queued);
+
+	for (size_t i = 0; i < num_queued; i++) {
+		struct mgc_chunk_cache_entry *entry = &cache->entries[cache->compress_queue[i]];
+		if (!entry->compressed) {
+			continue;
+		}
+
+		mgccc_debug_trace(entry->coord, "Compressed");
+
+		mgc_chunk_cache_discard_chunk(cache, entry);
+
+		cache->num_compressed += 1;
+		cache->compressed_bytes += mgc_chunk_compressed_size(entry->compressed);
+	}
+
+	TracyCPlot("compressed chunks", (double)cache->num_compressed);
+	TracyCPlot("compressed chunk memory (MB)",
+		(double)cache->compressed_bytes / 1000000.0);
+
 	TracyCZoneEnd(trace);
 }
+#endif
 
 void
-mgc_chunk_cache_mesh(struct mgc_chunk_cache *cache)
+mgc_chunk_cache_mesh(struct mgc_chunk_cache *cache, struct mgc_job_pool *pool)
 {
 	TracyCZone(trace, true);
 
+	assert(mgc_job_pool_num_workers(pool) <= MGC_SIM_MAX_THREADS);
+
+	// Chunks that are meshed in full have new tiles on their border, so
+	// their neighbours must be meshed again as well. Do this before
+	// queueing, as it can make entries visited earlier dirty.
 	for (size_t entry_i = 0; entry_i < cache->head; entry_i++) {
 		struct mgc_chunk_cache_entry *entry = &cache->entries[entry_i];
+		enum mgc_chunk_cache_entry_state state;
+		state = mgc_chunk_cache_entry_state(entry);
 
-		switch (entry->state) {
+		if (state == MGC_CHUNK_CACHE_LOADED ||
+			state == MGC_CHUNK_CACHE_DIRTY) {
+			mgc_chunk_cache_dirty_neighbours(cache, entry->coord);
+		}
+	}
+
+	size_t num_queued = 0;
+	for (size_t entry_i = 0; entry_i < cache->head; entry_i++) {
+		struct mgc_chunk_cache_entry *entry = &cache->entries[entry_i];
+
+		switch (mgc_chunk_cache_entry_state(entry)) {
 			case MGC_CHUNK_CACHE_UNUSED:
 			case MGC_CHUNK_CACHE_UNLOADED:
+			case MGC_CHUNK_CACHE_LOADING:
 			case MGC_CHUNK_CACHE_FAILED:
 				break;
 
@@ -225,312 +985,557 @@ mgc_chunk_cache_mesh(struct mgc_chunk_cache *cache)
 				// fallthrough
 			case MGC_CHUNK_CACHE_MESHED:
 				if (entry->dirty_mask) {
-					mgccc_debug_trace(entry->coord, "Meshing...");
-					struct mgc_chunk_gen_mesh_result res = {0};
-					res = chunk_gen_mesh(
-						cache->gen_mesh_buffer,
-						&cache->gen_mesh_out_buffer,
-						cache->mat_table,
-						entry->chunk,
-						entry->dirty_mask
-					);
-
-					if (res.err > 0) {
-						mgccc_debug_trace(entry->coord, "Meshing YIELDED");
-						break;
-					} else if (res.err < 0) {
-						mgccc_debug_trace(entry->coord, "Meshing FAILED");
-						entry->state = MGC_CHUNK_CACHE_FAILED;
-						continue;
-					}
-
-					entry->dirty_mask = 0;
-					entry->state = MGC_CHUNK_CACHE_MESHED;
-					mgccc_debug_trace(entry->coord, "Meshing OK");
-					// fallthrough
+					cache->mesh_queue[num_queued] = entry_i;
+					num_queued += 1;
 				}
 				break;
 		}
 	}
 
-	TracyCZoneEnd(trace);
-}
-
-void
-mgc_chunk_cache_render_tick(struct mgc_chunk_cache *cache)
-{
-	if (cache->update_state == MGC_CHUNK_CACHE_UPDATE_RENDER) {
-		TracyCZone(trace, true);
-
-		struct chunk_gen_mesh *mesh;
-		while ((mesh = chunk_mesh_buffer_pop(&cache->gen_mesh_out_buffer)) != NULL) {
-			isize chunk_idx = mgc_chunk_cache_find(cache, mesh->chunk);
-			struct mgc_chunk_cache_entry *entry;
-			entry = &cache->entries[chunk_idx];
-			size_t rchunk_idx = mesh->render_chunk_idx;
-
-			struct mgc_chunk_vbo_pool_entry *old_vbo;
-			old_vbo = entry->mesh[rchunk_idx];
-
-			if (mesh->num_verts > 0) {
-				entry->mesh[rchunk_idx] = mgc_chunk_vbo_pool_alloc(
-					&cache->vbo_pool,
-					mesh->data,
-					mesh->num_verts
-				);
-			} else {
-				entry->mesh[rchunk_idx] = NULL;
-			}
-
-			if (old_vbo) {
-				mgc_chunk_vbo_pool_release(&cache->vbo_pool, old_vbo);
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	// The mesher reads the tiles of the chunk and its neighbours.
+	for (size_t i = 0; i < num_queued; i++) {
+		struct mgc_chunk_cache_entry *entry = &cache->entries[cache->mesh_queue[i]];
+		entry->incompressible = false;
+		mgc_chunk_cache_expand(cache, entry);
+
+		for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+			isize neighbour_i;
+			neighbour_i = mgc_chunk_cache_find(cache,
+				v3i_add(entry->coord, chunk_mesh_neighbour_offsets[n]));
+			if (neighbour_i >= 0) {
+				mgc_chunk_cache_expand(cache, &cache->entries[neighbour_i]);
 			}
 		}
+	}
+#endif
 
-		cache->update_state = MGC_CHUNK_CACHE_UPDATE_SIM;
+	struct mgc_chunk_cache_mesh_job_data job = {0};
+	job.cache = cache;
+	job.entry_ids = cache->mesh_queue;
 
-		TracyCZoneEnd(trace);
+	mgc_job_pool_run(pool, mgc_chunk_cache_mesh_job, &job, num_queued);
+
+	// Chunks yield when the render thread has not drained the ring or the
+	// out buffers yet, so these show how close meshing is to stalling.
+	size_t out_used = 0;
+	for (size_t i = 0; i < MGC_SIM_MAX_THREADS; i++) {
+		struct chunk_gen_mesh_out_buffer *out = &cache->meshers[i].out;
+		out_used += out->head - mgc_atomic_load_u64(&out->tail);
 	}
+
+	TracyCPlot("mesh ring occupancy (meshes)",
+		(double)mgc_atomic_load_u32(&cache->handoff.ring.num_reserved));
+	TracyCPlot("mesh out buffer occupancy (MB)",
+		(double)out_used / 1000000.0);
+	TracyCPlot("meshing yielded (chunks)", (double)job.num_yielded);
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	mgc_chunk_cache_compress_idle(cache, pool);
+#endif
+
+	TracyCPlot("expanded chunks", (double)cache->num_expanded);
+	TracyCPlot("expanded chunk memory (MB)",
+		(double)(cache->num_expanded * sizeof(struct mgc_chunk_pool_entry)) / 1000000.0);
+
+	TracyCZoneEnd(trace);
 }
 
 void
-mgc_chunk_cache_make_render_queue(
-		struct mgc_chunk_cache *cache,
-		size_t queue_cap,
-		struct mgc_chunk_render_entry *queue,
-		size_t *queue_head)
+mgc_chunk_cache_render_tick(struct mgc_chunk_cache *cache)
 {
+	struct mgc_chunk_cache_handoff *handoff = &cache->handoff;
+
 	TracyCZone(trace, true);
 
-	for (size_t i = 0; i < cache->head; i++) {
-		assert(*queue_head < queue_cap);
+	struct chunk_gen_mesh *mesh;
+	while ((mesh = chunk_mesh_ring_pop(&handoff->ring)) != NULL) {
+		isize chunk_idx = mgc_chunk_cache_find(cache, mesh->chunk);
+		if (chunk_idx < 0) {
+			// The chunk was evicted after it was meshed.
+			chunk_mesh_buffer_release(mesh);
+			continue;
+		}
 
 		struct mgc_chunk_cache_entry *entry;
-		entry = &cache->entries[i];
+		entry = &cache->entries[chunk_idx];
 
-		if (entry->state == MGC_CHUNK_CACHE_MESHED ||
-			entry->state == MGC_CHUNK_CACHE_DIRTY) {
-			for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
-				if (entry->mesh[rchunk_i] && entry->mesh[rchunk_i]->mesh.numVertices > 0) {
-					v3i chunk_offset = V3i(
-						entry->coord.x * CHUNK_WIDTH,
-						entry->coord.y * CHUNK_WIDTH,
-						entry->coord.z * CHUNK_HEIGHT
-					);
-					v3i rchunk_offset = V3i(
-						(rchunk_i % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH,
-						((rchunk_i / RENDER_CHUNKS_PER_CHUNK_WIDTH) % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH,
-						(rchunk_i / RENDER_CHUNKS_PER_CHUNK_LAYER) * RENDER_CHUNK_HEIGHT
-					);
-
-					assert(*queue_head < queue_cap);
-					struct mgc_chunk_render_entry *render_entry;
-					render_entry = &queue[*queue_head];
-
-					render_entry->mesh = entry->mesh[rchunk_i]->mesh;
-					render_entry->coord = v3i_add(chunk_offset, rchunk_offset);
-
-					*queue_head += 1;
-				}
-			}
+		if (entry->load_id != mesh->load_id) {
+			// The chunk was evicted after it was meshed, and has been
+			// requested again since.
+			chunk_mesh_buffer_release(mesh);
+			continue;
 		}
+		size_t rchunk_idx = mesh->render_chunk_idx;
+
+		struct mgc_chunk_vbo_alloc alloc;
+		int err = mgc_chunk_vbo_pool_alloc(
+			&cache->vbo_pool,
+			mesh->data,
+			mesh->num_verts,
+			&alloc
+		);
+		if (err) {
+			// Keep drawing the old mesh, and have the render chunk meshed
+			// again so that the upload is retried.
+			mgc_atomic_fetch_or_u64(&entry->dirty_mask, 1ULL << rchunk_idx);
+		} else {
+			mgc_chunk_vbo_pool_release(&cache->vbo_pool, entry->mesh[rchunk_idx]);
+			entry->mesh[rchunk_idx] = alloc;
+		}
+
+		chunk_mesh_buffer_release(mesh);
 	}
 
+	mgc_mutex_lock(&handoff->lock);
+	if (handoff->published) {
+		handoff->published = false;
+		mgc_cond_broadcast(&handoff->cond);
+	}
+	mgc_mutex_unlock(&handoff->lock);
+
 	TracyCZoneEnd(trace);
 }
 
-static struct mgc_chunk_spatial_index_node *
-mgc_chunk_spatial_index_alloc(struct mgc_chunk_spatial_index *idx)
+bool
+mgc_chunk_cache_try_lock_structure(struct mgc_chunk_cache *cache)
 {
-	if (idx->free_list) {
-		struct mgc_chunk_spatial_index_node *result = NULL;
-		result = idx->free_list;
-		idx->free_list = result->free_list_next;
-		memset(result, 0, sizeof(struct mgc_chunk_spatial_index_node));
-		return result;
+	if (mgc_mutex_try_lock(&cache->structure_lock)) {
+		return true;
 	}
 
-	size_t id;
-	id = paged_list_push(&idx->nodes);
-	return paged_list_get(&idx->nodes, id);
+	mgc_mutex_lock(&cache->handoff.lock);
+	cache->handoff.structure_pending = true;
+	mgc_mutex_unlock(&cache->handoff.lock);
+
+	return false;
 }
 
-static void
-mgc_chunk_spatial_index_free(struct mgc_chunk_spatial_index *idx, struct mgc_chunk_spatial_index_node *node)
+void
+mgc_chunk_cache_unlock_structure(struct mgc_chunk_cache *cache)
 {
-	memset(node, 0, sizeof(struct mgc_chunk_spatial_index_node));
-	node->free_list_next = idx->free_list;
-	idx->free_list = node;
-}
+	mgc_mutex_unlock(&cache->structure_lock);
 
-#define COORD_OFFSET 100
+	mgc_mutex_lock(&cache->handoff.lock);
+	cache->handoff.structure_pending = false;
+	mgc_cond_broadcast(&cache->handoff.cond);
+	mgc_mutex_unlock(&cache->handoff.lock);
+}
 
-static inline v3u
-world_to_idx(v3i c)
+void
+mgc_chunk_cache_sim_begin(struct mgc_chunk_cache *cache)
 {
-	return V3u(
-		c.x + COORD_OFFSET,
-		c.y + COORD_OFFSET,
-		c.z + COORD_OFFSET
-	);
+	mgc_mutex_lock(&cache->structure_lock);
 }
 
-static inline v3i
-idx_to_world(v3u c)
+bool
+mgc_chunk_cache_sim_end(struct mgc_chunk_cache *cache)
 {
-	return V3i(
-		c.x - COORD_OFFSET,
-		c.y - COORD_OFFSET,
-		c.z - COORD_OFFSET
-	);
-}
+	struct mgc_chunk_cache_handoff *handoff = &cache->handoff;
 
-#undef COORD_OFFSET
+	mgc_mutex_unlock(&cache->structure_lock);
+
+	mgc_mutex_lock(&handoff->lock);
+
+#ifdef TRACY_ENABLE
+	u64 wait_begin = mgc_time_ns();
+#endif
+	while (handoff->published && !handoff->should_quit) {
+		mgc_cond_wait(&handoff->cond, &handoff->lock);
+	}
+#ifdef TRACY_ENABLE
+	u64 wait_upload_end = mgc_time_ns();
+#endif
+
+	if (!handoff->should_quit) {
+		handoff->published = true;
+	}
+
+	while (handoff->structure_pending && !handoff->should_quit) {
+		mgc_cond_wait(&handoff->cond, &handoff->lock);
+	}
+#ifdef TRACY_ENABLE
+	u64 wait_structure_end = mgc_time_ns();
+#endif
+
+	bool should_continue = !handoff->should_quit;
+	mgc_mutex_unlock(&handoff->lock);
+
+#ifdef TRACY_ENABLE
+	TracyCPlot("sim wait for upload (ms)",
+		(double)(wait_upload_end - wait_begin) / 1000000.0);
+	TracyCPlot("sim wait for structure (ms)",
+		(double)(wait_structure_end - wait_upload_end) / 1000000.0);
+#endif
+
+	return should_continue;
+}
 
-static inline v3u
-idx_to_level(v3u c, unsigned int level) 
+void
+mgc_chunk_cache_sim_quit(struct mgc_chunk_cache *cache)
 {
-	return V3u(
-		c.x >> (MGC_CHUNK_SPATIAL_INDEX_WIDTH_LOG2*level),
-		c.y >> (MGC_CHUNK_SPATIAL_INDEX_WIDTH_LOG2*level),
-		c.z >> (MGC_CHUNK_SPATIAL_INDEX_WIDTH_LOG2*level)
-	);
+	mgc_mutex_lock(&cache->handoff.lock);
+	cache->handoff.should_quit = true;
+	mgc_cond_broadcast(&cache->handoff.cond);
+	mgc_mutex_unlock(&cache->handoff.lock);
 }
 
 static int
-idx_to_child_id(v3u c)
+mgc_chunk_cache_evict_candidate_compare(const void *lhs_ptr, const void *rhs_ptr)
 {
-	int result = 0;
-	result += (c.x % MGC_CHUNK_SPATIAL_INDEX_WIDTH);
-	result += (c.y % MGC_CHUNK_SPATIAL_INDEX_WIDTH) * MGC_CHUNK_SPATIAL_INDEX_WIDTH;
-	result += (c.z % MGC_CHUNK_SPATIAL_INDEX_WIDTH) * MGC_CHUNK_SPATIAL_INDEX_WIDTH * MGC_CHUNK_SPATIAL_INDEX_WIDTH;
-	assert(result < MGC_CHUNK_SPATIAL_INDEX_LEAFS);
-	return result;
+	const struct mgc_chunk_cache_evict_candidate *lhs = lhs_ptr, *rhs = rhs_ptr;
+
+	// Furthest away first.
+	if (lhs->distance != rhs->distance) {
+		return lhs->distance < rhs->distance ? 1 : -1;
+	}
+
+	// Least recently touched first.
+	if (lhs->last_touched != rhs->last_touched) {
+		return lhs->last_touched < rhs->last_touched ? -1 : 1;
+	}
+
+	return 0;
 }
 
-void
-mgc_chunk_spatial_index_init(struct mgc_chunk_spatial_index *idx, struct mgc_memory *mem)
+size_t
+mgc_chunk_cache_evict(struct mgc_chunk_cache *cache, size_t max_evict)
 {
-	memset(idx, 0, sizeof(struct mgc_chunk_spatial_index));
-	paged_list_init(&idx->nodes, mem, sizeof(struct mgc_chunk_spatial_index_node));
+	TracyCZone(trace, true);
+
+	struct mgc_chunk_cache_evict_candidate *candidates;
+	candidates = cache->evict_candidates;
+	size_t num_candidates = 0;
+
+	// Entries that stay queued are compacted to the front of the queue.
+	size_t num_queued = 0;
+
+	for (size_t i = 0; i < cache->evict_queue_length; i++) {
+		u32 entry_i = cache->evict_queue[i];
+
+		struct mgc_chunk_cache_entry *entry;
+		entry = &cache->entries[entry_i];
+
+		enum mgc_chunk_cache_entry_state state;
+		state = mgc_chunk_cache_entry_state(entry);
+		assert(state != MGC_CHUNK_CACHE_UNUSED);
+
+		// The entry came back into the load bounds before it was evicted.
+		if (mgc_aabbi_contains(cache->load_chunk_bounds, entry->coord)) {
+			entry->evict_queued = false;
+			continue;
+		}
+
+		// Entries that are being loaded are owned by the loader threads.
+		// They stay queued until they are loaded.
+		if (state == MGC_CHUNK_CACHE_LOADING) {
+			cache->evict_queue[num_queued] = entry_i;
+			num_queued += 1;
+			continue;
+		}
+
+		v3i center = mgc_chunk_coord_to_world(entry->coord);
+		i64 dx = (i64)center.x + CHUNK_WIDTH/2  - cache->sim_center.x;
+		i64 dy = (i64)center.y + CHUNK_WIDTH/2  - cache->sim_center.y;
+		i64 dz = (i64)center.z + CHUNK_HEIGHT/2 - cache->sim_center.z;
+
+		struct mgc_chunk_cache_evict_candidate *candidate;
+		candidate = &candidates[num_candidates];
+		num_candidates += 1;
+
+		candidate->entry_i = entry_i;
+		candidate->distance = dx*dx + dy*dy + dz*dz;
+		candidate->last_touched = entry->last_touched;
+	}
+
+	qsort(candidates, num_candidates,
+		sizeof(struct mgc_chunk_cache_evict_candidate),
+		mgc_chunk_cache_evict_candidate_compare);
+
+	size_t num_evict = min(num_candidates, max_evict);
+	for (size_t i = 0; i < num_evict; i++) {
+		struct mgc_chunk_cache_entry *entry;
+		entry = &cache->entries[candidates[i].entry_i];
+		entry->evict_queued = false;
+		mgc_chunk_cache_evict_entry(cache, entry);
+	}
+
+	for (size_t i = num_evict; i < num_candidates; i++) {
+		cache->evict_queue[num_queued] = candidates[i].entry_i;
+		num_queued += 1;
+	}
+	cache->evict_queue_length = num_queued;
+
+	TracyCZoneEnd(trace);
+
+	return num_evict;
 }
 
-int
-mgc_chunk_spatial_index_insert(struct mgc_chunk_spatial_index *idx, v3i chunk_coord, u32 chunk_id)
+void
+mgc_chunk_render_queue_free(struct mgc_chunk_render_queue *queue)
 {
-	v3u chunk = world_to_idx(chunk_coord);
-
-	if (!idx->root) {
-		struct mgc_chunk_spatial_index_node *new_root;
-		new_root = mgc_chunk_spatial_index_alloc(idx);
-		new_root->level = 0;
-		new_root->coord = idx_to_level(chunk, new_root->level+1);
+	free(queue->entries);
+	queue->entries = NULL;
+	queue->length = 0;
+	queue->cap = 0;
+}
 
-		for (size_t i = 0; i < MGC_CHUNK_SPATIAL_INDEX_LEAFS; i++) {
-			new_root->chunks[i].index = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+static void
+mgc_chunk_render_queue_push(
+		struct mgc_chunk_render_queue *queue,
+		struct mgc_chunk_render_entry entry)
+{
+	if (queue->length >= queue->cap) {
+		size_t new_cap = queue->cap ? queue->cap * 2 : 1024;
+		struct mgc_chunk_render_entry *new_entries;
+		new_entries = realloc(queue->entries, new_cap * sizeof(struct mgc_chunk_render_entry));
+		if (!new_entries) {
+			panic("Failed to grow the render queue.");
 		}
-		idx->root = new_root;
+		queue->entries = new_entries;
+		queue->cap = new_cap;
 	}
 
-	while (!v3u_equal(idx->root->coord, idx_to_level(chunk, idx->root->level+1))) {
-		struct mgc_chunk_spatial_index_node *new_root;
-		new_root = mgc_chunk_spatial_index_alloc(idx);
-		new_root->level = idx->root->level + 1;
-		new_root->coord = idx_to_level(idx->root->coord, 1);
-		int child_id = idx_to_child_id(idx->root->coord);
-		new_root->children[child_id] = idx->root;
-		idx->root = new_root;
+	queue->entries[queue->length] = entry;
+	queue->length += 1;
+}
+
+static int
+mgc_chunk_render_entry_compare(const void *lhs_ptr, const void *rhs_ptr)
+{
+	const struct mgc_chunk_render_entry *lhs = lhs_ptr, *rhs = rhs_ptr;
+
+	// Closest first.
+	if (lhs->distance != rhs->distance) {
+		return lhs->distance < rhs->distance ? -1 : 1;
 	}
 
-	struct mgc_chunk_spatial_index_node *node;
-	node = idx->root;
+	return 0;
+}
 
-	while (node->level > 0) {
-		v3u child_coord = idx_to_level(chunk, node->level);
-		int child_id = idx_to_child_id(child_coord);
+void
+mgc_chunk_cache_make_render_queue(
+		struct mgc_chunk_cache *cache,
+		struct mgc_frustum *frustum,
+		v3 camera_pos,
+		struct mgc_chunk_render_queue *queue)
+{
+	TracyCZone(trace, true);
 
-		if (!node->children[child_id]) {
-			struct mgc_chunk_spatial_index_node *new_node;
-			new_node = mgc_chunk_spatial_index_alloc(idx);
-			new_node->level = node->level - 1;
-			new_node->coord = child_coord;
-			node->children[child_id] = new_node;
+	queue->length = 0;
+	size_t num_culled = 0;
 
-			if (new_node->level == 0) {
-				for (size_t i = 0; i < MGC_CHUNK_SPATIAL_INDEX_LEAFS; i++) {
-					new_node->chunks[i].index = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
-				}
+	for (size_t i = 0; i < cache->head; i++) {
+		struct mgc_chunk_cache_entry *entry;
+		entry = &cache->entries[i];
+
+		enum mgc_chunk_cache_entry_state state;
+		state = mgc_chunk_cache_entry_state(entry);
+
+		if (state != MGC_CHUNK_CACHE_MESHED &&
+			state != MGC_CHUNK_CACHE_DIRTY) {
+			continue;
+		}
+
+		v3i chunk_offset = V3i(
+			entry->coord.x * CHUNK_WIDTH,
+			entry->coord.y * CHUNK_WIDTH,
+			entry->coord.z * CHUNK_HEIGHT
+		);
+
+		v3 min, max;
+
+		// Skip the render chunks of chunks that are entirely outside.
+		mgc_grid_draw_bounds(chunk_offset,
+			V3i(CHUNK_WIDTH, CHUNK_WIDTH, CHUNK_HEIGHT), &min, &max);
+		if (!mgc_frustum_intersects_aabb(frustum, min, max)) {
+			for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
+				num_culled += entry->mesh[rchunk_i].num_vertices > 0;
 			}
+			continue;
 		}
 
-		node = node->children[child_id];
+		for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
+			if (entry->mesh[rchunk_i].num_vertices == 0) {
+				continue;
+			}
+
+			v3i rchunk_offset = V3i(
+				(rchunk_i % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH,
+				((rchunk_i / RENDER_CHUNKS_PER_CHUNK_WIDTH) % RENDER_CHUNKS_PER_CHUNK_WIDTH) * RENDER_CHUNK_WIDTH,
+				(rchunk_i / RENDER_CHUNKS_PER_CHUNK_LAYER) * RENDER_CHUNK_HEIGHT
+			);
+
+			struct mgc_chunk_render_entry render_entry = {0};
+			render_entry.mesh = entry->mesh[rchunk_i];
+			render_entry.coord = v3i_add(chunk_offset, rchunk_offset);
+
+			mgc_grid_draw_bounds(render_entry.coord,
+				V3i(RENDER_CHUNK_WIDTH, RENDER_CHUNK_WIDTH, RENDER_CHUNK_HEIGHT),
+				&min, &max);
+			if (!mgc_frustum_intersects_aabb(frustum, min, max)) {
+				num_culled += 1;
+				continue;
+			}
+
+			v3 d = V3(
+				(min.x + max.x) * 0.5f - camera_pos.x,
+				(min.y + max.y) * 0.5f - camera_pos.y,
+				(min.z + max.z) * 0.5f - camera_pos.z
+			);
+			render_entry.distance = d.x * d.x + d.y * d.y + d.z * d.z;
+
+			mgc_chunk_render_queue_push(queue, render_entry);
+		}
 	}
 
-	assert(node && node->level == 0);
+	// Front-to-back so the depth test can reject hidden fragments early.
+	if (queue->length > 1) {
+		qsort(queue->entries, queue->length,
+			sizeof(struct mgc_chunk_render_entry),
+			mgc_chunk_render_entry_compare);
+	}
 
-	int child_id = idx_to_child_id(chunk);
-	if (node->chunks[child_id].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
-		return -1;
+	TracyCPlot("render queue (render chunks)", (double)queue->length);
+	TracyCPlot("render queue culled (render chunks)", (double)num_culled);
+
+	TracyCZoneEnd(trace);
+}
+
+static void
+mgc_chunk_spatial_index_alloc_entries(struct mgc_chunk_spatial_index *idx, size_t cap)
+{
+	assert((cap & (cap - 1)) == 0);
+
+	idx->cap_entries = cap;
+	idx->num_entries = 0;
+	idx->hash_shift = 64;
+	for (size_t c = cap; c > 1; c >>= 1) {
+		idx->hash_shift -= 1;
+	}
+	idx->entries = calloc(cap, sizeof(struct mgc_chunk_spatial_index_entry));
+	for (size_t i = 0; i < cap; i++) {
+		idx->entries[i].index = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
 	}
+}
 
-	node->chunks[child_id].index = chunk_id;
-	return 0;
+// Returns the slot containing key, or the empty slot where it should be
+// inserted.
+static inline size_t
+mgc_chunk_spatial_index_probe(struct mgc_chunk_spatial_index *idx, u64 key)
+{
+	size_t mask = idx->cap_entries - 1;
+	size_t slot = mgc_chunk_spatial_index_slot(idx, key);
+
+	while (idx->entries[slot].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK &&
+			idx->entries[slot].key != key) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
 }
 
-int
-mgc_chunk_spatial_index_remove(struct mgc_chunk_spatial_index *idx, v3i chunk_coord)
+static void
+mgc_chunk_spatial_index_grow(struct mgc_chunk_spatial_index *idx)
 {
-	v3u chunk = world_to_idx(chunk_coord);
+	struct mgc_chunk_spatial_index_entry *old_entries = idx->entries;
+	size_t old_cap = idx->cap_entries;
 
-	struct mgc_chunk_spatial_index_node *node;
-	node = idx->root;
+	mgc_chunk_spatial_index_alloc_entries(idx, old_cap * 2);
 
-	while (node && node->level > 0) {
-		v3u child_coord = idx_to_level(chunk, node->level);
-		int child_id = idx_to_child_id(child_coord);
+	for (size_t i = 0; i < old_cap; i++) {
+		if (old_entries[i].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
+			size_t slot = mgc_chunk_spatial_index_probe(idx, old_entries[i].key);
+			idx->entries[slot] = old_entries[i];
+			idx->num_entries += 1;
+		}
+	}
+
+	free(old_entries);
+}
+
+void
+mgc_chunk_spatial_index_init(struct mgc_chunk_spatial_index *idx, size_t min_cap)
+{
+	memset(idx, 0, sizeof(struct mgc_chunk_spatial_index));
 
-		node = node->children[child_id];
+	// Keep the load factor below 0.5 for min_cap entries.
+	size_t cap = 16;
+	while (cap < min_cap * 2) {
+		cap *= 2;
 	}
 
-	if (!node || node->level != 0) {
-		return -1;
+	mgc_chunk_spatial_index_alloc_entries(idx, cap);
+}
+
+void
+mgc_chunk_spatial_index_destroy(struct mgc_chunk_spatial_index *idx)
+{
+	free(idx->entries);
+	memset(idx, 0, sizeof(struct mgc_chunk_spatial_index));
+}
+
+int
+mgc_chunk_spatial_index_insert(struct mgc_chunk_spatial_index *idx, v3i chunk_coord, u32 chunk_id)
+{
+	assert(chunk_id != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK);
+
+	if ((idx->num_entries + 1) * 2 > idx->cap_entries) {
+		mgc_chunk_spatial_index_grow(idx);
 	}
 
-	int child_id = idx_to_child_id(chunk);
-	if (node->chunks[child_id].index == MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
+	u64 key = mgc_chunk_spatial_index_key(chunk_coord);
+	size_t slot = mgc_chunk_spatial_index_probe(idx, key);
+
+	if (idx->entries[slot].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
 		return -1;
 	}
 
-	node->chunks[child_id].index = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+	idx->entries[slot].key = key;
+	idx->entries[slot].index = chunk_id;
+	idx->num_entries += 1;
+
 	return 0;
 }
 
-u32
-mgc_chunk_spatial_index_get(struct mgc_chunk_spatial_index *idx, v3i chunk_coord)
+int
+mgc_chunk_spatial_index_remove(struct mgc_chunk_spatial_index *idx, v3i chunk_coord)
 {
-	v3u chunk = world_to_idx(chunk_coord);
+	u64 key = mgc_chunk_spatial_index_key(chunk_coord);
+	size_t slot = mgc_chunk_spatial_index_probe(idx, key);
 
-	struct mgc_chunk_spatial_index_node *node;
-	node = idx->root;
-	if (!node) {
-		return MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+	if (idx->entries[slot].index == MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
+		return -1;
 	}
 
-	while (node && node->level > 0) {
-		v3u child_coord = idx_to_level(chunk, node->level);
-		int child_id = idx_to_child_id(child_coord);
+	// Backward-shift deletion. Move following entries of the probe sequence
+	// into the hole unless their home slot is cyclically between the hole and
+	// their current slot, so that no tombstones are needed.
+	size_t mask = idx->cap_entries - 1;
+	size_t hole = slot;
+	size_t next = (hole + 1) & mask;
+
+	while (idx->entries[next].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK) {
+		size_t home = mgc_chunk_spatial_index_slot(idx, idx->entries[next].key);
+
+		bool can_move;
+		if (hole <= next) {
+			can_move = home <= hole || home > next;
+		} else {
+			can_move = home <= hole && home > next;
+		}
 
-		node = node->children[child_id];
-	}
+		if (can_move) {
+			idx->entries[hole] = idx->entries[next];
+			hole = next;
+		}
 
-	if (!node || node->level != 0) {
-		return MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+		next = (next + 1) & mask;
 	}
 
-	if (!v3u_equal(node->coord, idx_to_level(chunk, 1))) {
-		return MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
-	}
+	idx->entries[hole].key = 0;
+	idx->entries[hole].index = MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK;
+	idx->num_entries -= 1;
 
-	int child_id = idx_to_child_id(chunk);
-	return node->chunks[child_id].index;
+	return 0;
 }
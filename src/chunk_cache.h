@@ -7,6 +7,11 @@
 #include "arena.h"
 #include "chunk.h"
 #include "chunk_mesher.h"
+#include "thread.h"
+#include "atomic.h"
+#include "math.h"
+#include "chunk_compressed.h"
+#include "utils.h"
 
 struct mgc_chunk;
 struct mgc_world;
@@ -14,6 +19,9 @@ struct mgc_world;
 enum mgc_chunk_cache_entry_state {
 	MGC_CHUNK_CACHE_UNUSED = 0,
 	MGC_CHUNK_CACHE_UNLOADED,
+	// The entry is queued for or being loaded by a loader thread. Only the
+	// loader thread may touch the entry's chunk while in this state.
+	MGC_CHUNK_CACHE_LOADING,
 	MGC_CHUNK_CACHE_LOADED,
 	MGC_CHUNK_CACHE_MESHED,
 	MGC_CHUNK_CACHE_DIRTY,
@@ -26,60 +34,147 @@ enum mgc_chunk_cache_entry_state {
 #error "RENDER_CHUNKS_PER_CHUNK must be less than 64"
 #endif
 
+#define CHUNK_AWAKE_MASK_UNITS (CHUNK_NUM_TILES / 64)
+
+// Tracks which tiles the sim has to visit. The masks are double buffered and
+// indexed by the sim clock: a tick visits the tiles in tiles[clock], and
+// wakes tiles for the next tick in tiles[!clock].
+struct mgc_chunk_awake {
+	u64 tiles[2][CHUNK_AWAKE_MASK_UNITS];
+	// Which render chunks have any awake tiles.
+	u64 render_chunks[2];
+	// Tiles written during the tick, which must not be visited or written
+	// again that tick. Also indexed by the sim clock, so that
+	// updated[!clock] can be cleared while neighbouring chunks set bits in
+	// updated[clock].
+	u64 updated[2][CHUNK_AWAKE_MASK_UNITS];
+};
+
+// Wakes every tile of the chunk and forgets which tiles were written.
+void
+mgc_chunk_awake_wake_all(struct mgc_chunk_awake *);
+
 struct mgc_chunk_cache_entry {
+	// Use mgc_chunk_cache_entry_state and mgc_chunk_cache_entry_set_state
+	// to access the state, as it is published from the loader threads.
 	enum mgc_chunk_cache_entry_state state;
 	v3i coord;
 	struct mgc_chunk *chunk;
+	struct mgc_chunk_awake *awake;
+	// Set while every tile of the chunk is the tile uniform. Uniform chunks
+	// are loaded without a chunk, and get one when the sim reaches them (see
+	// mgc_chunk_cache_materialise). The sim clears the flag once it might
+	// have written to the chunk.
+	bool is_uniform;
+	struct mgc_tile uniform;
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	// Set instead of chunk and awake while the entry is idle. Only the sim
+	// thread, or the render thread while holding the structure lock, may
+	// compress or expand an entry.
+	struct mgc_chunk_compressed *compressed;
+	// Set when compression found too many distinct tiles. Cleared when the
+	// entry is meshed again, as its tiles might have changed.
+	bool incompressible;
+#endif
 	// struct mgc_mesh mesh[RENDER_CHUNKS_PER_CHUNK];
-	struct mgc_chunk_vbo_pool_entry *mesh[RENDER_CHUNKS_PER_CHUNK];
+	struct mgc_chunk_vbo_alloc mesh[RENDER_CHUNKS_PER_CHUNK];
 	u64 dirty_mask;
+	// The render chunks whose last mesh had any vertices. Only used by the
+	// meshers.
+	u64 visible_mask;
+
+	// Unique for every request that adds an entry to the cache. Meshes carry
+	// it, so that the meshes of an evicted entry that are still in the ring
+	// are not attached to an entry requested again at the same coord.
+	u64 load_id;
+	// Set while the entry is in the cache's evict queue.
+	bool evict_queued;
+	// The cache tick at which this entry last left the load bounds. Used to
+	// rank entries for eviction.
+	u64 last_touched;
+
+	// The sim's rebuild count when this entry was last part of the sim.
+	// Used to wake chunks that enter the sim.
+	u64 sim_epoch;
+
+	struct mgc_chunk_cache_entry *free_list_next;
 };
 
+static inline enum mgc_chunk_cache_entry_state
+mgc_chunk_cache_entry_state(struct mgc_chunk_cache_entry *entry)
+{
+	return (enum mgc_chunk_cache_entry_state)mgc_atomic_load_int((volatile int *)&entry->state);
+}
+
+static inline void
+mgc_chunk_cache_entry_set_state(struct mgc_chunk_cache_entry *entry, enum mgc_chunk_cache_entry_state state)
+{
+	mgc_atomic_store_int((volatile int *)&entry->state, (int)state);
+}
+
 struct mgc_chunk_pool_entry {
 	size_t id;
 	struct mgc_chunk_pool_entry *next;
 	struct mgc_chunk chunk;
+	struct mgc_chunk_awake awake;
 };
 
+// The spatial index is an open-addressing hash map with linear probing from
+// packed chunk coordinates to cache entry indices. Each coordinate component
+// is packed into 21 bits, so chunk coordinates must be within
+// [-2^20, 2^20).
 struct mgc_chunk_spatial_index_entry {
+	u64 key;
 	u32 index;
 };
 
-#define MGC_CHUNK_SPATIAL_INDEX_WIDTH_LOG2 (1)
-#define MGC_CHUNK_SPATIAL_INDEX_WIDTH (1 << MGC_CHUNK_SPATIAL_INDEX_WIDTH_LOG2)
-#define MGC_CHUNK_SPATIAL_INDEX_CHILDREN (MGC_CHUNK_SPATIAL_INDEX_WIDTH*MGC_CHUNK_SPATIAL_INDEX_WIDTH*MGC_CHUNK_SPATIAL_INDEX_WIDTH)
-#define MGC_CHUNK_SPATIAL_INDEX_LEAFS MGC_CHUNK_SPATIAL_INDEX_CHILDREN
-/*
-(( \
-		sizeof(struct mgc_chunk_spatial_index_node *) * \
-		MGC_CHUNK_SPATIAL_INDEX_CHILDREN) / \
-		sizeof(struct mgc_chunk_spatial_index_entry))
-		*/
-
-// The coordinate system for this index is translated to (INT_MAX, INT_MAX,
-// INT_MAX). This is to avoid having to deal with rounding negative integers
-// towards negative infinity instead of towards 0.
-struct mgc_chunk_spatial_index_node {
-	v3u coord;
-	unsigned int level;
-	// size_t num_chunks;
-	union {
-		struct mgc_chunk_spatial_index_entry chunks[MGC_CHUNK_SPATIAL_INDEX_LEAFS];
-		struct mgc_chunk_spatial_index_node *children[MGC_CHUNK_SPATIAL_INDEX_CHILDREN];
-		struct mgc_chunk_spatial_index_node *free_list_next;
-	};
-};
-
 struct mgc_chunk_spatial_index {
-	struct mgc_chunk_spatial_index_node *root;
-	struct mgc_chunk_spatial_index_node *free_list;
-	struct paged_list nodes;
+	struct mgc_chunk_spatial_index_entry *entries;
+	// Always a power of two.
+	size_t cap_entries;
+	size_t num_entries;
+	// 64 - log2(cap_entries). See mgc_chunk_spatial_index_slot.
+	unsigned int hash_shift;
 };
 
 #define MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK UINT32_MAX
 
+#define MGC_CHUNK_SPATIAL_INDEX_COORD_BITS (21)
+#define MGC_CHUNK_SPATIAL_INDEX_COORD_MASK ((1ULL << MGC_CHUNK_SPATIAL_INDEX_COORD_BITS) - 1)
+#define MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS (1 << (MGC_CHUNK_SPATIAL_INDEX_COORD_BITS - 1))
+
+static inline u64
+mgc_chunk_spatial_index_key(v3i c)
+{
+	assert(c.x >= -MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS && c.x < MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS &&
+	       c.y >= -MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS && c.y < MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS &&
+	       c.z >= -MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS && c.z < MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS);
+
+	u64 x = (u64)(c.x + MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS) & MGC_CHUNK_SPATIAL_INDEX_COORD_MASK;
+	u64 y = (u64)(c.y + MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS) & MGC_CHUNK_SPATIAL_INDEX_COORD_MASK;
+	u64 z = (u64)(c.z + MGC_CHUNK_SPATIAL_INDEX_COORD_BIAS) & MGC_CHUNK_SPATIAL_INDEX_COORD_MASK;
+
+	return
+		(x << (MGC_CHUNK_SPATIAL_INDEX_COORD_BITS*0)) |
+		(y << (MGC_CHUNK_SPATIAL_INDEX_COORD_BITS*1)) |
+		(z << (MGC_CHUNK_SPATIAL_INDEX_COORD_BITS*2));
+}
+
+// Fibonacci hashing. The top bits of the key times 2^64 over the golden ratio
+// depend on every bit of the key, and keys that differ by a little, like
+// those of neighbouring chunks, are spread far apart. The 27 neighbours of a
+// chunk then rarely share a probe sequence.
+static inline size_t
+mgc_chunk_spatial_index_slot(struct mgc_chunk_spatial_index *idx, u64 key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> idx->hash_shift;
+}
+
+void
+mgc_chunk_spatial_index_init(struct mgc_chunk_spatial_index *, size_t min_cap);
+
 void
-mgc_chunk_spatial_index_init(struct mgc_chunk_spatial_index *, struct mgc_memory *);
+mgc_chunk_spatial_index_destroy(struct mgc_chunk_spatial_index *);
 
 int
 mgc_chunk_spatial_index_insert(struct mgc_chunk_spatial_index *, v3i coord, u32 chunk_id);
@@ -87,32 +182,144 @@ mgc_chunk_spatial_index_insert(struct mgc_chunk_spatial_index *, v3i coord, u32
 int
 mgc_chunk_spatial_index_remove(struct mgc_chunk_spatial_index *, v3i coord);
 
-u32
-mgc_chunk_spatial_index_get(struct mgc_chunk_spatial_index *, v3i coord);
+// Inline, as the sim and the mesher look up every neighbour of every chunk
+// they touch.
+static inline u32
+mgc_chunk_spatial_index_get(struct mgc_chunk_spatial_index *idx, v3i coord)
+{
+	u64 key = mgc_chunk_spatial_index_key(coord);
+	size_t mask = idx->cap_entries - 1;
+	size_t slot = mgc_chunk_spatial_index_slot(idx, key);
+
+	while (idx->entries[slot].index != MGC_CHUNK_SPATIAL_INDEX_NO_CHUNK &&
+			idx->entries[slot].key != key) {
+		slot = (slot + 1) & mask;
+	}
+
+	return idx->entries[slot].index;
+}
+
+struct mgc_chunk_cache_evict_candidate {
+	u32 entry_i;
+	u64 distance;
+	u64 last_touched;
+};
+
+struct mgc_chunk_cache;
+
+struct mgc_chunk_loader {
+	struct mgc_chunk_cache *cache;
+
+	struct mgc_thread *threads;
+	size_t num_threads;
+
+	struct mgc_mutex lock;
+	struct mgc_cond cond;
 
-#define MGC_CHUNK_CACHE_UPDATE_RENDER (0)
-#define MGC_CHUNK_CACHE_UPDATE_SIM (1)
+	// Ring buffer of indices of entries waiting to be loaded. An entry is
+	// only queued while it is in the LOADING state, so the queue never holds
+	// more than cap_entries elements.
+	u32 *queue;
+	size_t queue_cap;
+	size_t queue_head;
+	size_t queue_length;
+
+	// Chunks of entries that turned out to be uniform, to be returned to
+	// the chunk pool by the next cache tick.
+	struct mgc_chunk_pool_entry *unused_chunks;
+
+	bool should_quit;
+};
+
+struct mgc_chunk_mesher {
+	struct chunk_gen_mesh_buffer *scratch;
+	struct chunk_gen_mesh_out_buffer out;
+	// Filled with the tile of uniform chunks that have to be meshed.
+	struct mgc_chunk *uniform_chunk;
+};
+
+// Hands meshes from the meshers over to the render thread, which uploads
+// everything in the ring each frame. published is set at the end of each sim
+// tick and cleared by the render thread, which keeps the sim from running
+// more than one tick ahead of the render thread.
+struct mgc_chunk_cache_handoff {
+	struct mgc_mutex lock;
+	struct mgc_cond cond;
+
+	struct chunk_gen_mesh_ring ring;
+	bool published;
+
+	// Set by the render thread when it wants to change the structure of the
+	// cache. The sim thread parks between ticks until it is cleared.
+	bool structure_pending;
+	bool should_quit;
+};
 
 struct mgc_chunk_cache {
 	struct mgc_chunk_cache_entry *entries;
 	size_t cap_entries;
 	size_t head;
+	size_t num_used_entries;
+	struct mgc_chunk_cache_entry *free_list;
+
+	// The entries that left the load bounds and have not been evicted yet,
+	// with room for cap_entries elements. Only these are ranked when the
+	// cache runs low on free entries.
+	u32 *evict_queue;
+	size_t evict_queue_length;
+	// Scratch buffer of cap_entries elements used to rank eviction
+	// candidates.
+	struct mgc_chunk_cache_evict_candidate *evict_candidates;
+
+	u64 tick;
+	// The load_id of the most recently requested entry.
+	u64 last_load_id;
+
+	// Bumped whenever the set of chunks the sim can simulate might have
+	// changed, that is when the sim center moves or an entry is loaded,
+	// evicted or fails.
+	volatile u64 sim_generation;
 
 	v3i sim_center;
-	volatile int update_state;
+	// Entries outside these bounds can be evicted.
+	struct mgc_aabbi load_chunk_bounds;
+	// Set if a chunk in the load bounds could not be requested because the
+	// cache was full. The next mgc_chunk_cache_set_sim_center requests the
+	// whole load bounds again instead of only the chunks that entered them.
+	bool load_bounds_incomplete;
+
+	// Held by the sim thread for the duration of a tick. Changes to which
+	// chunks are in the cache, and to the sim center, must only be made
+	// while holding this lock.
+	struct mgc_mutex structure_lock;
+	struct mgc_chunk_cache_handoff handoff;
 
 	struct mgc_chunk_spatial_index index;
 
-	struct chunk_gen_mesh_buffer *gen_mesh_buffer;
-	struct chunk_gen_mesh_out_buffer gen_mesh_out_buffer;
+	// One mesher per sim worker, indexed by the job pool's worker_i.
+	struct mgc_chunk_mesher meshers[MGC_SIM_MAX_THREADS];
+	// Scratch buffer of cap_entries elements of entries to mesh this tick.
+	u32 *mesh_queue;
 	struct mgc_material_table *mat_table;
 
 	struct paged_list chunk_pool;
 	struct mgc_chunk_pool_entry *chunk_pool_free_list;
+	// The number of chunks allocated from chunk_pool.
+	size_t num_expanded;
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+	// Scratch buffer of MGC_CHUNK_CACHE_COMPRESS_BATCH elements of entries
+	// to compress this tick.
+	u32 *compress_queue;
+	size_t num_compressed;
+	size_t compressed_bytes;
+#endif
 
 	struct mgc_chunk_vbo_pool vbo_pool;
 
 	struct mgc_world *world;
+
+	struct mgc_chunk_loader loader;
 };
 
 void
@@ -122,37 +329,112 @@ mgc_chunk_cache_init(
 		struct mgc_world *world,
 		struct mgc_material_table *mat_table);
 
+// Stops the loader threads and releases the cache's memory. The sim thread
+// must be stopped before the cache is destroyed.
 void
+mgc_chunk_cache_destroy(struct mgc_chunk_cache *cache);
+
+// Returns 0 if the chunk is or was made present in the cache, or -1 if the
+// cache is full.
+int
 mgc_chunk_cache_request(struct mgc_chunk_cache *, v3i coord);
 
 void
 mgc_chunk_cache_invalidate(struct mgc_chunk_cache *, v3i coord);
 
+// Must be called while holding the structure lock.
 void
 mgc_chunk_cache_tick(struct mgc_chunk_cache *cache);
 
+// Meshes dirty chunks on the pool's workers and pushes the meshes to the
+// render thread. Chunks that do not fit in the mesher's buffer or the ring
+// stay dirty and are meshed on a later call. Must only be called from the
+// sim thread between mgc_chunk_cache_sim_begin and mgc_chunk_cache_sim_end.
 void
-mgc_chunk_cache_mesh(struct mgc_chunk_cache *cache);
+mgc_chunk_cache_mesh(struct mgc_chunk_cache *cache, struct mgc_job_pool *pool);
 
+// Uploads the meshes pushed by the meshers so far. Never blocks on the sim
+// thread.
 void
 mgc_chunk_cache_render_tick(struct mgc_chunk_cache *cache);
 
+// Tries to take the structure lock from the render thread. If the sim thread
+// is in the middle of a tick, this returns false and the sim thread will park
+// after the tick so that the next attempt succeeds.
+bool
+mgc_chunk_cache_try_lock_structure(struct mgc_chunk_cache *cache);
+
+void
+mgc_chunk_cache_unlock_structure(struct mgc_chunk_cache *cache);
+
+// Called by the sim thread before each tick.
+void
+mgc_chunk_cache_sim_begin(struct mgc_chunk_cache *cache);
+
+// Called by the sim thread after each tick. Waits for the render thread to
+// pick up the previous tick, and parks while the render thread waits for the
+// structure lock. Returns false if the sim thread
+// should quit.
+bool
+mgc_chunk_cache_sim_end(struct mgc_chunk_cache *cache);
+
+// Wakes the sim thread if it is waiting in mgc_chunk_cache_sim_end and makes
+// it return false.
+void
+mgc_chunk_cache_sim_quit(struct mgc_chunk_cache *cache);
+
+// Evicts up to max_evict entries that are outside the load bounds, starting
+// with the ones furthest from the sim center, and then the ones that left
+// the load bounds first. Must be called while holding the structure lock.
+// Returns the number of evicted entries.
+size_t
+mgc_chunk_cache_evict(struct mgc_chunk_cache *cache, size_t max_evict);
+
 isize
 mgc_chunk_cache_find(struct mgc_chunk_cache *cache, v3i coord);
 
+// Gives a uniform entry without a chunk its tiles. Must be called from the
+// sim thread, or while holding the structure lock.
+void
+mgc_chunk_cache_materialise(struct mgc_chunk_cache *, struct mgc_chunk_cache_entry *);
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+// Expands the entry's chunk if it is compressed. Must be called from the sim
+// thread, or while holding the structure lock.
+void
+mgc_chunk_cache_expand(struct mgc_chunk_cache *, struct mgc_chunk_cache_entry *);
+#endif
+
+// Requests the chunks that entered the load bounds since the last call, and
+// queues the ones that left them for eviction. Must be called while holding
+// the structure lock.
 void
 mgc_chunk_cache_set_sim_center(struct mgc_chunk_cache *cache, v3i coord);
 
+// The mesh is in the cache's vbo_pool, and is drawn with the pool's VAO.
 struct mgc_chunk_render_entry {
-	struct mgc_mesh mesh;
+	struct mgc_chunk_vbo_alloc mesh;
 	v3i coord;
+	// Squared distance from the camera to the render chunk's center.
+	float distance;
+};
+
+struct mgc_chunk_render_queue {
+	struct mgc_chunk_render_entry *entries;
+	size_t length;
+	size_t cap;
 };
 
+void
+mgc_chunk_render_queue_free(struct mgc_chunk_render_queue *);
+
+// Replaces the queue's contents with the render chunks that intersect the
+// frustum, sorted front-to-back from camera_pos. Both are in render space.
 void
 mgc_chunk_cache_make_render_queue(
 		struct mgc_chunk_cache *,
-		size_t queue_cap,
-		struct mgc_chunk_render_entry *queue,
-		size_t *queue_head);
+		struct mgc_frustum *frustum,
+		v3 camera_pos,
+		struct mgc_chunk_render_queue *queue);
 
 #endif
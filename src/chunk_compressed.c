@@ -0,0 +1,159 @@
+#include "chunk_compressed.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+// Open addressing table from tiles to palette indices. Twice the size of the
+// palette so probes stay short.
+#define MGC_CHUNK_COMPRESS_TABLE_SIZE (MGC_CHUNK_COMPRESSED_MAX_PALETTE * 2)
+
+struct mgc_chunk_compress_table {
+	u32 keys[MGC_CHUNK_COMPRESS_TABLE_SIZE];
+	u16 values[MGC_CHUNK_COMPRESS_TABLE_SIZE];
+	bool used[MGC_CHUNK_COMPRESS_TABLE_SIZE];
+};
+
+static inline u32
+mgc_chunk_compress_key(struct mgc_chunk *chunk, size_t i)
+{
+	return (u32)*mgc_chunk_material(chunk, i) | ((u32)*mgc_chunk_data(chunk, i) << 16);
+}
+
+static inline size_t
+mgc_chunk_compress_slot(struct mgc_chunk_compress_table *table, u32 key)
+{
+	size_t slot = (key * 2654435761u) % MGC_CHUNK_COMPRESS_TABLE_SIZE;
+	while (table->used[slot] && table->keys[slot] != key) {
+		slot = (slot + 1) % MGC_CHUNK_COMPRESS_TABLE_SIZE;
+	}
+	return slot;
+}
+
+static size_t
+mgc_chunk_compressed_num_words(u8 bits_per_tile)
+{
+	return (CHUNK_NUM_TILES * bits_per_tile + 63) / 64;
+}
+
+size_t
+mgc_chunk_compressed_size(struct mgc_chunk_compressed *compressed)
+{
+	return sizeof(struct mgc_chunk_compressed)
+		+ mgc_chunk_compressed_num_words(compressed->bits_per_tile) * sizeof(u64);
+}
+
+struct mgc_chunk_compressed *
+mgc_chunk_compress(struct mgc_chunk *chunk)
+{
+	TracyCZone(trace, true);
+
+	struct mgc_chunk_compress_table table;
+	memset(table.used, 0, sizeof(table.used));
+
+	struct mgc_tile palette[MGC_CHUNK_COMPRESSED_MAX_PALETTE];
+	size_t num_palette = 0;
+
+	// Neighbouring tiles are usually the same, so only look up changes.
+	u32 prev_key = 0;
+	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+		u32 key = mgc_chunk_compress_key(chunk, i);
+		if (i > 0 && key == prev_key) {
+			continue;
+		}
+		prev_key = key;
+
+		size_t slot = mgc_chunk_compress_slot(&table, key);
+		if (table.used[slot]) {
+			continue;
+		}
+
+		if (num_palette == MGC_CHUNK_COMPRESSED_MAX_PALETTE) {
+			TracyCZoneEnd(trace);
+			return NULL;
+		}
+
+		table.used[slot] = true;
+		table.keys[slot] = key;
+		table.values[slot] = num_palette;
+		palette[num_palette].material = key & 0xffff;
+		palette[num_palette].data = key >> 16;
+		num_palette += 1;
+	}
+
+	u8 bits_per_tile = 0;
+	while (((size_t)1 << bits_per_tile) < num_palette) {
+		bits_per_tile = bits_per_tile ? bits_per_tile * 2 : 1;
+	}
+
+	size_t num_words = mgc_chunk_compressed_num_words(bits_per_tile);
+	struct mgc_chunk_compressed *compressed;
+	compressed = malloc(sizeof(struct mgc_chunk_compressed) + num_words * sizeof(u64));
+	if (!compressed) {
+		TracyCZoneEnd(trace);
+		return NULL;
+	}
+
+	compressed->location = chunk->location;
+	compressed->num_palette = num_palette;
+	compressed->bits_per_tile = bits_per_tile;
+	memcpy(compressed->palette, palette, num_palette * sizeof(struct mgc_tile));
+	memset(compressed->indices, 0, num_words * sizeof(u64));
+
+	if (bits_per_tile > 0) {
+		size_t tiles_per_word = 64 / bits_per_tile;
+		u64 index = 0;
+		for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+			u32 key = mgc_chunk_compress_key(chunk, i);
+			if (i == 0 || key != prev_key) {
+				index = table.values[mgc_chunk_compress_slot(&table, key)];
+				prev_key = key;
+			}
+
+			compressed->indices[i / tiles_per_word] |=
+				index << ((i % tiles_per_word) * bits_per_tile);
+		}
+	}
+
+	TracyCZoneEnd(trace);
+
+	return compressed;
+}
+
+void
+mgc_chunk_decompress(struct mgc_chunk_compressed *compressed, struct mgc_chunk *out)
+{
+	TracyCZone(trace, true);
+
+	out->location = compressed->location;
+
+	if (compressed->bits_per_tile == 0) {
+		struct mgc_tile tile = compressed->palette[0];
+		for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
+			*mgc_chunk_material(out, i) = tile.material;
+			*mgc_chunk_data(out, i) = tile.data;
+		}
+
+		TracyCZoneEnd(trace);
+		return;
+	}
+
+	u8 bits_per_tile = compressed->bits_per_tile;
+	size_t tiles_per_word = 64 / bits_per_tile;
+	u64 mask = ((u64)1 << bits_per_tile) - 1;
+
+	for (size_t word_i = 0; word_i < CHUNK_NUM_TILES / tiles_per_word; word_i++) {
+		u64 word = compressed->indices[word_i];
+		size_t first = word_i * tiles_per_word;
+		for (size_t i = 0; i < tiles_per_word; i++) {
+			struct mgc_tile tile = compressed->palette[word & mask];
+			*mgc_chunk_material(out, first + i) = tile.material;
+			*mgc_chunk_data(out, first + i) = tile.data;
+			word >>= bits_per_tile;
+		}
+	}
+
+	TracyCZoneEnd(trace);
+}
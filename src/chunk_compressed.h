@@ -0,0 +1,33 @@
+#ifndef MAGIC_CHUNK_COMPRESSED_H
+#define MAGIC_CHUNK_COMPRESSED_H
+
+#include "intdef.h"
+#include "types.h"
+#include "chunk.h"
+
+#define MGC_CHUNK_COMPRESSED_MAX_PALETTE (256)
+
+// A chunk stored as a palette of its distinct tiles and, for each tile, its
+// index in the palette. The indices are packed into u64s with
+// bits_per_tile bits each, in tile order.
+struct mgc_chunk_compressed {
+	v3i location;
+	u16 num_palette;
+	// 0, 1, 2, 4 or 8. With 0 bits every tile is palette[0].
+	u8 bits_per_tile;
+	struct mgc_tile palette[MGC_CHUNK_COMPRESSED_MAX_PALETTE];
+	u64 indices[];
+};
+
+// Returns a new allocation, or NULL if the chunk has more than
+// MGC_CHUNK_COMPRESSED_MAX_PALETTE distinct tiles. Release it with free.
+struct mgc_chunk_compressed *
+mgc_chunk_compress(struct mgc_chunk *chunk);
+
+void
+mgc_chunk_decompress(struct mgc_chunk_compressed *, struct mgc_chunk *out);
+
+size_t
+mgc_chunk_compressed_size(struct mgc_chunk_compressed *);
+
+#endif
@@ -54,6 +54,28 @@ mgc_chunk_mask_set(struct mgc_chunk_mask *chunk, v3i c)
 	mgc_chunk_mask_set_to(chunk, c, true);
 }
 
+bool
+mgc_chunk_mask_is_empty(struct mgc_chunk_mask *mask)
+{
+	for (size_t i = 0; i < CHUNK_NUM_TILES / MGC_CHUNK_MASK_BIT_PER_UNIT; i++) {
+		if (mask->mask[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+mgc_chunk_mask_is_full(struct mgc_chunk_mask *mask)
+{
+	for (size_t i = 0; i < CHUNK_NUM_TILES / MGC_CHUNK_MASK_BIT_PER_UNIT; i++) {
+		if (mask->mask[i] != UINT64_MAX) {
+			return false;
+		}
+	}
+	return true;
+}
+
 bool
 mgc_chunk_layer_mask_get(struct mgc_chunk_layer_mask *mask, v2i c)
 {
@@ -25,6 +25,12 @@ mgc_chunk_mask_seti_to(struct mgc_chunk_mask *chunk, size_t i, bool is_set);
 void
 mgc_chunk_mask_set(struct mgc_chunk_mask *chunk, v3i c);
 
+bool
+mgc_chunk_mask_is_empty(struct mgc_chunk_mask *mask);
+
+bool
+mgc_chunk_mask_is_full(struct mgc_chunk_mask *mask);
+
 struct mgc_chunk_layer_mask {
 	u64 mask[CHUNK_LAYER_NUM_TILES / MGC_CHUNK_MASK_BIT_PER_UNIT];
 };
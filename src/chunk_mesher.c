@@ -6,19 +6,20 @@
 #include "material.h"
 #include "config.h"
 #include "chunk.h"
+#include "atomic.h"
 
 #include <glad/glad.h>
 
-typedef enum {
-	NEIGHBOUR_NW    = 0,
-	NEIGHBOUR_NE    = 1,
-	NEIGHBOUR_W     = 2,
-	NEIGHBOUR_E     = 3,
-	NEIGHBOUR_SW    = 4,
-	NEIGHBOUR_SE    = 5,
-	NEIGHBOUR_ABOVE = 6,
-	NEIGHBOUR_BELOW = 7,
-} LayerNeighbourName;
+const v3i chunk_mesh_neighbour_offsets[NUM_LAYER_NEIGHBOURS] = {
+	[NEIGHBOUR_NW]    = {.x=-1, .y= 1, .z= 0},
+	[NEIGHBOUR_NE]    = {.x= 0, .y= 1, .z= 0},
+	[NEIGHBOUR_W]     = {.x=-1, .y= 0, .z= 0},
+	[NEIGHBOUR_E]     = {.x= 1, .y= 0, .z= 0},
+	[NEIGHBOUR_SW]    = {.x= 0, .y=-1, .z= 0},
+	[NEIGHBOUR_SE]    = {.x= 1, .y=-1, .z= 0},
+	[NEIGHBOUR_ABOVE] = {.x= 0, .y= 0, .z= 1},
+	[NEIGHBOUR_BELOW] = {.x= 0, .y= 0, .z=-1},
+};
 
 typedef enum {
 	NEIGHBOUR_MASK_NW    = (1<<NEIGHBOUR_NW),
@@ -64,6 +65,144 @@ chunkLayerCullMask(u8 *cullMask, struct layer_neighbours *neighbours)
 	}
 }
 
+// The chunk that apron tiles are read from. cnk is NULL if the neighbour is
+// not loaded, and then its tiles are solid if solid is set.
+struct chunkApronSource {
+	struct mgc_chunk *cnk;
+	bool solid;
+	// Added to a chunk-local coordinate to get the coordinate in cnk.
+	int dx, dy, dz;
+};
+
+// Finds the chunk containing the tile at the chunk-local coordinate, which
+// may be one step outside the chunk.
+static struct chunkApronSource
+chunkApronSourceAt(struct mgc_chunk *cnk, struct mgc_chunk **neighbours, u8 solidNeighbours, int x, int y, int z)
+{
+	struct chunkApronSource result = {0};
+
+	v3i chunk_offset = V3i(
+		(x < 0) ? -1 : (x >= CHUNK_WIDTH)  ? 1 : 0,
+		(y < 0) ? -1 : (y >= CHUNK_WIDTH)  ? 1 : 0,
+		(z < 0) ? -1 : (z >= CHUNK_HEIGHT) ? 1 : 0
+	);
+
+	if (chunk_offset.x == 0 && chunk_offset.y == 0 && chunk_offset.z == 0) {
+		result.cnk = cnk;
+		return result;
+	}
+
+	// Chunks that are not layer neighbours are treated as unloaded.
+	for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+		v3i offset = chunk_mesh_neighbour_offsets[n];
+		if (offset.x == chunk_offset.x &&
+			offset.y == chunk_offset.y &&
+			offset.z == chunk_offset.z) {
+			result.cnk = neighbours[n];
+			result.solid = (solidNeighbours >> n) & 1;
+			break;
+		}
+	}
+
+	result.dx = -chunk_offset.x * CHUNK_WIDTH;
+	result.dy = -chunk_offset.y * CHUNK_WIDTH;
+	result.dz = -chunk_offset.z * CHUNK_HEIGHT;
+
+	return result;
+}
+
+// Returns whether the tile at the chunk-local coordinate, which must be in
+// source, is solid.
+static inline bool
+chunkApronSolid(struct mgc_material_table *materials, struct chunkApronSource *source, int x, int y, int z)
+{
+	if (!source->cnk) {
+		return source->solid;
+	}
+
+	size_t i =
+		  (x + source->dx)
+		+ (y + source->dy) * CHUNK_WIDTH
+		+ (z + source->dz) * CHUNK_LAYER_NUM_TILES;
+	return (mgc_mat_props(materials, *mgc_chunk_material(source->cnk, i)).flags & MGC_MAT_SOLID) != 0;
+}
+
+// Sets solid[i] for the RENDER_CHUNK_WIDTH+1 tiles (x, y) + i*(step_x, step_y)
+// along one side of a render chunk layer. The render chunk is inside the
+// chunk, so only the first and the last of them can be in a different chunk
+// than the rest.
+static void
+chunkApronLine(bool *solid, struct mgc_material_table *materials, struct mgc_chunk *cnk, struct mgc_chunk **chunkNeighbours, u8 solidNeighbours, int x, int y, int z, int step_x, int step_y)
+{
+	const int w = RENDER_CHUNK_WIDTH;
+
+	struct chunkApronSource first, middle, last;
+	first  = chunkApronSourceAt(cnk, chunkNeighbours, solidNeighbours, x,              y,              z);
+	middle = chunkApronSourceAt(cnk, chunkNeighbours, solidNeighbours, x + step_x,     y + step_y,     z);
+	last   = chunkApronSourceAt(cnk, chunkNeighbours, solidNeighbours, x + w * step_x, y + w * step_y, z);
+
+	solid[0] = chunkApronSolid(materials, &first, x, y, z);
+	for (int i = 1; i < w; i++) {
+		solid[i] = chunkApronSolid(materials, &middle, x + i * step_x, y + i * step_y, z);
+	}
+	solid[w] = chunkApronSolid(materials, &last, x + w * step_x, y + w * step_y, z);
+}
+
+static inline void
+layerMaskSet(u64 *mask, size_t r_x, size_t r_y)
+{
+	size_t i = r_x + r_y * RENDER_CHUNK_WIDTH;
+	mask[i/BITS_PER_UNIT] |= 1ULL << (i % BITS_PER_UNIT);
+}
+
+// Adds the solid tiles just outside the render chunk's layer to the layer's
+// side neighbour masks. (x, y, z) is the chunk-local coordinate of the layer's
+// first tile.
+static void
+chunkLayerApron(struct layer_neighbours *neighbours, struct mgc_material_table *materials, struct mgc_chunk *cnk, struct mgc_chunk **chunkNeighbours, u8 solidNeighbours, int x, int y, int z)
+{
+	const int w = RENDER_CHUNK_WIDTH;
+
+	// Each tile of the apron borders up to two tiles of the layer, so look
+	// them up once. The rows and columns share the two corner tiles.
+	// west[i]: (-1, i), east[i]: (w, i-1), south[i]: (i, -1), north[i]: (i-1, w)
+	bool west[RENDER_CHUNK_WIDTH+1], east[RENDER_CHUNK_WIDTH+1];
+	bool south[RENDER_CHUNK_WIDTH+1], north[RENDER_CHUNK_WIDTH+1];
+	chunkApronLine(west,  materials, cnk, chunkNeighbours, solidNeighbours, x - 1, y,     z, 0, 1);
+	chunkApronLine(east,  materials, cnk, chunkNeighbours, solidNeighbours, x + w, y - 1, z, 0, 1);
+	chunkApronLine(south, materials, cnk, chunkNeighbours, solidNeighbours, x,     y - 1, z, 1, 0);
+	chunkApronLine(north, materials, cnk, chunkNeighbours, solidNeighbours, x - 1, y + w, z, 1, 0);
+
+	for (int i = 0; i < w; i++) {
+		if (west[i])    layerMaskSet(neighbours->w,  0,   i);
+		if (west[i+1])  layerMaskSet(neighbours->nw, 0,   i);
+		if (east[i+1])  layerMaskSet(neighbours->e,  w-1, i);
+		if (east[i])    layerMaskSet(neighbours->se, w-1, i);
+		if (south[i])   layerMaskSet(neighbours->sw, i,   0);
+		if (south[i+1]) layerMaskSet(neighbours->se, i,   0);
+		if (north[i+1]) layerMaskSet(neighbours->ne, i,   w-1);
+		if (north[i])   layerMaskSet(neighbours->nw, i,   w-1);
+	}
+}
+
+// Sets the above or below mask of a layer from the layer of tiles at the
+// chunk-local z, just outside the render chunk. All of them are in the same
+// chunk.
+static void
+chunkLayerApronVertical(u64 *mask, struct mgc_material_table *materials, struct mgc_chunk *cnk, struct mgc_chunk **chunkNeighbours, u8 solidNeighbours, int x, int y, int z)
+{
+	struct chunkApronSource source;
+	source = chunkApronSourceAt(cnk, chunkNeighbours, solidNeighbours, x, y, z);
+
+	for (int r_y = 0; r_y < RENDER_CHUNK_WIDTH; r_y++) {
+		for (int r_x = 0; r_x < RENDER_CHUNK_WIDTH; r_x++) {
+			if (chunkApronSolid(materials, &source, x + r_x, y + r_y, z)) {
+				layerMaskSet(mask, r_x, r_y);
+			}
+		}
+	}
+}
+
 static inline u64
 tilesMaskMove(u64 *mask, size_t i, i64 movement)
 {
@@ -101,49 +240,38 @@ struct chunk_gen_mesh *
 chunk_mesh_buffer_alloc(struct chunk_gen_mesh_out_buffer *buffer, size_t data_length)
 {
 	size_t length = sizeof(struct chunk_gen_mesh) + data_length;
+	// Keep the mesh headers aligned.
+	length = (length + 7) & ~(size_t)7;
 
-	size_t immediate_space;
-	size_t wrapped_space;
-
-	if ((void *)buffer->next > buffer->head) {
-		wrapped_space = 0;
-		immediate_space = (u8 *)buffer->next - (u8 *)buffer->head;
-	} else {
-		immediate_space = ((u8 *)buffer->data + buffer->cap) - (u8 *)buffer->head;
-		wrapped_space = (u8 *)buffer->next - (u8 *)buffer->data;
-	}
+	u64 tail = mgc_atomic_load_u64(&buffer->tail);
+	u64 offset = buffer->head % buffer->cap;
 
-	struct chunk_gen_mesh *result = NULL;
-	if (immediate_space > length) {
-		result = buffer->head;
-	} else if (wrapped_space > length) {
-		result = buffer->data;
+	// Meshes are not split across the end of the buffer, so skip to the
+	// beginning if there is not enough space left before the end.
+	u64 padding = 0;
+	if (offset + length > buffer->cap) {
+		padding = buffer->cap - offset;
 	}
 
-	if (!result) {
+	if (buffer->head + padding + length - tail > buffer->cap) {
 		return NULL;
 	}
 
-	assert(((u8 *)result+length) < ((u8 *)buffer->data+buffer->cap));
+	struct chunk_gen_mesh *result;
+	result = (struct chunk_gen_mesh *)&buffer->data[(offset + padding) % buffer->cap];
+	buffer->head += padding + length;
 
 	memset(result, 0, length);
 
+	result->owner = buffer;
+	result->end = buffer->head;
 	result->cap = data_length;
 	result->data = (u8 *)result + sizeof(struct chunk_gen_mesh);
-	buffer->head = (u8 *)result + length;
-
-	if (!buffer->tail) {
-		assert(buffer->next == NULL);
-		buffer->tail = &buffer->next;
-	}
-
-	*buffer->tail = result;
-	buffer->tail = &result->next;
 
 #if 0
-	int p_begin = ((size_t)((u8 *)result->data - (u8 *)buffer->data         ) * 50UL) / (size_t)buffer->cap;
-	int p_end   = ((size_t)((u8 *)result->data - (u8 *)buffer->data + length) * 50UL) / (size_t)buffer->cap;
-	int p_next  = ((size_t)((u8 *)buffer->next - (u8 *)buffer->data         ) * 50UL) / (size_t)buffer->cap;
+	int p_begin = (((u8 *)result - buffer->data) * 50UL) / buffer->cap;
+	int p_end   = (((u8 *)result - buffer->data + length) * 50UL) / buffer->cap;
+	int p_next  = ((tail % buffer->cap) * 50UL) / buffer->cap;
 
 	if (p_begin > 50) p_begin = 50;
 	if (p_begin < 0)  p_begin = 0;
@@ -167,91 +295,121 @@ chunk_mesh_buffer_alloc(struct chunk_gen_mesh_out_buffer *buffer, size_t data_le
 	printf("alloc %p (%zu) (+%zu, %zi remaining)\n",
 		(void *)result,
 		length,
-		(u8 *)result - (u8 *)buffer->data,
-		(ssize_t)buffer->cap - (ssize_t)((u8 *)buffer->head - (u8 *)buffer->data)
+		(u8 *)result - buffer->data,
+		(ssize_t)buffer->cap - (ssize_t)(buffer->head - tail)
 	);
 #endif
 
 	return result;
 }
 
-struct chunk_gen_mesh *
-chunk_mesh_buffer_pop(struct chunk_gen_mesh_out_buffer *buffer)
+void
+chunk_mesh_buffer_release(struct chunk_gen_mesh *mesh)
 {
-	struct chunk_gen_mesh *res = buffer->next;
-	if (!res) {
-		return NULL;
-	}
-	buffer->next = res->next;
-	if (!buffer->next) {
-		buffer->tail = &buffer->next;
-	}
-
-	return res;
+	mgc_atomic_store_u64(&mesh->owner->tail, mesh->end);
 }
 
 int
 chunk_gen_mesh_buffer_init(struct chunk_gen_mesh_out_buffer *buffer)
 {
-	buffer->cap = 50 * 1000 * 1000;
-	buffer->data = calloc(sizeof(u8), buffer->cap); // 10MB
+	buffer->cap = MGC_CHUNK_MESH_OUT_BUFFER_SIZE;
+	buffer->data = calloc(sizeof(u8), buffer->cap);
 	if (!buffer->data) {
 		return -1;
 	}
 
-	buffer->head = buffer->data;
-	buffer->tail = &buffer->next;
+	buffer->head = 0;
+	buffer->tail = 0;
 	return 0;
 }
 
-struct mgc_chunk_gen_mesh_result
-chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_buffer *out, struct mgc_material_table *materials, struct mgc_chunk *cnk, u64 dirty_mask)
+void
+chunk_gen_mesh_buffer_destroy(struct chunk_gen_mesh_out_buffer *buffer)
 {
-	TracyCZone(trace, true);
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->cap = 0;
+}
 
-	memset(buffer, 0, sizeof(struct chunk_gen_mesh_buffer));
+int
+chunk_mesh_ring_init(struct chunk_gen_mesh_ring *ring, u32 cap)
+{
+	assert((cap & (cap - 1)) == 0);
 
-	struct layer_neighbours *neighbourMasks = buffer->neighbourMasks;
+	memset(ring, 0, sizeof(struct chunk_gen_mesh_ring));
+	ring->slots = calloc(cap, sizeof(struct chunk_gen_mesh_ring_slot));
+	if (!ring->slots) {
+		return -1;
+	}
+	ring->cap = cap;
 
-	for (size_t i = 0; i < CHUNK_NUM_TILES; i++) {
-		// render chunk coord in chunk
-		//
-		// The full chunk is broken into strips (rchunk_idx) which contains a
-		// full row from a specific chunk.
-		size_t rchunk_idx = i / RENDER_CHUNK_WIDTH;
-		size_t rchunk_x = rchunk_idx % RENDER_CHUNKS_PER_CHUNK_WIDTH;
-		size_t rchunk_y = (rchunk_idx / (RENDER_CHUNKS_PER_CHUNK_WIDTH * RENDER_CHUNK_WIDTH)) % RENDER_CHUNKS_PER_CHUNK_WIDTH;
-		size_t rchunk_z = (rchunk_idx / (RENDER_CHUNKS_PER_CHUNK_WIDTH * CHUNK_WIDTH * RENDER_CHUNK_WIDTH));
-		size_t rchunk_i = rchunk_x +
-			(rchunk_y * RENDER_CHUNKS_PER_CHUNK_WIDTH) +
-			(rchunk_z * RENDER_CHUNKS_PER_CHUNK_LAYER);
-		assert(rchunk_i < RENDER_CHUNKS_PER_CHUNK);
+	return 0;
+}
 
-		struct render_chunk_gen_mesh_buffer *rbuffer;
-		rbuffer = &buffer->render_chunks[rchunk_i];
+void
+chunk_mesh_ring_destroy(struct chunk_gen_mesh_ring *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+	ring->cap = 0;
+}
 
-		// render chunk local coordinates
-		size_t r_x = i % RENDER_CHUNK_WIDTH;
-		size_t r_y = (i / CHUNK_WIDTH) % RENDER_CHUNK_WIDTH;
-		size_t r_z = (i / CHUNK_LAYER_NUM_TILES) % RENDER_CHUNK_HEIGHT;
-		size_t r_i = r_x +
-			(r_y * RENDER_CHUNK_WIDTH) +
-			(r_z * RENDER_CHUNK_LAYER_NUM_TILES);
-		assert(r_i < RENDER_CHUNK_NUM_TILES);
+bool
+chunk_mesh_ring_reserve(struct chunk_gen_mesh_ring *ring, u32 num_meshes)
+{
+	u32 reserved = mgc_atomic_load_u32(&ring->num_reserved);
+	do {
+		if (reserved + num_meshes > ring->cap) {
+			return false;
+		}
+	} while (!mgc_atomic_cas_u32(&ring->num_reserved, &reserved, reserved + num_meshes));
 
-		u64 *solidMask = rbuffer->solidMask;
-		u8 *tileColor = rbuffer->tileColor;
+	return true;
+}
+
+void
+chunk_mesh_ring_unreserve(struct chunk_gen_mesh_ring *ring, u32 num_meshes)
+{
+	mgc_atomic_fetch_sub_u32(&ring->num_reserved, num_meshes);
+}
+
+void
+chunk_mesh_ring_push(struct chunk_gen_mesh_ring *ring, struct chunk_gen_mesh *mesh)
+{
+	// The reservation guarantees that the consumer is done with the slot.
+	u32 pos = mgc_atomic_fetch_add_u32(&ring->tail, 1);
+	struct chunk_gen_mesh_ring_slot *slot = &ring->slots[pos & (ring->cap - 1)];
+
+	slot->mesh = mesh;
+	mgc_atomic_store_u32(&slot->sequence, pos + 1);
+}
 
-		struct mgc_tile *tile = &cnk->tiles[i];
-		Material *mat = mgc_mat_get(materials, tile->material);
-		solidMask[r_i/BITS_PER_UNIT] |= (mat->solid ? 1ULL : 0ULL) << (r_i % BITS_PER_UNIT);
+struct chunk_gen_mesh *
+chunk_mesh_ring_pop(struct chunk_gen_mesh_ring *ring)
+{
+	u32 pos = ring->head;
+	struct chunk_gen_mesh_ring_slot *slot = &ring->slots[pos & (ring->cap - 1)];
 
-		tileColor[r_i*3+0] = mat->color.r;
-		tileColor[r_i*3+1] = mat->color.g;
-		tileColor[r_i*3+2] = mat->color.b;
+	if (mgc_atomic_load_u32(&slot->sequence) != pos + 1) {
+		return NULL;
 	}
 
+	struct chunk_gen_mesh *mesh = slot->mesh;
+	ring->head = pos + 1;
+	chunk_mesh_ring_unreserve(ring, 1);
+
+	return mesh;
+}
+
+struct mgc_chunk_gen_mesh_result
+chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_buffer *out, struct mgc_material_table *materials, struct mgc_chunk *cnk, struct mgc_chunk **neighbours, u8 solid_neighbours, u64 dirty_mask)
+{
+	TracyCZone(trace, true);
+
+	struct layer_neighbours *neighbourMasks = buffer->neighbourMasks;
+
 	struct mgc_chunk_gen_mesh_result result = {0};
+	u64 out_head = out->head;
 
 	for (size_t rchunk_i = 0; rchunk_i < RENDER_CHUNKS_PER_CHUNK; rchunk_i++) {
 		if ((dirty_mask & (1UL << rchunk_i)) == 0) {
@@ -260,21 +418,74 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 		}
 
 		struct render_chunk_gen_mesh_buffer *rbuffer;
-		rbuffer = &buffer->render_chunks[rchunk_i];
+		rbuffer = &buffer->render_chunk;
 
 		// We assume the number of tiles is a multiple of 64.
 		u64 *solidMask = rbuffer->solidMask;
+#if CHUNK_MESH_USES_PALETTE
+		u16 *tileMaterial = rbuffer->tileMaterial;
+#else
 		u8 *tileColor = rbuffer->tileColor;
+#endif
+
+		memset(solidMask, 0, sizeof(rbuffer->solidMask));
+		memset(neighbourMasks, 0, sizeof(buffer->neighbourMasks));
+
+		// render chunk coord in chunk
+		size_t rchunk_x = rchunk_i % RENDER_CHUNKS_PER_CHUNK_WIDTH;
+		size_t rchunk_y = (rchunk_i / RENDER_CHUNKS_PER_CHUNK_WIDTH) % RENDER_CHUNKS_PER_CHUNK_WIDTH;
+		size_t rchunk_z = rchunk_i / RENDER_CHUNKS_PER_CHUNK_LAYER;
+
+		// The chunk-local coordinate of the render chunk's first tile.
+		int origin_x = rchunk_x * RENDER_CHUNK_WIDTH;
+		int origin_y = rchunk_y * RENDER_CHUNK_WIDTH;
+		int origin_z = rchunk_z * RENDER_CHUNK_HEIGHT;
+
+		// Only classify the tiles of this render chunk, one row at a time.
+		for (size_t r_z = 0; r_z < RENDER_CHUNK_HEIGHT; r_z++) {
+			for (size_t r_y = 0; r_y < RENDER_CHUNK_WIDTH; r_y++) {
+				size_t row_i =
+					  (rchunk_x * RENDER_CHUNK_WIDTH)
+					+ (rchunk_y * RENDER_CHUNK_WIDTH + r_y) * CHUNK_WIDTH
+					+ (rchunk_z * RENDER_CHUNK_HEIGHT + r_z) * CHUNK_LAYER_NUM_TILES;
+				size_t r_row_i =
+					  (r_y * RENDER_CHUNK_WIDTH)
+					+ (r_z * RENDER_CHUNK_LAYER_NUM_TILES);
+
+				for (size_t r_x = 0; r_x < RENDER_CHUNK_WIDTH; r_x++) {
+					size_t i = row_i + r_x;
+					size_t r_i = r_row_i + r_x;
+					assert(r_i < RENDER_CHUNK_NUM_TILES);
+
+					mgc_material_id mat_id = *mgc_chunk_material(cnk, i);
+					struct mgc_material_props mat = mgc_mat_props(materials, mat_id);
+					solidMask[r_i/BITS_PER_UNIT] |= ((mat.flags & MGC_MAT_SOLID) ? 1ULL : 0ULL) << (r_i % BITS_PER_UNIT);
+
+#if CHUNK_MESH_USES_PALETTE
+					tileMaterial[r_i] = mat_id;
+#else
+					tileColor[r_i*3+0] = mat.color.r;
+					tileColor[r_i*3+1] = mat.color.g;
+					tileColor[r_i*3+2] = mat.color.b;
+#endif
+				}
+			}
+		}
 
-		// [nw, ne, w, e, sw, se, above, below] for each tile.
+		// [nw, ne, w, e, sw, se, above, below] for each tile. Every layer is
+		// written below, so it does not need to be cleared.
 		u8 *cullMask = buffer->cullMask;
-		memset(cullMask, 0, sizeof(buffer->cullMask));
 
 		struct layer_neighbours *prev, *curr, *next;
 		prev = &neighbourMasks[0];
 		curr = &neighbourMasks[1];
 		next = &neighbourMasks[2];
 
+		// Tiles outside the render chunk, including those in neighbouring
+		// chunks, also cull the faces on its border.
+		chunkLayerApronVertical(curr->below, materials, cnk, neighbours, solid_neighbours,
+			origin_x, origin_y, origin_z - 1);
+
 		for (size_t y = 0; y < RENDER_CHUNK_HEIGHT; y++) {
 			u64 *layerSolidMask = &solidMask[y*RENDER_CHUNK_LAYER_NUM_TILES/BITS_PER_UNIT];
 
@@ -316,6 +527,9 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 				curr->se[i] |= tilesMaskMove(layerSolidMask, i, -RENDER_CHUNK_WIDTH+1) & westEdgeMask;
 			}
 
+			chunkLayerApron(curr, materials, cnk, neighbours, solid_neighbours,
+				origin_x, origin_y, origin_z + y);
+
 			if (y > 0) {
 				u8 *prevLayerCullMask = &cullMask[(y-1)*RENDER_CHUNK_LAYER_NUM_TILES];
 				chunkLayerCullMask(prevLayerCullMask, prev);
@@ -330,9 +544,23 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 			next = newLayer;
 		}
 
+		chunkLayerApronVertical(prev->above, materials, cnk, neighbours, solid_neighbours,
+			origin_x, origin_y, origin_z + RENDER_CHUNK_HEIGHT);
+
 		u8 *lastLayerCullMask = &cullMask[(RENDER_CHUNK_HEIGHT-1)*RENDER_CHUNK_LAYER_NUM_TILES];
 		chunkLayerCullMask(lastLayerCullMask, prev);
 
+		// The number of vertices, or instances with instanced meshes.
+		size_t numVerts = 0;
+
+#if MGC_CHUNK_MESH_INSTANCED
+		for (size_t i = 0; i < RENDER_CHUNK_NUM_TILES; i++) {
+			bool solid = !!(solidMask[i / BITS_PER_UNIT] & (1ULL << (i % BITS_PER_UNIT)));
+			if (solid && cullMask[i] != 0xff) {
+				numVerts += 1;
+			}
+		}
+#else
 		size_t numTriangles = 0;
 		for (size_t i = 0; i < RENDER_CHUNK_NUM_TILES; i++) {
 			bool solid = !!(solidMask[i / BITS_PER_UNIT] & (1ULL << (i % BITS_PER_UNIT)));
@@ -351,41 +579,53 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 			numTriangles += count_set_bits_u8(hexFaces)       * 2;
 		}
 
-		// position, normal, and color per vertex.
-		// Add 1 for alignment
-		const size_t vertexStride = sizeof(v3)*2 + sizeof(u8)*3+1;
-		assert(vertexStride == 28);
+		numVerts = numTriangles * 3;
+#endif
+
+		const size_t vertexStride = CHUNK_MESH_VERTEX_STRIDE;
 		struct chunk_gen_mesh *mesh_result;
-		mesh_result = chunk_mesh_buffer_alloc(out, vertexStride * 3 * numTriangles);
+		mesh_result = chunk_mesh_buffer_alloc(out, vertexStride * numVerts);
+		if (!mesh_result) {
+			// Keep the render chunks meshed so far, the rest are meshed
+			// again once the consumer has released some space. If the
+			// buffer was empty, that will never happen.
+			bool out_was_empty = out_head == mgc_atomic_load_u64(&out->tail);
+			result.err = (out_was_empty && result.meshed_mask == 0) ? -1 : 1;
+			break;
+		}
+
+#if MGC_CHUNK_MESH_INSTANCED
+		if (numVerts > 0) {
+			u32 *records = mesh_result->data;
 
+			size_t recordI = 0;
+			for (size_t i = 0; i < RENDER_CHUNK_NUM_TILES; i++) {
+				bool solid = !!(solidMask[i / BITS_PER_UNIT] & (1ULL << (i % BITS_PER_UNIT)));
+				if (!solid || cullMask[i] == 0xff) {
+					continue;
+				}
+
+				u32 x = i % RENDER_CHUNK_WIDTH;
+				u32 y = i / RENDER_CHUNK_LAYER_NUM_TILES;
+				u32 z = (i % RENDER_CHUNK_LAYER_NUM_TILES) / RENDER_CHUNK_WIDTH;
+				u8 visibleMask = ~cullMask[i];
+
+				records[recordI*2+0] =
+					  (x << CHUNK_MESH_VERTEX_X_SHIFT)
+					| (y << CHUNK_MESH_VERTEX_Y_SHIFT)
+					| (z << CHUNK_MESH_VERTEX_Z_SHIFT)
+					| ((u32)visibleMask << CHUNK_MESH_VERTEX_FACES_SHIFT);
+				records[recordI*2+1] = tileMaterial[i];
+				recordI += 1;
+			}
+			assert(recordI == numVerts);
+		}
+#else
 		if (numTriangles > 0) {
+#if !MGC_CHUNK_MESH_PACKED_VERTICES
 			const f32 normalX = sin(30.0 * PI / 180.0);
 			const f32 normalY = cos(30.0 * PI / 180.0);
-
-			const f32 xOffset = cos(30.0 * PI / 180.0) * hexR;
-			const f32 yOffset = sin(30.0 * PI / 180.0) * hexR;
-
-			const v3 hexVerts[] = {
-				V3(0.0f,     hexH,  hexR),
-				V3(xOffset,  hexH,  yOffset),
-				V3(xOffset,  hexH, -yOffset),
-				V3(0.0f,     hexH, -hexR),
-				V3(-xOffset, hexH, -yOffset),
-				V3(-xOffset, hexH,  yOffset),
-
-				V3(0.0f,     0.0f,  hexR),
-				V3(xOffset,  0.0f,  yOffset),
-				V3(xOffset,  0.0f, -yOffset),
-				V3(0.0f,     0.0f, -hexR),
-				V3(-xOffset, 0.0f, -yOffset),
-				V3(-xOffset, 0.0f,  yOffset),
-			};
-
-			if (!mesh_result) {
-				// TODO: Handle error here.
-				printf("We ran out of chunk gen mesh buffer space. TODO: Handle this scenario.\n");
-				break;
-			}
+#endif
 
 			u8 *vertices = mesh_result->data;
 
@@ -401,6 +641,25 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 					i / RENDER_CHUNK_LAYER_NUM_TILES,
 					(i % RENDER_CHUNK_LAYER_NUM_TILES) / RENDER_CHUNK_WIDTH
 				);
+
+				u8 visibleMask = ~cullMask[i];
+
+#if MGC_CHUNK_MESH_PACKED_VERTICES
+				u32 tileBits =
+					  (coord.x << CHUNK_MESH_VERTEX_X_SHIFT)
+					| (coord.y << CHUNK_MESH_VERTEX_Y_SHIFT)
+					| (coord.z << CHUNK_MESH_VERTEX_Z_SHIFT);
+				u32 material = tileMaterial[i];
+
+#define HEX_FACE(name, normal) \
+					u32 face = (name);
+
+#define EMIT_HEX_VERTEX(n, i) \
+					((u32 *)&vertices[vertI+vertexStride*n])[0] = tileBits \
+						| ((u32)(i) << CHUNK_MESH_VERTEX_CORNER_SHIFT) \
+						| (face << CHUNK_MESH_VERTEX_FACE_SHIFT); \
+					((u32 *)&vertices[vertI+vertexStride*n])[1] = material;
+#else
 				v3 center = V3(
 					coord.x * hexStrideX + coord.z * hexStaggerX,
 					coord.y * hexH,
@@ -411,7 +670,8 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 				u8 colorG = tileColor[i*3+1];
 				u8 colorB = tileColor[i*3+2];
 
-				u8 visibleMask = ~cullMask[i];
+#define HEX_FACE(name, n) \
+					v3 normal = (n);
 
 #define EMIT_HEX_VERTEX(n, i) \
 					*(v3 *)(&vertices[vertI+vertexStride*n+ 0]) = v3_add(center, hexVerts[i]); \
@@ -419,6 +679,7 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 					*(u8 *)(&vertices[vertI+vertexStride*n+24]) = colorR; \
 					*(u8 *)(&vertices[vertI+vertexStride*n+25]) = colorG; \
 					*(u8 *)(&vertices[vertI+vertexStride*n+26]) = colorB;
+#endif
 
 #define EMIT_HEX_TRIANGLE(i0, i1, i2) \
 				EMIT_HEX_VERTEX(0, i0) \
@@ -428,43 +689,43 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 
 #define FLAG_SET(v, flag) ((v & flag) != 0)
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_NW)) {
-					v3 normal = V3(-normalX,  0.0f, normalY);
+					HEX_FACE(NEIGHBOUR_NW, V3(-normalX,  0.0f, normalY));
 					EMIT_HEX_TRIANGLE(5, 6, 11);
 					EMIT_HEX_TRIANGLE(5, 0,  6);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_NE)) {
-					v3 normal = V3(normalX,  0.0f, normalY);
+					HEX_FACE(NEIGHBOUR_NE, V3(normalX,  0.0f, normalY));
 					EMIT_HEX_TRIANGLE(0, 7, 6);
 					EMIT_HEX_TRIANGLE(0, 1, 7);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_W)) {
-					v3 normal = V3(-1.0f,  0.0f,  0.0f);
+					HEX_FACE(NEIGHBOUR_W, V3(-1.0f,  0.0f,  0.0f));
 					EMIT_HEX_TRIANGLE(4, 11, 10);
 					EMIT_HEX_TRIANGLE(4,  5, 11);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_E)) {
-					v3 normal = V3( 1.0f,  0.0f,  0.0f);
+					HEX_FACE(NEIGHBOUR_E, V3( 1.0f,  0.0f,  0.0f));
 					EMIT_HEX_TRIANGLE(1, 8, 7);
 					EMIT_HEX_TRIANGLE(1, 2, 8);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_SW)) {
-					v3 normal = V3(-normalX,  0.0f, -normalY);
+					HEX_FACE(NEIGHBOUR_SW, V3(-normalX,  0.0f, -normalY));
 					EMIT_HEX_TRIANGLE(3, 10,  9);
 					EMIT_HEX_TRIANGLE(3,  4, 10);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_SE)) {
-					v3 normal = V3(normalX,  0.0f, -normalY);
+					HEX_FACE(NEIGHBOUR_SE, V3(normalX,  0.0f, -normalY));
 					EMIT_HEX_TRIANGLE(2, 9, 8);
 					EMIT_HEX_TRIANGLE(2, 3, 9);
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_ABOVE)) {
-					v3 normal = V3( 0.0f,  1.0f,  0.0f);
+					HEX_FACE(NEIGHBOUR_ABOVE, V3( 0.0f,  1.0f,  0.0f));
 					EMIT_HEX_TRIANGLE(0, 5, 1);
 					EMIT_HEX_TRIANGLE(1, 4, 2);
 					EMIT_HEX_TRIANGLE(1, 5, 4);
@@ -472,7 +733,7 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 				}
 
 				if (FLAG_SET(visibleMask, NEIGHBOUR_MASK_BELOW)) {
-					v3 normal = V3( 0.0f, -1.0f,  0.0f);
+					HEX_FACE(NEIGHBOUR_BELOW, V3( 0.0f, -1.0f,  0.0f));
 					EMIT_HEX_TRIANGLE(6,  7, 11);
 					EMIT_HEX_TRIANGLE(7,  8, 10);
 					EMIT_HEX_TRIANGLE(7, 10, 11);
@@ -483,94 +744,369 @@ chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_b
 			assert(vertI == vertexStride * 3 * numTriangles);
 
 #undef EMIT_HEX_TRIANGLE
-			result.set[rchunk_i] = true;
+#undef EMIT_HEX_VERTEX
+#undef HEX_FACE
 		}
+#endif
 
-		mesh_result->num_verts = numTriangles * 3;
+		mesh_result->num_verts = numVerts;
 		mesh_result->chunk = cnk->location;
 		mesh_result->render_chunk_idx = rchunk_i;
 		result.buffer[rchunk_i] = mesh_result;
+		result.meshed_mask |= 1ULL << rchunk_i;
 	}
 
 	TracyCZoneEnd(trace);
 	return result;
 }
 
-void
-mgc_chunk_vbo_pool_init(struct mgc_chunk_vbo_pool *pool,
-		struct mgc_chunk_vbo_pool_entry *mem, size_t cap)
+#if MGC_CHUNK_MESH_INSTANCED
+// The triangles of the hex prism as a face followed by three corners in
+// hexVerts, in the same winding as chunk_gen_mesh's unpacked meshes.
+static const u8 prismTriangles[20][4] = {
+	{NEIGHBOUR_NW,    5,  6, 11}, {NEIGHBOUR_NW,    5,  0,  6},
+	{NEIGHBOUR_NE,    0,  7,  6}, {NEIGHBOUR_NE,    0,  1,  7},
+	{NEIGHBOUR_W,     4, 11, 10}, {NEIGHBOUR_W,     4,  5, 11},
+	{NEIGHBOUR_E,     1,  8,  7}, {NEIGHBOUR_E,     1,  2,  8},
+	{NEIGHBOUR_SW,    3, 10,  9}, {NEIGHBOUR_SW,    3,  4, 10},
+	{NEIGHBOUR_SE,    2,  9,  8}, {NEIGHBOUR_SE,    2,  3,  9},
+	{NEIGHBOUR_ABOVE, 0,  5,  1}, {NEIGHBOUR_ABOVE, 1,  4,  2},
+	{NEIGHBOUR_ABOVE, 1,  5,  4}, {NEIGHBOUR_ABOVE, 2,  4,  3},
+	{NEIGHBOUR_BELOW, 6,  7, 11}, {NEIGHBOUR_BELOW, 7,  8, 10},
+	{NEIGHBOUR_BELOW, 7, 10, 11}, {NEIGHBOUR_BELOW, 8,  9, 10},
+};
+
+// Uploads the prism every chunk instance draws. Each vertex is a corner and a
+// face, so the shader can give the face its normal and hide it.
+static void
+chunkPrismInit(struct mgc_chunk_vbo_pool *pool)
 {
-	pool->entries = mem;
-	pool->cap_entries = cap;
-	pool->free_list = pool->entries;
+	u8 vertices[CHUNK_MESH_PRISM_NUM_VERTS][2];
+	u8 indices[CHUNK_MESH_PRISM_NUM_INDICES];
+	size_t numVertices = 0;
 
-	memset(pool->entries, 0, pool->cap_entries * sizeof(struct mgc_chunk_vbo_pool_entry));
-	// Exclude the last entry to leave its free_list_next it at NULL.
-	for (size_t i = 0; i < pool->cap_entries-1; i++) {
-		pool->entries[i].free_list_next = &pool->entries[i+1];
+	for (size_t tri_i = 0; tri_i < ARRAY_LENGTH(prismTriangles); tri_i++) {
+		u8 face = prismTriangles[tri_i][0];
+
+		for (size_t corner_i = 0; corner_i < 3; corner_i++) {
+			u8 corner = prismTriangles[tri_i][1 + corner_i];
+
+			size_t vert_i = 0;
+			while (vert_i < numVertices &&
+				(vertices[vert_i][0] != corner || vertices[vert_i][1] != face)) {
+				vert_i += 1;
+			}
+
+			if (vert_i == numVertices) {
+				assert(numVertices < CHUNK_MESH_PRISM_NUM_VERTS);
+				vertices[vert_i][0] = corner;
+				vertices[vert_i][1] = face;
+				numVertices += 1;
+			}
+
+			indices[tri_i*3 + corner_i] = vert_i;
+		}
 	}
+	assert(numVertices == CHUNK_MESH_PRISM_NUM_VERTS);
+
+	glGenBuffers(1, &pool->prism_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, pool->prism_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &pool->prism_elements);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->prism_elements);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
+#endif
 
-struct mgc_chunk_vbo_pool_entry *
-mgc_chunk_vbo_pool_alloc(struct mgc_chunk_vbo_pool *pool, u8 *data, size_t num_vertices)
+// Points the shared VAO's attributes at the pool's vertex buffer. Must be
+// called again whenever the vertex buffer is replaced.
+static void
+chunkVboPoolBindAttributes(struct mgc_chunk_vbo_pool *pool)
 {
-	struct mgc_chunk_vbo_pool_entry *entry;
-	entry = pool->free_list;
-	if (!entry) {
-		printf("out of vbos\n");
-		return NULL;
-	}
-	pool->free_list = entry->free_list_next;
-	entry->free_list_next = NULL;
+	const size_t vertex_stride = CHUNK_MESH_VERTEX_STRIDE;
+
+	glBindVertexArray(pool->vao);
 
-	struct mgc_mesh *mesh = &entry->mesh;
+#if MGC_CHUNK_MESH_INSTANCED
+	// Corner and face of the shared prism
+	glBindBuffer(GL_ARRAY_BUFFER, pool->prism_vbo);
+	glVertexAttribIPointer(0, 2, GL_UNSIGNED_BYTE, 2, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->prism_elements);
 
-	// Add 1 for alignment
-	const size_t vertex_stride = sizeof(v3)*2 + sizeof(u8)*3+1;
-	assert(vertex_stride == 28);
-	size_t buffer_size = num_vertices * vertex_stride;
+	// Tile and visible faces, and material, per instance
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+	glVertexAttribIPointer(1, 2, GL_UNSIGNED_INT, vertex_stride, 0);
+	glVertexAttribDivisor(1, 1);
 
-	mesh->numVertices = num_vertices;
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+#elif MGC_CHUNK_MESH_PACKED_VERTICES
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
 
-	if (!entry->initialized) {
-		glGenVertexArrays(1, &mesh->vao);
-		glGenBuffers(1, &mesh->vbo);
+	// Tile, corner and face, and material
+	glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, vertex_stride, 0);
+
+	glEnableVertexAttribArray(0);
+#else
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+
+	// Position
+	glVertexAttribPointer(0, 3, GL_FLOAT,         GL_FALSE, vertex_stride, 0);
+	// Normal
+	glVertexAttribPointer(1, 3, GL_FLOAT,         GL_FALSE, vertex_stride, (void*)(sizeof(v3)));
+	// Colour
+	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE,  vertex_stride, (void*)(sizeof(v3)*2));
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+#endif
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static size_t
+chunkVboPoolBufferSize(struct mgc_chunk_vbo_pool *pool)
+{
+	return (size_t)mgc_buddy_num_units(&pool->blocks)
+		* MGC_CHUNK_VBO_POOL_BLOCK_VERTICES
+		* CHUNK_MESH_VERTEX_STRIDE;
+}
+
+static void
+chunkVboPoolInitGl(struct mgc_chunk_vbo_pool *pool)
+{
+#if MGC_CHUNK_MESH_INSTANCED
+	chunkPrismInit(pool);
+#endif
+
+	glGenVertexArrays(1, &pool->vao);
+	glGenBuffers(1, &pool->vbo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+	glBufferData(GL_ARRAY_BUFFER, chunkVboPoolBufferSize(pool), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	chunkVboPoolBindAttributes(pool);
+
+	pool->initialized = true;
+}
+
+// Doubles the size of the vertex buffer. The meshes in it keep their
+// offsets, so they are copied to the start of the new buffer.
+static int
+chunkVboPoolGrow(struct mgc_chunk_vbo_pool *pool)
+{
+	TracyCZone(trace, true);
+
+	size_t old_size = chunkVboPoolBufferSize(pool);
+	if (mgc_buddy_grow(&pool->blocks)) {
+		TracyCZoneEnd(trace);
+		return -1;
 	}
+	size_t new_size = chunkVboPoolBufferSize(pool);
 
-	glBindVertexArray(mesh->vao);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	u32 new_vbo;
+	glGenBuffers(1, &new_vbo);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_DYNAMIC_DRAW);
 
-	if (entry->buffer_size < buffer_size) {
-		glBufferData(GL_ARRAY_BUFFER, buffer_size, data, GL_STATIC_DRAW);
-		entry->buffer_size = buffer_size;
-	} else {
-		glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_size, data);
+	glBindBuffer(GL_COPY_READ_BUFFER, pool->vbo);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glDeleteBuffers(1, &pool->vbo);
+	pool->vbo = new_vbo;
+
+	chunkVboPoolBindAttributes(pool);
+
+	TracyCZoneEnd(trace);
+	return 0;
+}
+
+static u32
+chunkVboPoolNumBlocks(size_t num_vertices)
+{
+	return (num_vertices + MGC_CHUNK_VBO_POOL_BLOCK_VERTICES - 1)
+		/ MGC_CHUNK_VBO_POOL_BLOCK_VERTICES;
+}
+
+int
+mgc_chunk_vbo_pool_init(struct mgc_chunk_vbo_pool *pool)
+{
+	memset(pool, 0, sizeof(struct mgc_chunk_vbo_pool));
+	return mgc_buddy_init(&pool->blocks, MGC_CHUNK_VBO_POOL_LOG_INITIAL_BLOCKS);
+}
+
+void
+mgc_chunk_vbo_pool_destroy(struct mgc_chunk_vbo_pool *pool)
+{
+	// The GL objects go away with the context.
+	mgc_buddy_destroy(&pool->blocks);
+}
+
+int
+mgc_chunk_vbo_pool_alloc(struct mgc_chunk_vbo_pool *pool, u8 *data, size_t num_vertices, struct mgc_chunk_vbo_alloc *out)
+{
+	struct mgc_chunk_vbo_alloc result = {0};
+
+	if (num_vertices == 0) {
+		*out = result;
+		return 0;
 	}
 
-	if (!entry->initialized) {
-		// Position
-		glVertexAttribPointer(0, 3, GL_FLOAT,         GL_FALSE, vertex_stride, 0);
-		// Normal
-		glVertexAttribPointer(1, 3, GL_FLOAT,         GL_FALSE, vertex_stride, (void*)(sizeof(v3)));
-		// Colour
-		glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE,  vertex_stride, (void*)(sizeof(v3)*2));
-
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
+	if (!pool->initialized) {
+		chunkVboPoolInitGl(pool);
 	}
 
-	glBindVertexArray(0);
+	u32 block;
+	while (mgc_buddy_alloc(&pool->blocks, chunkVboPoolNumBlocks(num_vertices), &block)) {
+		if (chunkVboPoolGrow(pool)) {
+			print_error("chunk mesher", "Failed to grow the chunk vertex buffer.");
+			return -1;
+		}
+	}
+
+	const size_t vertex_stride = CHUNK_MESH_VERTEX_STRIDE;
+
+	result.first = block * MGC_CHUNK_VBO_POOL_BLOCK_VERTICES;
+	result.num_vertices = num_vertices;
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+	glBufferSubData(GL_ARRAY_BUFFER,
+		(size_t)result.first * vertex_stride,
+		num_vertices * vertex_stride,
+		data);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	entry->initialized = true;
+	*out = result;
+	return 0;
+}
+
+void
+mgc_chunk_vbo_pool_release(struct mgc_chunk_vbo_pool *pool, struct mgc_chunk_vbo_alloc alloc)
+{
+	if (alloc.num_vertices == 0) {
+		return;
+	}
+
+	mgc_buddy_free(&pool->blocks,
+		alloc.first / MGC_CHUNK_VBO_POOL_BLOCK_VERTICES,
+		chunkVboPoolNumBlocks(alloc.num_vertices));
+}
 
-	return entry;
+#if MGC_CHUNK_RENDER_INDIRECT
+void
+mgc_chunk_draw_list_destroy(struct mgc_chunk_draw_list *list)
+{
+	// The GL objects go away with the context.
+	free(list->commands);
+	free(list->offsets);
+	list->commands = NULL;
+	list->offsets = NULL;
+	list->num_draws = 0;
+	list->cap_draws = 0;
 }
 
 void
-mgc_chunk_vbo_pool_release(struct mgc_chunk_vbo_pool *pool, struct mgc_chunk_vbo_pool_entry *entry)
+mgc_chunk_draw_list_clear(struct mgc_chunk_draw_list *list)
 {
-	entry->free_list_next = pool->free_list;
-	pool->free_list = entry;
+	list->num_draws = 0;
 }
+
+void
+mgc_chunk_draw_list_push(struct mgc_chunk_draw_list *list, struct mgc_chunk_vbo_alloc mesh, v3 offset)
+{
+	if (mesh.num_vertices == 0) {
+		return;
+	}
+
+	if (list->num_draws >= list->cap_draws) {
+		size_t new_cap = list->cap_draws ? list->cap_draws * 2 : 1024;
+
+		struct mgc_chunk_draw_command *commands;
+		commands = realloc(list->commands, new_cap * sizeof(struct mgc_chunk_draw_command));
+		if (!commands) {
+			panic("Failed to grow the chunk draw list.");
+			return;
+		}
+		list->commands = commands;
+
+		v4 *offsets;
+		offsets = realloc(list->offsets, new_cap * sizeof(v4));
+		if (!offsets) {
+			panic("Failed to grow the chunk draw list.");
+			return;
+		}
+		list->offsets = offsets;
+
+		list->cap_draws = new_cap;
+	}
+
+	struct mgc_chunk_draw_command *cmd = &list->commands[list->num_draws];
+#if MGC_CHUNK_MESH_INSTANCED
+	cmd->count = CHUNK_MESH_PRISM_NUM_INDICES;
+	cmd->instance_count = mesh.num_vertices;
+	cmd->first_index = 0;
+	cmd->base_vertex = 0;
+	cmd->base_instance = mesh.first;
+#else
+	cmd->count = mesh.num_vertices;
+	cmd->instance_count = 1;
+	cmd->first = mesh.first;
+	cmd->base_instance = 0;
+#endif
+
+	list->offsets[list->num_draws] = V4(offset.x, offset.y, offset.z, 0.0f);
+	list->num_draws += 1;
+}
+
+void
+mgc_chunk_draw_list_draw(struct mgc_chunk_draw_list *list, struct mgc_chunk_vbo_pool *pool)
+{
+	TracyCZone(trace, true);
+
+	if (list->num_draws == 0 || !pool->initialized) {
+		TracyCZoneEnd(trace);
+		return;
+	}
+
+	if (!list->initialized) {
+		glGenBuffers(1, &list->command_buffer);
+		glGenBuffers(1, &list->offset_buffer);
+		list->initialized = true;
+	}
+
+	// Both buffers are respecified every frame, so the driver does not have
+	// to wait for the previous frame's draws to finish.
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list->command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER,
+		list->num_draws * sizeof(struct mgc_chunk_draw_command),
+		list->commands, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, list->offset_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER,
+		list->num_draws * sizeof(v4),
+		list->offsets, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, list->offset_buffer);
+
+	glBindVertexArray(pool->vao);
+#if MGC_CHUNK_MESH_INSTANCED
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_BYTE, 0, list->num_draws, 0);
+#else
+	glMultiDrawArraysIndirect(GL_TRIANGLES, 0, list->num_draws, 0);
+#endif
+	glBindVertexArray(0);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	TracyCZoneEnd(trace);
+}
+#endif
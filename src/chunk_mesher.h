@@ -4,6 +4,66 @@
 #include "mesh.h"
 #include "types.h"
 #include "config.h"
+#include "buddy.h"
+
+typedef enum {
+	NEIGHBOUR_NW    = 0,
+	NEIGHBOUR_NE    = 1,
+	NEIGHBOUR_W     = 2,
+	NEIGHBOUR_E     = 3,
+	NEIGHBOUR_SW    = 4,
+	NEIGHBOUR_SE    = 5,
+	NEIGHBOUR_ABOVE = 6,
+	NEIGHBOUR_BELOW = 7,
+} LayerNeighbourName;
+
+#define NUM_LAYER_NEIGHBOURS 8
+
+// The offset from a tile to each of its neighbours, indexed by
+// LayerNeighbourName. Chunks use the same grid, so these are also the offsets
+// from a chunk to the chunks it shares faces with.
+extern const v3i chunk_mesh_neighbour_offsets[NUM_LAYER_NEIGHBOURS];
+
+// Instanced meshes have one record of two u32s per visible tile. The first
+// holds the tile's coordinate in the render chunk (x, up, and z, as in
+// mgc_grid_draw_coord's output) and the mask of faces to draw, indexed by
+// LayerNeighbourName. The second is the tile's material, which the shader
+// looks up in its palette. The mesh's num_verts is the number of records.
+//
+// Packed vertices are two u32s. The first holds the tile's coordinate, the
+// corner in hexVerts and the face as a LayerNeighbourName. The second is the
+// tile's material.
+//
+// Unpacked vertices are position(v3f) normal(v3f) colour(3*u8) and one byte
+// of padding.
+#if MGC_CHUNK_MESH_INSTANCED
+#define CHUNK_MESH_VERTEX_STRIDE 8
+#define CHUNK_MESH_VERTEX_X_SHIFT 0
+#define CHUNK_MESH_VERTEX_Y_SHIFT 5
+#define CHUNK_MESH_VERTEX_Z_SHIFT 10
+#define CHUNK_MESH_VERTEX_FACES_SHIFT 15
+
+// The shared prism has 4 vertices per side and 6 per cap, and is drawn as 20
+// triangles.
+#define CHUNK_MESH_PRISM_NUM_VERTS (6*4 + 2*6)
+#define CHUNK_MESH_PRISM_NUM_INDICES (20*3)
+#elif MGC_CHUNK_MESH_PACKED_VERTICES
+#define CHUNK_MESH_VERTEX_STRIDE 8
+#define CHUNK_MESH_VERTEX_X_SHIFT 0
+#define CHUNK_MESH_VERTEX_Y_SHIFT 5
+#define CHUNK_MESH_VERTEX_Z_SHIFT 10
+#define CHUNK_MESH_VERTEX_CORNER_SHIFT 15
+#define CHUNK_MESH_VERTEX_FACE_SHIFT 19
+#else
+#define CHUNK_MESH_VERTEX_STRIDE 28
+#endif
+
+// Whether meshes refer to materials instead of holding colours.
+#define CHUNK_MESH_USES_PALETTE (MGC_CHUNK_MESH_INSTANCED || MGC_CHUNK_MESH_PACKED_VERTICES)
+
+#if CHUNK_MESH_USES_PALETTE && (RENDER_CHUNK_WIDTH > 32 || RENDER_CHUNK_HEIGHT > 32)
+#error "Packed tile coordinates only have room for render chunks up to 32 tiles wide and high."
+#endif
 
 #define BITS_PER_UNIT (sizeof(u64)*8)
 #define LAYER_MASK_UNITS ((RENDER_CHUNK_LAYER_NUM_TILES + BITS_PER_UNIT-1) / BITS_PER_UNIT)
@@ -22,40 +82,66 @@ struct layer_neighbours {
 
 struct render_chunk_gen_mesh_buffer {
 	u64 solidMask[(RENDER_CHUNK_NUM_TILES + BITS_PER_UNIT-1) / BITS_PER_UNIT];
+#if CHUNK_MESH_USES_PALETTE
+	u16 tileMaterial[RENDER_CHUNK_NUM_TILES];
+#else
 	u8 tileColor[RENDER_CHUNK_NUM_TILES * 3];
+#endif
 };
 
-// Keep the buffers for chunk generating to avoid reallocation.
+// Keep the buffers for chunk generating to avoid reallocation. The buffers
+// are reused for each render chunk that is meshed.
 struct chunk_gen_mesh_buffer {
-	struct render_chunk_gen_mesh_buffer render_chunks[RENDER_CHUNKS_PER_CHUNK];
-	u8 cullMask[sizeof(u8) * 8*RENDER_CHUNK_NUM_TILES];
+	struct render_chunk_gen_mesh_buffer render_chunk;
+	u8 cullMask[RENDER_CHUNK_NUM_TILES];
 	struct layer_neighbours neighbourMasks[3];
 };
 
 struct chunk_gen_mesh {
-	struct chunk_gen_mesh *next;
+	// The buffer the mesh was allocated from, and the buffer's head after
+	// the allocation.
+	struct chunk_gen_mesh_out_buffer *owner;
+	u64 end;
+
 	void *data;
 	size_t cap;
 	size_t num_verts;
 	v3i chunk;
 	size_t render_chunk_idx;
+	// Set by the chunk cache to the load_id of the entry the mesh was made
+	// for.
+	u64 load_id;
 };
 
+// A cyclic buffer that one mesher allocates meshes from, and that the
+// consumer releases the meshes back to in the same order.
 struct chunk_gen_mesh_out_buffer {
-	// TODO: Thread safe
-
-	void *data;
+	u8 *data;
 	size_t cap;
 
-	void *head;
+	// The total number of bytes that have been allocated and released. head
+	// is only touched by the mesher, tail is written by the consumer.
+	u64 head;
+	volatile u64 tail;
+};
 
-	// The next chunk_gen_mesh is the first that should be popped, and is also
-	// the tail of the cyclic buffer.
-	struct chunk_gen_mesh *next;
+struct chunk_gen_mesh_ring_slot {
+	// Set to the slot's position + 1 when the mesh has been pushed.
+	volatile u32 sequence;
+	struct chunk_gen_mesh *mesh;
+};
+
+// A bounded queue of finished meshes with multiple producers and a single
+// consumer. Producers must reserve room for their meshes before pushing
+// them, so pushing never fails.
+struct chunk_gen_mesh_ring {
+	struct chunk_gen_mesh_ring_slot *slots;
+	u32 cap;
 
-	// A reference to the next pointer to the newest chunk_gen_mesh, or
-	// chunk_gen_mesh_out_buffer.next if the queue is empty.
-	struct chunk_gen_mesh **tail;
+	volatile u32 num_reserved;
+	volatile u32 tail;
+	// Only touched by the consumer.
+	u32 head;
 };
 
 #undef LAYER_MASK_UNITS
@@ -64,7 +150,10 @@ struct chunk_gen_mesh_out_buffer {
 struct mgc_chunk_gen_mesh_result {
 	struct chunk_gen_mesh *buffer[RENDER_CHUNKS_PER_CHUNK];
 	// struct mgc_mesh mesh[RENDER_CHUNKS_PER_CHUNK];
-	bool set[RENDER_CHUNKS_PER_CHUNK];
+	// The render chunks that got a mesh in buffer.
+	u64 meshed_mask;
+	// 1 if the out buffer filled up before every dirty render chunk was
+	// meshed, and -1 if not even one render chunk fits in the empty buffer.
 	int err;
 };
 
@@ -74,36 +163,135 @@ struct mgc_chunk;
 int
 chunk_gen_mesh_buffer_init(struct chunk_gen_mesh_out_buffer *buffer);
 
+void
+chunk_gen_mesh_buffer_destroy(struct chunk_gen_mesh_out_buffer *buffer);
+
+// Gives the mesh's memory back to the buffer it was allocated from. Meshes
+// from the same buffer must be released in the order they were allocated.
+void
+chunk_mesh_buffer_release(struct chunk_gen_mesh *mesh);
+
+// cap must be a power of two.
+int
+chunk_mesh_ring_init(struct chunk_gen_mesh_ring *ring, u32 cap);
+
+void
+chunk_mesh_ring_destroy(struct chunk_gen_mesh_ring *ring);
+
+// Reserves room for num_meshes pushes. Returns false if the ring does not
+// have room for them.
+bool
+chunk_mesh_ring_reserve(struct chunk_gen_mesh_ring *ring, u32 num_meshes);
+
+// Returns reserved room that will not be pushed to.
+void
+chunk_mesh_ring_unreserve(struct chunk_gen_mesh_ring *ring, u32 num_meshes);
+
+void
+chunk_mesh_ring_push(struct chunk_gen_mesh_ring *ring, struct chunk_gen_mesh *mesh);
+
+// Returns NULL if the ring is empty or the oldest mesh is not pushed yet.
+// Must only be called from one thread at a time.
 struct chunk_gen_mesh *
-chunk_mesh_buffer_pop(struct chunk_gen_mesh_out_buffer *buffer);
+chunk_mesh_ring_pop(struct chunk_gen_mesh_ring *ring);
 
+// Meshes the render chunks in dirty_mask into out, one mesh per render chunk.
+// If out fills up, the meshes made so far are still returned in buffer and
+// meshed_mask, and err is positive. The caller resumes by meshing the render
+// chunks left in dirty_mask once the consumer has released some space.
+// neighbours holds the adjacent chunks indexed by LayerNeighbourName, and is
+// used to cull faces on the chunk's border. Tiles in NULL neighbours are solid
+// if the neighbour's bit is set in solid_neighbours.
 struct mgc_chunk_gen_mesh_result
-chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_buffer *out, struct mgc_material_table *materials, struct mgc_chunk *cnk, u64 dirty_mask);
+chunk_gen_mesh(struct chunk_gen_mesh_buffer *buffer, struct chunk_gen_mesh_out_buffer *out, struct mgc_material_table *materials, struct mgc_chunk *cnk, struct mgc_chunk **neighbours, u8 solid_neighbours, u64 dirty_mask);
 
-struct mgc_chunk_vbo_pool_entry {
-	struct mgc_chunk_vbo_pool_entry *free_list_next;
-	struct mgc_mesh mesh;
-	size_t buffer_size;
-	bool initialized;
+// A range of vertices in the pool's vertex buffer. Empty if num_vertices is 0.
+struct mgc_chunk_vbo_alloc {
+	u32 first;
+	u32 num_vertices;
 };
 
+// Every chunk mesh lives in one vertex buffer that is drawn through one
+// VAO, with each mesh's first vertex (or instance) as the draw's offset.
 struct mgc_chunk_vbo_pool {
-	struct mgc_chunk_vbo_pool_entry *entries;
-	size_t cap_entries;
-	struct mgc_chunk_vbo_pool_entry *free_list;
+	// In blocks of MGC_CHUNK_VBO_POOL_BLOCK_VERTICES vertices.
+	struct mgc_buddy blocks;
+
+	// Created on the first allocation, as GL might not be initialized when
+	// the pool is.
+	u32 vao, vbo;
+	bool initialized;
+
+#if MGC_CHUNK_MESH_INSTANCED
+	// The hex prism every instance draws.
+	u32 prism_vbo, prism_elements;
+#endif
 };
 
+int
+mgc_chunk_vbo_pool_init(struct mgc_chunk_vbo_pool *pool);
+
 void
-mgc_chunk_vbo_pool_init(struct mgc_chunk_vbo_pool *pool,
-		struct mgc_chunk_vbo_pool_entry *mem, size_t cap);
+mgc_chunk_vbo_pool_destroy(struct mgc_chunk_vbo_pool *pool);
 
-// This routine is specifc for chunk meshes. It requires the data to be:
-// position(v3f) normal(v3f) colour(3*u8)
+// This routine is specifc for chunk meshes. It requires the data to be in the
+// format described by CHUNK_MESH_VERTEX_STRIDE. With instanced meshes,
+// num_vertices is the number of instances. The vertex buffer is grown if it
+// does not have room for the mesh. Returns non-zero, and leaves out
+// untouched, if the vertex buffer could not be grown.
 // This routine is not thread safe because of the open-gl calls.
-struct mgc_chunk_vbo_pool_entry *
-mgc_chunk_vbo_pool_alloc(struct mgc_chunk_vbo_pool *pool, u8 *data, size_t num_vertices);
+int
+mgc_chunk_vbo_pool_alloc(struct mgc_chunk_vbo_pool *pool, u8 *data, size_t num_vertices, struct mgc_chunk_vbo_alloc *out);
 
 void
-mgc_chunk_vbo_pool_release(struct mgc_chunk_vbo_pool *pool, struct mgc_chunk_vbo_pool_entry *entry);
+mgc_chunk_vbo_pool_release(struct mgc_chunk_vbo_pool *pool, struct mgc_chunk_vbo_alloc alloc);
+
+#if MGC_CHUNK_RENDER_INDIRECT
+// The layout of the commands glMultiDraw*Indirect reads.
+#if MGC_CHUNK_MESH_INSTANCED
+struct mgc_chunk_draw_command {
+	u32 count;
+	u32 instance_count;
+	u32 first_index;
+	i32 base_vertex;
+	u32 base_instance;
+};
+#else
+struct mgc_chunk_draw_command {
+	u32 count;
+	u32 instance_count;
+	u32 first;
+	u32 base_instance;
+};
+#endif
+
+// Collects the render chunks to draw in a frame, and draws them all with one
+// multi-draw call. The shader reads each draw's offset from drawOffsets.
+struct mgc_chunk_draw_list {
+	struct mgc_chunk_draw_command *commands;
+	// vec4 for each draw, to match the storage buffer's std430 layout.
+	v4 *offsets;
+	size_t num_draws;
+	size_t cap_draws;
+
+	// Created on the first draw.
+	u32 command_buffer, offset_buffer;
+	bool initialized;
+};
+
+void
+mgc_chunk_draw_list_destroy(struct mgc_chunk_draw_list *list);
+
+void
+mgc_chunk_draw_list_clear(struct mgc_chunk_draw_list *list);
+
+void
+mgc_chunk_draw_list_push(struct mgc_chunk_draw_list *list, struct mgc_chunk_vbo_alloc mesh, v3 offset);
+
+// Uploads the draws and draws them with the pool's VAO. The shader program
+// must already be bound.
+void
+mgc_chunk_draw_list_draw(struct mgc_chunk_draw_list *list, struct mgc_chunk_vbo_pool *pool);
+#endif
 
 #endif
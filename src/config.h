@@ -33,11 +33,29 @@
 #define RENDER_CHUNKS_PER_CHUNK_LAYER (RENDER_CHUNKS_PER_CHUNK_WIDTH*RENDER_CHUNKS_PER_CHUNK_WIDTH)
 #define RENDER_CHUNKS_PER_CHUNK (RENDER_CHUNKS_PER_CHUNK_LAYER*RENDER_CHUNKS_PER_CHUNK_HEIGHT)
 
+// Store the tiles' materials and data in separate arrays instead of
+// interleaved, so passes that only look at materials read half as much.
+// `./build.sh check` compares the two layouts.
+#ifndef MGC_CHUNK_SOA
+#define MGC_CHUNK_SOA 1
+#endif
+
 #define SIM_CHUNK_BATCH_SIZE_LAYERS 8
 #if (CHUNK_HEIGHT % SIM_CHUNK_BATCH_SIZE_LAYERS) != 0
 #error "SIM_CHUNK_BATCH_SIZE_LAYERS must be a multiple of CHUNK_HEIGHT"
 #endif
 
+// Resolve straight falls 64 tiles at a time. Set to 0 to only use the scalar
+// rules, which the fast path must match exactly. `./build.sh check` compares
+// the two.
+#ifndef MGC_SIM_FAST_GRAVITY
+#define MGC_SIM_FAST_GRAVITY 1
+#endif
+
+// Upper bound on the number of threads simulating chunks, including the sim
+// thread itself.
+#define MGC_SIM_MAX_THREADS (8)
+
 #define NUM_SIM_CHUNKS_WIDTH (((MGC_SIM_RADIUS*2+1 + CHUNK_WIDTH-1)/CHUNK_WIDTH)+1)
 #define NUM_SIM_CHUNKS_HEIGHT (((MGC_SIM_RADIUS*2+1 + CHUNK_HEIGHT-1)/CHUNK_HEIGHT)+1)
 #define NUM_SIM_CHUNKS (NUM_SIM_CHUNKS_WIDTH*NUM_SIM_CHUNKS_WIDTH*NUM_SIM_CHUNKS_HEIGHT)
@@ -46,8 +64,60 @@
 #define HEX_HEIGHT (0.25f)
 #define HEX_RADIUS (0.5f)
 
+// Store chunk mesh vertices as 8 byte tile coordinates, corner, face and
+// material ids that the vertex shader expands, instead of 28 byte positions,
+// normals and colours.
+#define MGC_CHUNK_MESH_PACKED_VERTICES 1
+
+// Draw chunks as one instance of a shared hex prism per visible tile, which
+// the vertex shader places and hides the culled faces of, instead of meshing
+// every visible face. Takes precedence over MGC_CHUNK_MESH_PACKED_VERTICES.
+#define MGC_CHUNK_MESH_INSTANCED 1
+
+// Upper bound on the number of materials the packed and instanced vertex
+// shaders can colour. Must match the size of palette in the shaders.
+#define MGC_CHUNK_MESH_PALETTE_SIZE (64)
+
 #define MGC_CHUNK_CACHE_WIDTH (10)
 #define MGC_CHUNK_CACHE_SIZE (MGC_CHUNK_CACHE_WIDTH*MGC_CHUNK_CACHE_WIDTH*MGC_CHUNK_CACHE_WIDTH)
 
+// Start evicting chunks outside the load bounds when fewer than this many
+// cache entries are free, and evict at most MGC_CHUNK_CACHE_EVICT_BATCH
+// entries per render tick.
+#define MGC_CHUNK_CACHE_MIN_FREE (MGC_CHUNK_CACHE_SIZE/8)
+#define MGC_CHUNK_CACHE_EVICT_BATCH (64)
+
+// Keep chunks whose tiles are all the same as just that tile. They are only
+// given their tiles once the sim might write to them.
+#define MGC_CHUNK_CACHE_UNIFORM_CHUNKS 1
+
+// Store chunks that are out of the sim's reach and fully meshed as a palette
+// and bit-packed indices, and give their tiles back to the system. They are
+// expanded again when the sim reaches them or they have to be meshed. At
+// most MGC_CHUNK_CACHE_COMPRESS_BATCH chunks are compressed per sim tick.
+#define MGC_CHUNK_CACHE_COMPRESS_IDLE 1
+#define MGC_CHUNK_CACHE_COMPRESS_BATCH (64)
+
+// Upper bound on the number of threads loading chunks in the background.
+#define MGC_CHUNK_LOADER_MAX_THREADS (4)
+
+// Each mesher allocates its meshes from its own buffer of this many bytes,
+// and publishes them through a ring with room for this many meshes. A
+// mesher that runs out of either leaves the chunk dirty until a later tick.
+#define MGC_CHUNK_MESH_OUT_BUFFER_SIZE (16*1000*1000)
+#define MGC_CHUNK_MESH_RING_SIZE (4096)
+
+// Chunk meshes are sub-allocated from one vertex buffer in blocks of a power
+// of two times this many vertices. The buffer starts out with room for
+// 1 << MGC_CHUNK_VBO_POOL_LOG_INITIAL_BLOCKS blocks, and doubles in size
+// when it runs out.
+#define MGC_CHUNK_VBO_POOL_BLOCK_VERTICES (16)
+#define MGC_CHUNK_VBO_POOL_LOG_INITIAL_BLOCKS (12)
+
+// Draw every visible render chunk with one multi-draw-indirect call, with
+// each draw's offset in a storage buffer, instead of one draw call per render
+// chunk.
+#define MGC_CHUNK_RENDER_INDIRECT 1
+
 
 #endif
@@ -3,6 +3,7 @@
 float hexStrideX;
 float hexStrideY;
 float hexStaggerX;
+v3 hexVerts[HEX_NUM_VERTS];
 
 void
 hexGridInitialize()
@@ -10,6 +11,23 @@ hexGridInitialize()
 	hexStrideX = cos(30.0 * PI / 180.0) * 2.0f * hexR;
 	hexStrideY = sin(30.0 * PI / 180.0) * hexR + hexR;
 	hexStaggerX = cos(30.0 * PI / 180.0) * hexR;
+
+	const f32 xOffset = cos(30.0 * PI / 180.0) * hexR;
+	const f32 yOffset = sin(30.0 * PI / 180.0) * hexR;
+
+	hexVerts[ 0] = V3(0.0f,     hexH,  hexR);
+	hexVerts[ 1] = V3(xOffset,  hexH,  yOffset);
+	hexVerts[ 2] = V3(xOffset,  hexH, -yOffset);
+	hexVerts[ 3] = V3(0.0f,     hexH, -hexR);
+	hexVerts[ 4] = V3(-xOffset, hexH, -yOffset);
+	hexVerts[ 5] = V3(-xOffset, hexH,  yOffset);
+
+	hexVerts[ 6] = V3(0.0f,     0.0f,  hexR);
+	hexVerts[ 7] = V3(xOffset,  0.0f,  yOffset);
+	hexVerts[ 8] = V3(xOffset,  0.0f, -yOffset);
+	hexVerts[ 9] = V3(0.0f,     0.0f, -hexR);
+	hexVerts[10] = V3(-xOffset, 0.0f, -yOffset);
+	hexVerts[11] = V3(-xOffset, 0.0f,  yOffset);
 }
 
 v2
@@ -36,3 +54,27 @@ mgc_grid_draw_coord(v3i p)
 
 	return res;
 }
+
+v3i
+mgc_grid_tile_coord(v3 p)
+{
+	v3i res;
+
+	res.y = (int)roundf(p.z / hexStrideY);
+	res.x = (int)roundf((p.x - res.y * hexStaggerX) / hexStrideX);
+	res.z = (int)floorf(p.y / hexH);
+
+	return res;
+}
+
+void
+mgc_grid_draw_bounds(v3i origin, v3i extent, v3 *out_min, v3 *out_max)
+{
+	v3 first = mgc_grid_draw_coord(origin);
+	v3 last = mgc_grid_draw_coord(v3i_add(origin,
+		V3i(extent.x - 1, extent.y - 1, extent.z - 1)));
+
+	// Tiles reach hexStaggerX and hexR out from their center, and hexH up.
+	*out_min = V3(first.x - hexStaggerX, first.y, first.z - hexR);
+	*out_max = V3(last.x + hexStaggerX, last.y + hexH, last.z + hexR);
+}
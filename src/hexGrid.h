@@ -14,6 +14,12 @@ extern float hexStrideX;
 extern float hexStrideY;
 extern float hexStaggerX;
 
+#define HEX_NUM_VERTS 12
+
+// The corners of a tile relative to its center, the top face followed by the
+// bottom face.
+extern v3 hexVerts[HEX_NUM_VERTS];
+
 void
 hexGridInitialize();
 
@@ -23,4 +29,13 @@ gridDrawCoord(v2i);
 v3
 mgc_grid_draw_coord(v3i p);
 
+// The tile whose center is closest to the render space point p, from the
+// tile layer p is in. The inverse of mgc_grid_draw_coord.
+v3i
+mgc_grid_tile_coord(v3 p);
+
+// The render-space box around the tiles from origin to origin+extent-1.
+void
+mgc_grid_draw_bounds(v3i origin, v3i extent, v3 *out_min, v3 *out_max);
+
 #endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <signal.h>
@@ -130,8 +131,24 @@ int main(int argc, char *argv[])
 	freopen_s(&console_fp, "CONOUT$", "w", stdout);
 	freopen_s(&console_fp, "CONOUT$", "w", stderr);
 #endif
+
+	int argc = __argc;
+	char **argv = __argv;
 #endif
 
+	// With --archive, chunks are loaded from a chunk archive instead of
+	// being generated from the world definition.
+	const char *archive_path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+			i += 1;
+			archive_path = argv[i];
+		} else {
+			fprintf(stderr, "usage: %s [--archive <chunk archive>]\n", argv[0]);
+			return -1;
+		}
+	}
+
 	if (!glfwInit()) {
 		printf("Failed to initialize glfw.\n");
 		return -1;
@@ -171,7 +188,11 @@ int main(int argc, char *argv[])
 	world_init_context.err = &err_ctx;
 
 	struct mgc_world world = {0};
-	mgc_world_init_world_def(&world, &world_init_context);
+	if (archive_path) {
+		mgc_world_init_precomputed(&world, &world_init_context, archive_path);
+	} else {
+		mgc_world_init_world_def(&world, &world_init_context);
+	}
 
 	struct mgc_chunk_cache chunk_cache = {0};
 	mgc_chunk_cache_init(&chunk_cache, &memory, &world, &reg.materials);
@@ -220,8 +241,26 @@ int main(int argc, char *argv[])
 	cam.zoom = 0.5f;
 	cam.location = V3(2.0f, 2.0f, 2.0f);
 
+	const char *chunk_shader_defines = NULL;
+#if MGC_CHUNK_RENDER_INDIRECT
+	// The chunk shaders look up each draw's offset with gl_DrawIDARB, which
+	// is not core in OpenGL 4.5. Without it, chunks are drawn one at a time.
+	bool draw_indirect = render_has_extension("GL_ARB_shader_draw_parameters");
+	if (draw_indirect) {
+		chunk_shader_defines = "#define MGC_CHUNK_DRAW_OFFSETS 1\n";
+	} else {
+		print_info("GL_ARB_shader_draw_parameters is not supported. Drawing chunks one at a time.");
+	}
+#endif
+
 	GLuint defaultVShader, defaultFShader;
-	defaultVShader = shader_compile_from_file("assets/shaders/default.vsh", GL_VERTEX_SHADER);
+#if MGC_CHUNK_MESH_INSTANCED
+	defaultVShader = shader_compile_from_file_with_defines("assets/shaders/chunk_instanced.vsh", GL_VERTEX_SHADER, chunk_shader_defines);
+#elif MGC_CHUNK_MESH_PACKED_VERTICES
+	defaultVShader = shader_compile_from_file_with_defines("assets/shaders/chunk_packed.vsh", GL_VERTEX_SHADER, chunk_shader_defines);
+#else
+	defaultVShader = shader_compile_from_file_with_defines("assets/shaders/default.vsh", GL_VERTEX_SHADER, chunk_shader_defines);
+#endif
 	defaultFShader = shader_compile_from_file("assets/shaders/default.fsh", GL_FRAGMENT_SHADER);
 
 	GLuint defaultShader;
@@ -240,6 +279,34 @@ int main(int argc, char *argv[])
 	inColor = glGetUniformLocation(defaultShader, "inColor");
 	inLightPos = glGetUniformLocation(defaultShader, "inLightPos");
 
+#if CHUNK_MESH_USES_PALETTE
+	{
+		// Packed vertices and instances are expanded using the same grid as the
+		// mesher, and coloured by material.
+		if (reg.materials.num_materials > MGC_CHUNK_MESH_PALETTE_SIZE) {
+			print_error("render", "Too many materials for the chunk palette (%zu > %i).",
+				reg.materials.num_materials, MGC_CHUNK_MESH_PALETTE_SIZE);
+			return -1;
+		}
+
+		v3 palette[MGC_CHUNK_MESH_PALETTE_SIZE] = {0};
+		for (size_t i = 0; i < reg.materials.num_materials; i++) {
+			Color color = reg.materials.materials[i].color;
+			palette[i] = V3(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f);
+		}
+
+		glUseProgram(defaultShader);
+		glUniform3fv(glGetUniformLocation(defaultShader, "hexVerts"),
+			HEX_NUM_VERTS, (f32 *)hexVerts);
+		glUniform3f(glGetUniformLocation(defaultShader, "hexStride"),
+			hexStrideX, hexH, hexStrideY);
+		glUniform1f(glGetUniformLocation(defaultShader, "hexStaggerX"), hexStaggerX);
+		glUniform3fv(glGetUniformLocation(defaultShader, "palette"),
+			MGC_CHUNK_MESH_PALETTE_SIZE, (f32 *)palette);
+		glUseProgram(0);
+	}
+#endif
+
 	glEnable(GL_CULL_FACE);
 	glFrontFace(GL_CCW);
 	glCullFace(GL_FRONT);
@@ -250,14 +317,16 @@ int main(int argc, char *argv[])
 	mgc_sim_thread_start(&sim_thread_info, &arena, &chunk_cache, &reg);
 
 	int tick = 0;
+	bool chunk_cache_update_pending = false;
 
 
 	// struct mgc_sim_buffer *sim_buffer = calloc(sizeof(struct mgc_sim_buffer), 1);
 
-	struct mgc_chunk_render_entry *render_queue;
-	size_t render_queue_cap = 1024;
+	struct mgc_chunk_render_queue render_queue = {0};
 
-	render_queue = calloc(sizeof(struct mgc_chunk_render_entry), render_queue_cap);
+#if MGC_CHUNK_RENDER_INDIRECT
+	struct mgc_chunk_draw_list draw_list = {0};
+#endif
 
 	bool mouse_control_enabled = false;
 
@@ -344,21 +413,24 @@ int main(int argc, char *argv[])
 		}
 
 		if (tick % 30 == 0) {
-			v3i sim_center = V3i(0, 0, 0);
+			chunk_cache_update_pending = true;
+		}
+
+		// If the sim thread is busy, it will park after its current tick and
+		// we try again next frame.
+		if (chunk_cache_update_pending &&
+			mgc_chunk_cache_try_lock_structure(&chunk_cache)) {
+			// Moving the center only requests the chunks that enter the
+			// load bounds, so it can follow the camera.
+			v3i sim_center = mgc_grid_tile_coord(c.position);
 			mgc_chunk_cache_set_sim_center(&chunk_cache, sim_center);
 			mgc_chunk_cache_tick(&chunk_cache);
+			mgc_chunk_cache_unlock_structure(&chunk_cache);
+			chunk_cache_update_pending = false;
 		}
 
 		mgc_chunk_cache_render_tick(&chunk_cache);
 
-		size_t render_queue_length = 0;
-		mgc_chunk_cache_make_render_queue(
-			&chunk_cache,
-			render_queue_cap,
-			render_queue,
-			&render_queue_length
-		);
-
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		int width, height;
@@ -409,32 +481,68 @@ int main(int argc, char *argv[])
 		m4 cameraTransform;
 		mat4_multiply(cameraTransform.m, perspective.m, camera.m);
 
+		struct mgc_frustum frustum;
+		mgc_frustum_from_matrix(&frustum, &cameraTransform);
+
+		mgc_chunk_cache_make_render_queue(
+			&chunk_cache,
+			&frustum,
+			c.position,
+			&render_queue
+		);
+
 		glUseProgram(defaultShader);
 
 		m4 normalTransform;
 		mat4_identity(normalTransform.m);
 		glUniformMatrix4fv(inCameraTransform, 1, GL_TRUE, cameraTransform.m);
 		glUniformMatrix4fv(inNormalTransform, 1, GL_TRUE, normalTransform.m);
+		glUniform3fv(inLightPos, 1, lightPos.m);
+		glUniform3f(inColor, 1.0f, 1.0f, 1.0f);
 
-		for (size_t queue_i = 0; queue_i < render_queue_length; queue_i++) {
-			struct mgc_chunk_render_entry *entry = &render_queue[queue_i];
-			v3 chunk_location = mgc_grid_draw_coord(entry->coord);
-
-			glBindVertexArray(entry->mesh.vao);
+		// glLineWidth(1.0f);
+		// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+#if MGC_CHUNK_RENDER_INDIRECT
+		if (draw_indirect) {
 			m4 worldTransform;
 			mat4_identity(worldTransform.m);
-			mat4_translate(worldTransform.m, worldTransform.m, chunk_location.m);
+			glUniformMatrix4fv(inWorldTransform, 1, GL_TRUE, worldTransform.m);
+
+			mgc_chunk_draw_list_clear(&draw_list);
+			for (size_t queue_i = 0; queue_i < render_queue.length; queue_i++) {
+				struct mgc_chunk_render_entry *entry = &render_queue.entries[queue_i];
+				mgc_chunk_draw_list_push(&draw_list, entry->mesh,
+					mgc_grid_draw_coord(entry->coord));
+			}
+
+			mgc_chunk_draw_list_draw(&draw_list, &chunk_cache.vbo_pool);
+		} else
+#endif
+		{
+			// Every chunk mesh is in the pool's vertex buffer.
+			glBindVertexArray(chunk_cache.vbo_pool.vao);
 
-			glUniformMatrix4fv(inWorldTransform,  1, GL_TRUE, worldTransform.m);
-			glUniform3fv(inLightPos, 1, lightPos.m);
+			for (size_t queue_i = 0; queue_i < render_queue.length; queue_i++) {
+				struct mgc_chunk_render_entry *entry = &render_queue.entries[queue_i];
+				v3 chunk_location = mgc_grid_draw_coord(entry->coord);
 
-			glUniform3f(inColor, 1.0f, 1.0f, 1.0f);
+				m4 worldTransform;
+				mat4_identity(worldTransform.m);
+				mat4_translate(worldTransform.m, worldTransform.m, chunk_location.m);
 
-			// glLineWidth(1.0f);
-			// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+				glUniformMatrix4fv(inWorldTransform,  1, GL_TRUE, worldTransform.m);
 
-			glDrawArrays(GL_TRIANGLES, 0, entry->mesh.numVertices);
+#if MGC_CHUNK_MESH_INSTANCED
+				glDrawElementsInstancedBaseInstance(GL_TRIANGLES,
+					CHUNK_MESH_PRISM_NUM_INDICES, GL_UNSIGNED_BYTE, 0,
+					entry->mesh.num_vertices, entry->mesh.first);
+#else
+				glDrawArrays(GL_TRIANGLES, entry->mesh.first, entry->mesh.num_vertices);
+#endif
+			}
+
+			glBindVertexArray(0);
 		}
 
 		glfwSwapBuffers(win);
@@ -448,8 +556,12 @@ int main(int argc, char *argv[])
 
 	mgc_sim_thread_stop(&sim_thread_info);
 
-	free(render_queue);
-	free(chunk_cache.entries);
+	mgc_chunk_render_queue_free(&render_queue);
+#if MGC_CHUNK_RENDER_INDIRECT
+	mgc_chunk_draw_list_destroy(&draw_list);
+#endif
+	mgc_chunk_cache_destroy(&chunk_cache);
+	mgc_world_destroy(&world);
 	atom_table_destroy(&atom_table);
 	mgc_memory_destroy(&memory);
 
@@ -1,5 +1,7 @@
 #include "material.h"
+#include "utils.h"
 #include <assert.h>
+#include <stdlib.h>
 
 TraitType defaultTraits[] = {
 	[TRAIT_GAS]        = { NOCAST_STR("gas")        },
@@ -22,11 +24,11 @@ ActionType defaultActionTypes[] = {
 };
 
 Material defaultMaterials[] = {
-	[MAT_AIR]   = { NOCAST_STR("air"),   NOCAST_COLOR_HEX(0x000000), false },
-	[MAT_WATER] = { NOCAST_STR("water"), NOCAST_COLOR_HEX(0x0000ff), true },
-	[MAT_WOOD]  = { NOCAST_STR("wood"),  NOCAST_COLOR_HEX(0x804000), true },
-	[MAT_METAL] = { NOCAST_STR("metal"), NOCAST_COLOR_HEX(0xd3d3d3), true },
-	[MAT_SAND]  = { NOCAST_STR("sand"),  NOCAST_COLOR_HEX(0xc2b280), true },
+	[MAT_AIR]   = { NOCAST_STR("air"),   NOCAST_COLOR_HEX(0x000000), false, MGC_MAT_BEHAVIOUR_STATIC },
+	[MAT_WATER] = { NOCAST_STR("water"), NOCAST_COLOR_HEX(0x0000ff), true,  MGC_MAT_BEHAVIOUR_LIQUID },
+	[MAT_WOOD]  = { NOCAST_STR("wood"),  NOCAST_COLOR_HEX(0x804000), true,  MGC_MAT_BEHAVIOUR_STATIC },
+	[MAT_METAL] = { NOCAST_STR("metal"), NOCAST_COLOR_HEX(0xd3d3d3), true,  MGC_MAT_BEHAVIOUR_STATIC },
+	[MAT_SAND]  = { NOCAST_STR("sand"),  NOCAST_COLOR_HEX(0xc2b280), true,  MGC_MAT_BEHAVIOUR_POWDER },
 };
 
 MaterialTrait defaultMaterialTraits[] = {
@@ -54,12 +56,63 @@ mgc_material_table_init(struct mgc_material_table *mats)
 {
 	mats->num_materials = sizeof(defaultMaterials) / sizeof(Material);
 	mats->materials = defaultMaterials;
+	mats->props = NULL;
+
+	mgc_material_table_build_props(mats);
+}
+
+void
+mgc_material_table_build_props(struct mgc_material_table *mats)
+{
+	struct mgc_material_props *props;
+	props = realloc(mats->props, mats->num_materials * sizeof(struct mgc_material_props));
+	if (!props) {
+		panic("Failed to allocate the material property table.");
+		return;
+	}
+	mats->props = props;
+
+	mats->powder_materials = 0;
+	mats->liquid_materials = 0;
+
+	for (size_t i = 0; i < mats->num_materials; i++) {
+		Material *mat = &mats->materials[i];
+		props[i].flags = mat->solid ? MGC_MAT_SOLID : 0;
+		props[i].behaviour = mat->behaviour;
+		props[i].color = mat->color;
+
+		if (i < 64) {
+			mats->powder_materials |=
+				(u64)(mat->behaviour == MGC_MAT_BEHAVIOUR_POWDER) << i;
+			mats->liquid_materials |=
+				(u64)(mat->behaviour == MGC_MAT_BEHAVIOUR_LIQUID) << i;
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(defaultMaterialTraits) / sizeof(MaterialTrait); i++) {
+		MaterialTrait *trait = &defaultMaterialTraits[i];
+		if (trait->material >= mats->num_materials) {
+			continue;
+		}
+
+		switch (trait->trait) {
+			case TRAIT_LIQUID:
+				props[trait->material].flags |= MGC_MAT_LIQUID;
+				break;
+
+			case TRAIT_GAS:
+				props[trait->material].flags |= MGC_MAT_GAS;
+				break;
+
+			default:
+				break;
+		}
+	}
 }
 
 Material *
 mgc_mat_get(struct mgc_material_table *mats, mgc_material_id id)
 {
-	id &= 0x3fff;
 	assert(id < mats->num_materials);
 	return &mats->materials[id];
 }
@@ -2,6 +2,8 @@
 #define MAGIC_MATERIAL_H
 
 #include "intdef.h"
+#include "types.h"
+#include "utils.h"
 #include "str.h"
 #include "color.h"
 
@@ -9,7 +11,6 @@ typedef uint16_t TraitId;
 typedef uint16_t ActionId;
 typedef uint16_t StatusId;
 
-// The top 2 bits are reserved for other purposes.
 typedef uint16_t mgc_material_id;
 
 typedef enum {
@@ -59,12 +60,36 @@ typedef enum {
 	MAT_SAND,
 } DeafultMaterialTypes;
 
+// How the simulation moves tiles of a material.
+enum mgc_material_behaviour {
+	MGC_MAT_BEHAVIOUR_STATIC,
+	// Falls, and slides down slopes while falling.
+	MGC_MAT_BEHAVIOUR_POWDER,
+	// Falls and spreads out sideways.
+	MGC_MAT_BEHAVIOUR_LIQUID,
+};
+
 typedef struct mgc_material {
 	struct string name;
 	Color color;
 	bool solid;
+	enum mgc_material_behaviour behaviour;
 } Material;
 
+#define MGC_MAT_SOLID  (1 << 0)
+#define MGC_MAT_LIQUID (1 << 1)
+#define MGC_MAT_GAS    (1 << 2)
+
+// The properties of a material that the mesher and the simulation read for
+// every tile, packed so the whole table stays in cache.
+struct mgc_material_props {
+	// MGC_MAT_SOLID, MGC_MAT_LIQUID and MGC_MAT_GAS.
+	u8 flags;
+	// enum mgc_material_behaviour
+	u8 behaviour;
+	Color color;
+};
+
 typedef struct mgc_material_trait {
 	mgc_material_id material;
 	TraitId trait;
@@ -94,11 +119,33 @@ typedef struct mgc_material_transition {
 struct mgc_material_table {
 	struct mgc_material *materials;
 	size_t num_materials;
+
+	// Indexed by material id. Built from materials by
+	// mgc_material_table_build_props.
+	struct mgc_material_props *props;
+
+	// Bit i is set if material i falls as a powder or as a liquid. Only
+	// covers the first 64 materials, and lets the sim classify a row of
+	// tiles without looking each of them up in props.
+	u64 powder_materials;
+	u64 liquid_materials;
 };
 
 void
 mgc_material_table_init(struct mgc_material_table *);
 
+// Rebuilds the property table. Must be called whenever materials are added
+// to the table.
+void
+mgc_material_table_build_props(struct mgc_material_table *);
+
+static inline struct mgc_material_props
+mgc_mat_props(struct mgc_material_table *mats, mgc_material_id id)
+{
+	assert(id < mats->num_materials);
+	return mats->props[id];
+}
+
 Material *
 mgc_mat_get(struct mgc_material_table *, mgc_material_id);
 
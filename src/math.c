@@ -91,3 +91,41 @@ mat4_hex_rotate(m4i *result, int rotation)
 
 	return result;
 }
+
+void
+mgc_frustum_from_matrix(struct mgc_frustum *frustum, m4 *view_projection)
+{
+	// The matrix is column-major, so row i is (m[i], m[4+i], m[8+i], m[12+i]).
+	float *m = view_projection->m;
+	v4 row[4];
+	for (size_t i = 0; i < 4; i++) {
+		row[i] = V4(m[i], m[4+i], m[8+i], m[12+i]);
+	}
+
+	for (size_t i = 0; i < 3; i++) {
+		v4 r = row[i];
+		frustum->planes[i*2+0] = V4(row[3].x + r.x, row[3].y + r.y, row[3].z + r.z, row[3].w + r.w);
+		frustum->planes[i*2+1] = V4(row[3].x - r.x, row[3].y - r.y, row[3].z - r.z, row[3].w - r.w);
+	}
+}
+
+bool
+mgc_frustum_intersects_aabb(struct mgc_frustum *frustum, v3 min, v3 max)
+{
+	for (size_t i = 0; i < 6; i++) {
+		v4 p = frustum->planes[i];
+
+		// The corner furthest along the plane's normal.
+		v3 corner = V3(
+			p.x >= 0.0f ? max.x : min.x,
+			p.y >= 0.0f ? max.y : min.y,
+			p.z >= 0.0f ? max.z : min.z
+		);
+
+		if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -19,4 +19,18 @@ vec4i_multiply_mat4(int *result, int *v0, int *m);
 m4i *
 mat4_hex_rotate(m4i *result, int rotation);
 
+// The six clip planes of a view-projection matrix as (normal, distance),
+// pointing inwards. The planes are not normalized.
+struct mgc_frustum {
+	v4 planes[6];
+};
+
+void
+mgc_frustum_from_matrix(struct mgc_frustum *, m4 *view_projection);
+
+// Conservative; boxes close to a corner of the frustum may be reported as
+// intersecting even if they are outside.
+bool
+mgc_frustum_intersects_aabb(struct mgc_frustum *, v3 min, v3 max);
+
 #endif
@@ -44,6 +44,12 @@ GLuint shader_compile(char *shaderCode, size_t codeLength, GLenum type) {
 
 GLuint
 shader_compile_from_file(const char *file, GLenum type)
+{
+	return shader_compile_from_file_with_defines(file, type, NULL);
+}
+
+GLuint
+shader_compile_from_file_with_defines(const char *file, GLenum type, const char *defines)
 {
 	FILE *fp = fopen(file, "rb");
 	if (!fp) {
@@ -53,20 +59,47 @@ shader_compile_from_file(const char *file, GLenum type)
 	long length = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	char *buffer = malloc(length);
+	size_t defines_length = defines ? strlen(defines) : 0;
+	char *buffer = malloc(length + defines_length);
 	size_t err;
 	
 	err = fread(buffer, sizeof(char), length, fp);
 	if ((long)err < length) {
 		perror("read shader");
 	}
+	fclose(fp);
+
+	if (defines_length > 0) {
+		// The defines go right after the #version line, which has to come
+		// first.
+		char *version_end = memchr(buffer, '\n', length);
+		size_t insert_at = version_end ? (size_t)(version_end - buffer) + 1 : 0;
+		memmove(buffer + insert_at + defines_length, buffer + insert_at, length - insert_at);
+		memcpy(buffer + insert_at, defines, defines_length);
+	}
 
-	GLuint shader = shader_compile(buffer, length, type);
+	GLuint shader = shader_compile(buffer, length + defines_length, type);
 	free(buffer);
 
 	return shader;
 }
 
+bool
+render_has_extension(const char *name)
+{
+	GLint num_extensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+
+	for (GLint i = 0; i < num_extensions; i++) {
+		const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool shader_link(GLuint program) {
 	GLint link_status;
 
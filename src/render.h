@@ -59,7 +59,16 @@ shader_compile(char *shaderCode, size_t codeLength, GLenum type);
 GLuint
 shader_compile_from_file(const char *file, GLenum type);
 
+// Compiles the shader in file with defines, a string of #define lines,
+// inserted after its #version line.
+GLuint
+shader_compile_from_file_with_defines(const char *file, GLenum type, const char *defines);
+
 bool
 shader_link(GLuint program);
 
+// Returns true if the current context supports the OpenGL extension name.
+bool
+render_has_extension(const char *name);
+
 #endif
@@ -1,6 +1,8 @@
 #include "sim.h"
 #include "utils.h"
 #include "material.h"
+#include "atomic.h"
+#include "thread.h"
 
 #include "profile.h"
 
@@ -26,18 +28,33 @@ static v3i neighbourhood[NEIGHBOURHOOD_SIZE] = {
 #define SIM_CTX_CHANGED_MASK_SIZE (NEIGHBOURHOOD_SIZE*RENDER_CHUNKS_PER_CHUNK)
 #define SIM_CTX_CHANGED_MASK_BIT_PER_UNIT (sizeof(u64)*8)
 #define SIM_CTX_CHANGED_SIZE DIVIDE_CEILING(SIM_CTX_CHANGED_MASK_SIZE, SIM_CTX_CHANGED_MASK_BIT_PER_UNIT)
+#if (RENDER_CHUNK_HEIGHT % SIM_CHUNK_BATCH_SIZE_LAYERS) != 0
+#error "SIM_CHUNK_BATCH_SIZE_LAYERS must be a factor of RENDER_CHUNK_HEIGHT"
+#endif
+
 struct mgc_sim_context {
 	struct mgc_sim_chunk *chunks;
 	v3i coord;
 	bool clock;
+	// Indexed by material id.
+	struct mgc_material_props *materials;
+	// See mgc_material_table.
+	u64 powder_materials;
+	u64 liquid_materials;
 	chunk_dirty_mask_t *changed;
+	// Render chunks with tiles woken for the next tick.
+	chunk_dirty_mask_t *awake_changed;
 };
 
 struct mgc_tile_ref {
-	struct mgc_tile *tile;
+	u16 *material;
+	u16 *data;
 	u64 chunk_mask;
 	u32 neighbour_idx;
+	u32 tile_idx;
 	u32 render_chunk_idx;
+	// The tile's coordinate relative to the center chunk.
+	v3i coord;
 };
 
 // This routine requires the offset to be constrained to +-(32,32,32).
@@ -65,49 +82,150 @@ mgc_sim_get_tile(struct mgc_sim_context ctx, v3i offset)
 	size_t tile_i = x | y << LOG_CHUNK_WIDTH | z << (LOG_CHUNK_WIDTH*2);
 
 	struct mgc_tile_ref tile_ref = {0};
+	tile_ref.coord = V3i(
+		ctx.coord.x + offset.x,
+		ctx.coord.y + offset.y,
+		ctx.coord.z + offset.z
+	);
 	tile_ref.neighbour_idx = chunk_i;
+	tile_ref.tile_idx = tile_i;
 	tile_ref.render_chunk_idx = render_chunk_i;
-	tile_ref.tile = &ctx.chunks->neighbours[chunk_i].tiles[tile_i];
+	tile_ref.material = mgc_chunk_ref_material(ctx.chunks->neighbours[chunk_i], tile_i);
+	tile_ref.data = mgc_chunk_ref_data(ctx.chunks->neighbours[chunk_i], tile_i);
 
 	return tile_ref;
 }
 
+static inline size_t
+mgc_sim_count_trailing_zeros(u64 v)
+{
+#if __GNUC__
+	return __builtin_ctzll(v);
+#else
+	unsigned long result;
+	_BitScanForward64(&result, v);
+	return result;
+#endif
+}
+
+// Wakes the tiles in the 3x3x3 box around a written tile for the next tick.
+static void
+mgc_sim_wake(struct mgc_sim_context ctx, struct mgc_tile_ref ref)
+{
+	for (int dz = -1; dz <= 1; dz++) {
+		int z = ref.coord.z + dz;
+		size_t chunk_z = (z + CHUNK_HEIGHT) >> LOG_CHUNK_HEIGHT;
+		z = z & ((1<<(LOG_CHUNK_HEIGHT))-1);
+
+		for (int dy = -1; dy <= 1; dy++) {
+			int y = ref.coord.y + dy;
+			size_t chunk_y = (y + CHUNK_WIDTH) >> LOG_CHUNK_WIDTH;
+			y = y & ((1<<(LOG_CHUNK_WIDTH))-1);
+
+			// Wake the tiles of the row that are in the same chunk at once.
+			int x_begin = ref.coord.x - 1;
+			while (x_begin <= ref.coord.x + 1) {
+				size_t chunk_x = (x_begin + CHUNK_WIDTH) >> LOG_CHUNK_WIDTH;
+				int x = x_begin & ((1<<(LOG_CHUNK_WIDTH))-1);
+				int num_tiles = ref.coord.x + 2 - x_begin;
+				if (x + num_tiles > CHUNK_WIDTH) {
+					num_tiles = CHUNK_WIDTH - x;
+				}
+
+				size_t chunk_i = chunk_x + chunk_y * 3 + chunk_z * 9;
+				size_t tile_i = x | y << LOG_CHUNK_WIDTH | z << (LOG_CHUNK_WIDTH*2);
+
+				struct mgc_chunk_awake *awake;
+				awake = ctx.chunks->cache_entry[chunk_i]->awake;
+				mgc_atomic_fetch_or_u64(
+					&awake->tiles[!ctx.clock][tile_i / 64],
+					((1ULL << num_tiles) - 1) << (tile_i % 64)
+				);
+
+				size_t rchunk_yz =
+					  (y / RENDER_CHUNK_WIDTH) * RENDER_CHUNKS_PER_CHUNK_WIDTH
+					+ (z / RENDER_CHUNK_HEIGHT) * RENDER_CHUNKS_PER_CHUNK_LAYER;
+				ctx.awake_changed[chunk_i] |=
+					(1UL << (rchunk_yz + x / RENDER_CHUNK_WIDTH)) |
+					(1UL << (rchunk_yz + (x + num_tiles - 1) / RENDER_CHUNK_WIDTH));
+
+				x_begin += num_tiles;
+			}
+		}
+	}
+}
+
+// Marks the render chunk of a written tile as changed. Tiles on the border of
+// a render chunk also mark the render chunks next to them, as their meshes
+// cull faces against the tile.
+static inline void
+mgc_sim_mark_changed(struct mgc_sim_context ctx, struct mgc_tile_ref ref)
+{
+	ctx.changed[ref.neighbour_idx] |= (1UL << ref.render_chunk_idx);
+
+	int r_x = ref.coord.x & (RENDER_CHUNK_WIDTH-1);
+	int r_y = ref.coord.y & (RENDER_CHUNK_WIDTH-1);
+	int r_z = ref.coord.z & (RENDER_CHUNK_HEIGHT-1);
+	if (r_x != 0 && r_x != RENDER_CHUNK_WIDTH-1 &&
+		r_y != 0 && r_y != RENDER_CHUNK_WIDTH-1 &&
+		r_z != 0 && r_z != RENDER_CHUNK_HEIGHT-1) {
+		return;
+	}
+
+	for (size_t n = 0; n < NUM_LAYER_NEIGHBOURS; n++) {
+		v3i coord = v3i_add(ref.coord, chunk_mesh_neighbour_offsets[n]);
+
+		size_t chunk_i =
+			  ((coord.x + CHUNK_WIDTH)  >> LOG_CHUNK_WIDTH)
+			+ ((coord.y + CHUNK_WIDTH)  >> LOG_CHUNK_WIDTH)  * 3
+			+ ((coord.z + CHUNK_HEIGHT) >> LOG_CHUNK_HEIGHT) * 9;
+
+		int x = coord.x & ((1<<(LOG_CHUNK_WIDTH)) -1);
+		int y = coord.y & ((1<<(LOG_CHUNK_WIDTH)) -1);
+		int z = coord.z & ((1<<(LOG_CHUNK_HEIGHT))-1);
+
+		size_t render_chunk_i =
+			  (x / RENDER_CHUNK_WIDTH)
+			+ (y / RENDER_CHUNK_WIDTH) * RENDER_CHUNKS_PER_CHUNK_WIDTH
+			+ (z / RENDER_CHUNK_HEIGHT) * RENDER_CHUNKS_PER_CHUNK_LAYER;
+
+		ctx.changed[chunk_i] |= (1UL << render_chunk_i);
+	}
+}
+
 #define INLINE_TILE_INSTRS 0
 
-#define _TM_TOUCHED(m) ((m >> 1) ^ (ctx.clock ? 0 : 0x4000))
+#define _TILE_UPDATED_UNIT(ref) \
+	(&ctx.chunks->cache_entry[(ref).neighbour_idx]->awake->updated[ctx.clock][(ref).tile_idx / 64])
 #define TILE_UPDATED(ref) \
-	(((ref).tile->material) & (_TM_TOUCHED((ref).tile->material) & 0x4000))
+	((mgc_atomic_load_u64(_TILE_UPDATED_UNIT(ref)) >> ((ref).tile_idx % 64)) & 1)
 #define TILE(mat, data) ((struct mgc_tile){mat, data})
+#define TILE_GET(ref) ((struct mgc_tile){*(ref).material, *(ref).data})
 #define TILE_SET(dst, tile_data) do { \
 	if (!TILE_UPDATED(dst)) { \
-		(dst).tile->material = (ctx.clock ? 0xc000 : 0x4000) | ((tile_data).material & 0x3fff); \
-		(dst).tile->data = ((tile_data).data); \
-		ctx.changed[dst.neighbour_idx] |= \
-			(1UL << dst.render_chunk_idx); \
+		*(dst).material = ((tile_data).material); \
+		*(dst).data = ((tile_data).data); \
+		mgc_atomic_fetch_or_u64(_TILE_UPDATED_UNIT(dst), \
+			1ULL << ((dst).tile_idx % 64)); \
+		mgc_sim_mark_changed(ctx, dst); \
+		mgc_sim_wake(ctx, dst); \
 	} \
 } while(0);
 #define TILE_SWAP(t1, t2) do { \
 	if (!TILE_UPDATED(t1) && !TILE_UPDATED(t2)) { \
-		struct mgc_tile tmp = *(t2).tile; \
-		TILE_SET((t2), *(t1).tile); \
+		struct mgc_tile tmp = TILE_GET(t2); \
+		TILE_SET((t2), TILE_GET(t1)); \
 		TILE_SET((t1), tmp); \
 	} \
 } while(0);
-#define MAT(ref) (mgc_tile_material(*(ref).tile))
-#define DATA(ref) ((ref).tile->data)
+#define MAT(ref) (*(ref).material)
+#define BEHAVIOUR(ref) (ctx.materials[*(ref).material].behaviour)
+#define DATA(ref) (*(ref).data)
 
 #if !INLINE_TILE_INSTRS
 
 #define ALWAYS_INLINE __attribute__ ((always_inline))
 
-static bool ALWAYS_INLINE
-mgc_sim_impl_tm_touched(struct mgc_sim_context ctx, u16 m)
-{
-	return _TM_TOUCHED(m);
-}
-#undef _TM_TOUCHED
-#define _TM_TOUCHED(...) mgc_sim_impl_tm_touched(ctx, __VA_ARGS__)
-
 static bool ALWAYS_INLINE
 mgc_sim_impl_tile_updated(struct mgc_sim_context ctx, struct mgc_tile_ref tile)
 {
@@ -169,9 +287,9 @@ mgc_sim_tile(struct mgc_sim_context ctx, struct mgc_tile_ref tile)
 	struct mgc_tile_ref below = mgc_sim_get_tile(ctx, V3i(0, 0, -1));
 	struct mgc_tile_ref above = mgc_sim_get_tile(ctx, V3i(0, 0,  1));
 
-	switch (MAT(tile)) {
+	switch (BEHAVIOUR(tile)) {
 
-		case MAT_SAND:
+		case MGC_MAT_BEHAVIOUR_POWDER:
 			if (MAT(below) == MAT_AIR) {
 				DATA(tile) = 1;
 				TILE_SWAP(tile, below);
@@ -192,16 +310,18 @@ mgc_sim_tile(struct mgc_sim_context ctx, struct mgc_tile_ref tile)
 				}
 			}
 
-			DATA(tile) = 0;
+			if (DATA(tile) != 0) {
+				DATA(tile) = 0;
+			}
 			break;
 
-		case MAT_WATER:
+		case MGC_MAT_BEHAVIOUR_LIQUID:
 			if (MAT(below) == MAT_AIR) {
 				TILE_SWAP(tile, below);
 				return;
 			}
 
-			if (MAT(below) == MAT_WATER) {
+			if (MAT(below) == MAT(tile)) {
 				if (MAT(above) == MAT_AIR) {
 					TILE_SET(tile, TILE(MAT_AIR, 0));
 				}
@@ -214,7 +334,7 @@ mgc_sim_tile(struct mgc_sim_context ctx, struct mgc_tile_ref tile)
 					struct mgc_tile_ref other = mgc_sim_get_tile(ctx, V3i(x, y, 0));
 
 					if (MAT(other) == MAT_AIR) {
-						TILE_SET(other, *tile.tile);
+						TILE_SET(other, TILE_GET(tile));
 					}
 				}
 			}
@@ -223,16 +343,319 @@ mgc_sim_tile(struct mgc_sim_context ctx, struct mgc_tile_ref tile)
 	}
 }
 
+#if MGC_SIM_FAST_GRAVITY
+#define SIM_UNITS_PER_LAYER (CHUNK_LAYER_NUM_TILES / 64)
+#define SIM_ROWS_PER_UNIT (64 / CHUNK_WIDTH)
+#define SIM_ROW_MASK ((1ULL << CHUNK_WIDTH) - 1)
+
+#if CHUNK_WIDTH > 62
+#error "The fast gravity path needs a row and the tile on either side of it to fit in 64 bits"
+#endif
+
+// The row masks below have one bit per tile from x = -1 to x = CHUNK_WIDTH,
+// so bit x+1 is the tile at x. The tiles at -1 and CHUNK_WIDTH are in the
+// chunks to the west and east.
+
+// Adds the render chunks touched by the tiles in mask, in the row at y and z
+// relative to the center chunk, to out.
+static inline void
+mgc_sim_row_render_chunks(int y, int z, u64 mask, chunk_dirty_mask_t *out)
+{
+	size_t chunk_yz =
+		  ((y + CHUNK_WIDTH)  >> LOG_CHUNK_WIDTH)  * 3
+		+ ((z + CHUNK_HEIGHT) >> LOG_CHUNK_HEIGHT) * 9;
+	y = y & ((1<<(LOG_CHUNK_WIDTH)) -1);
+	z = z & ((1<<(LOG_CHUNK_HEIGHT))-1);
+
+	size_t rchunk_yz =
+		  (y / RENDER_CHUNK_WIDTH) * RENDER_CHUNKS_PER_CHUNK_WIDTH
+		+ (z / RENDER_CHUNK_HEIGHT) * RENDER_CHUNKS_PER_CHUNK_LAYER;
+
+	if (mask & 1) {
+		out[chunk_yz + 0] |= (1UL << (rchunk_yz + RENDER_CHUNKS_PER_CHUNK_WIDTH - 1));
+	}
+	for (size_t rx = 0; rx < RENDER_CHUNKS_PER_CHUNK_WIDTH; rx++) {
+		u64 render_chunk_tiles =
+			((1ULL << RENDER_CHUNK_WIDTH) - 1) << (1 + rx * RENDER_CHUNK_WIDTH);
+		if (mask & render_chunk_tiles) {
+			out[chunk_yz + 1] |= (1UL << (rchunk_yz + rx));
+		}
+	}
+	if ((mask >> (CHUNK_WIDTH + 1)) & 1) {
+		out[chunk_yz + 2] |= (1UL << rchunk_yz);
+	}
+}
+
+// Wakes the tiles in mask, in the row at y and z relative to the center
+// chunk, for the next tick.
+static void
+mgc_sim_wake_row(struct mgc_sim_context ctx, int y, int z, u64 mask)
+{
+	size_t chunk_yz =
+		  ((y + CHUNK_WIDTH)  >> LOG_CHUNK_WIDTH)  * 3
+		+ ((z + CHUNK_HEIGHT) >> LOG_CHUNK_HEIGHT) * 9;
+	size_t row_i =
+		  (y & ((1<<(LOG_CHUNK_WIDTH)) -1)) << LOG_CHUNK_WIDTH
+		| (z & ((1<<(LOG_CHUNK_HEIGHT))-1)) << (LOG_CHUNK_WIDTH*2);
+
+	struct mgc_chunk_awake *awake;
+	if (mask & 1) {
+		size_t tile_i = row_i + CHUNK_WIDTH - 1;
+		awake = ctx.chunks->cache_entry[chunk_yz + 0]->awake;
+		mgc_atomic_fetch_or_u64(
+			&awake->tiles[!ctx.clock][tile_i / 64], 1ULL << (tile_i % 64));
+	}
+	if ((mask >> 1) & SIM_ROW_MASK) {
+		awake = ctx.chunks->cache_entry[chunk_yz + 1]->awake;
+		mgc_atomic_fetch_or_u64(
+			&awake->tiles[!ctx.clock][row_i / 64],
+			((mask >> 1) & SIM_ROW_MASK) << (row_i % 64));
+	}
+	if ((mask >> (CHUNK_WIDTH + 1)) & 1) {
+		awake = ctx.chunks->cache_entry[chunk_yz + 2]->awake;
+		mgc_atomic_fetch_or_u64(
+			&awake->tiles[!ctx.clock][row_i / 64], 1ULL << (row_i % 64));
+	}
+
+	mgc_sim_row_render_chunks(y, z, mask, ctx.awake_changed);
+}
+
+// Returns which tiles in the row at y and z relative to the center chunk are
+// air.
+static u64
+mgc_sim_row_air(struct mgc_sim_context ctx, int y, int z)
+{
+	ctx.coord = V3i(0, y, z);
+	u16 *mats = mgc_sim_get_tile(ctx, V3i(0, 0, 0)).material;
+
+	u64 air = 0;
+	for (size_t x = 0; x < CHUNK_WIDTH; x++) {
+		air |= (u64)(mats[x*MGC_CHUNK_TILE_STRIDE] == MAT_AIR) << (x + 1);
+	}
+	air |= (u64)(MAT(mgc_sim_get_tile(ctx, V3i(-1, 0, 0))) == MAT_AIR);
+	air |= (u64)(MAT(mgc_sim_get_tile(ctx, V3i(CHUNK_WIDTH, 0, 0))) == MAT_AIR)
+		<< (CHUNK_WIDTH + 1);
+
+	return air;
+}
+
+static inline u64
+mgc_sim_unit_row(u64 unit, int r)
+{
+	if (r < 0 || r >= SIM_ROWS_PER_UNIT) {
+		return 0;
+	}
+	return ((unit >> (r * CHUNK_WIDTH)) & SIM_ROW_MASK) << 1;
+}
+
+// Wakes the tiles around, and marks the render chunks of, the tiles set in
+// written, in every layer from z_bottom to z_top. The same as calling
+// mgc_sim_mark_changed and mgc_sim_wake for each of them.
+static void
+mgc_sim_mark_written(struct mgc_sim_context ctx, int y0, int z_bottom, int z_top, u64 written)
+{
+	for (int r = -1; r <= SIM_ROWS_PER_UNIT; r++) {
+		int y = y0 + r;
+		u64 here = mgc_sim_unit_row(written, r);
+		u64 south = mgc_sim_unit_row(written, r - 1);
+		u64 north = mgc_sim_unit_row(written, r + 1);
+
+		// The 3x3x3 box around each written tile.
+		u64 wake =
+			  (south | here | north)
+			| (south | here | north) << 1
+			| (south | here | north) >> 1;
+		if (wake) {
+			for (int z = z_bottom - 1; z <= z_top + 1; z++) {
+				mgc_sim_wake_row(ctx, y, z, wake);
+			}
+		}
+
+		// The tiles next to each written tile in its layer, see
+		// chunk_mesh_neighbour_offsets. Tiles to the south reach this row
+		// through their NE and NW neighbours, and tiles to the north through
+		// their SW and SE neighbours. Above and below are just the column.
+		u64 changed =
+			  here | here << 1 | here >> 1
+			| south | south >> 1
+			| north | north << 1;
+		if (changed) {
+			for (int z = z_bottom; z <= z_top; z++) {
+				mgc_sim_row_render_chunks(y, z, changed, ctx.changed);
+			}
+		}
+		if (here) {
+			mgc_sim_row_render_chunks(y, z_top + 1,    here, ctx.changed);
+			mgc_sim_row_render_chunks(y, z_bottom - 1, here, ctx.changed);
+		}
+	}
+}
+
+// Simulates the awake tiles of one 64 tile unit of a layer at once, and
+// returns the tiles that need the full rules of mgc_sim_tile. Those are
+// powder that may slide, liquid that spreads, and falling
+// tiles whose target a sliding tile earlier in the unit might take. They are
+// left untouched, and the caller runs them through mgc_sim_tile in order
+// after this. Everything else falls, settles, evaporates or does nothing
+// here, and the result must be identical to mgc_sim_tile.
+static u64
+mgc_sim_update_unit_fast(struct mgc_sim_context ctx, size_t unit_i, u64 awake, u64 updated)
+{
+	size_t base_i = unit_i * 64;
+	int z = unit_i / SIM_UNITS_PER_LAYER;
+	int y0 = (base_i / CHUNK_WIDTH) % CHUNK_WIDTH;
+
+	ctx.coord = V3i(0, y0, z);
+	struct mgc_tile_ref tile = mgc_sim_get_tile(ctx, V3i(0, 0,  0));
+	struct mgc_tile_ref below = mgc_sim_get_tile(ctx, V3i(0, 0, -1));
+
+	u16 *mats = tile.material;
+	u16 *data = tile.data;
+	u16 *below_mats = below.material;
+	u16 *below_data = below.data;
+
+	u64 powder = 0, liquid = 0, sliding = 0, has_data = 0;
+	u64 below_air = 0, below_same = 0;
+	u16 high_mats = 0;
+	for (size_t k = 0; k < 64; k++) {
+		u16 mat = mats[k*MGC_CHUNK_TILE_STRIDE];
+		u16 tile_data = data[k*MGC_CHUNK_TILE_STRIDE];
+		u16 below_mat = below_mats[k*MGC_CHUNK_TILE_STRIDE];
+
+		high_mats |= mat & ~63;
+		powder     |= ((ctx.powder_materials >> (mat & 63)) & 1) << k;
+		liquid     |= ((ctx.liquid_materials >> (mat & 63)) & 1) << k;
+		sliding    |= (u64)(tile_data == 1) << k;
+		has_data   |= (u64)(tile_data != 0) << k;
+		below_air  |= (u64)(below_mat == MAT_AIR) << k;
+		below_same |= (u64)(below_mat == mat) << k;
+	}
+
+	// The behaviour masks only cover the first 64 materials.
+	if (high_mats) {
+		return awake;
+	}
+
+	u64 visit = awake & ~updated;
+	powder &= visit;
+	liquid &= visit;
+
+	u64 full_rules = 0;
+
+	// Powder that can not fall slides if it is sliding and one of the tiles
+	// diagonally below it is air. The tiles below only ever stop being air
+	// during this layer, so the ones that are not air now stay that way.
+	u64 slides = powder & ~below_air & sliding;
+	if (slides) {
+		u64 air[SIM_ROWS_PER_UNIT + 2];
+		for (int r = -1; r <= SIM_ROWS_PER_UNIT; r++) {
+			air[r + 1] = mgc_sim_row_air(ctx, y0 + r, z - 1);
+		}
+
+		u64 diagonal_air = 0;
+		for (int r = 0; r < SIM_ROWS_PER_UNIT; r++) {
+			u64 south = air[r], row = air[r + 1], north = air[r + 2];
+			u64 any =
+				  south >> 1 | south >> 2
+				| row         | row >> 2
+				| north       | north >> 1;
+			diagonal_air |= (any & SIM_ROW_MASK) << (r * CHUNK_WIDTH);
+		}
+		full_rules |= slides & diagonal_air;
+	}
+
+	// Liquid that can not fall spreads unless it is on top of the same
+	// liquid, in which case it evaporates if there is air above it. Only the
+	// tiles spread into are air, so the evaporating ones are never among
+	// them, and the layer above is not written until after this layer.
+	u64 surface = liquid & ~below_air & below_same;
+	u64 evaporate = 0;
+	full_rules |= liquid & ~below_air & ~below_same;
+	if (surface) {
+		u16 *above_mats = mgc_sim_get_tile(ctx, V3i(0, 0, 1)).material;
+		u64 above_air = 0;
+		for (size_t k = 0; k < 64; k++) {
+			above_air |= (u64)(above_mats[k*MGC_CHUNK_TILE_STRIDE] == MAT_AIR) << k;
+		}
+		evaporate = surface & above_air;
+	}
+
+	// A tile that swaps with the tile below it fails to do so if that tile
+	// was written this tick. Sliding tiles write the tiles diagonally below
+	// them, so falling tiles later in the unit whose target a sliding tile
+	// could take are left to the full rules too. If such a tile is sliding
+	// itself, it might slide instead, and so on.
+	u64 below_updated = mgc_atomic_load_u64(_TILE_UPDATED_UNIT(below));
+	u64 falling = (powder | liquid) & below_air & ~below_updated;
+	u64 sliders = full_rules & powder;
+	while (sliders) {
+		u64 taken = falling & ~full_rules & (
+			  sliders << 1
+			| sliders << (CHUNK_WIDTH-1)
+			| sliders << CHUNK_WIDTH);
+		full_rules |= taken;
+		sliders = taken & powder & sliding;
+	}
+	falling &= ~full_rules;
+
+	// Powder over air is marked as sliding, even if it does not get to fall.
+	// Powder that has landed stops sliding.
+	u64 set_sliding = powder & below_air & ~full_rules;
+	u64 clear_data = powder & ~below_air & has_data & ~full_rules;
+
+	if (!(falling | set_sliding | clear_data | evaporate)) {
+		return full_rules;
+	}
+
+	for (size_t k = 0; k < 64; k++) {
+		u16 mat = mats[k*MGC_CHUNK_TILE_STRIDE];
+		u16 tile_data = data[k*MGC_CHUNK_TILE_STRIDE];
+		u16 below_mat = below_mats[k*MGC_CHUNK_TILE_STRIDE];
+		u16 below_tile_data = below_data[k*MGC_CHUNK_TILE_STRIDE];
+
+		bool evaporates = (evaporate >> k) & 1;
+		mat = evaporates ? MAT_AIR : mat;
+		tile_data = ((set_sliding >> k) & 1) ? 1 : tile_data;
+		tile_data = (((clear_data | evaporate) >> k) & 1) ? 0 : tile_data;
+
+		bool falls = (falling >> k) & 1;
+		mats[k*MGC_CHUNK_TILE_STRIDE]       = falls ? below_mat : mat;
+		data[k*MGC_CHUNK_TILE_STRIDE]       = falls ? below_tile_data : tile_data;
+		below_mats[k*MGC_CHUNK_TILE_STRIDE] = falls ? mat : below_mat;
+		below_data[k*MGC_CHUNK_TILE_STRIDE] = falls ? tile_data : below_tile_data;
+	}
+
+	if (falling | evaporate) {
+		mgc_atomic_fetch_or_u64(_TILE_UPDATED_UNIT(tile), falling | evaporate);
+	}
+	if (falling) {
+		mgc_atomic_fetch_or_u64(_TILE_UPDATED_UNIT(below), falling);
+		mgc_sim_mark_written(ctx, y0, z - 1, z, falling);
+	}
+	if (evaporate) {
+		mgc_sim_mark_written(ctx, y0, z, z, evaporate);
+	}
+
+	return full_rules;
+}
+
+#undef SIM_ROW_MASK
+#undef SIM_ROWS_PER_UNIT
+#undef SIM_UNITS_PER_LAYER
+#endif
+
 #undef TILE
+#undef TILE_GET
 #undef TILE_SET
 #undef TILE_SWAP
 #undef TILE_UPDATED
-#undef _TM_TOUCHED
+#undef _TILE_UPDATED_UNIT
 #undef MAT
+#undef BEHAVIOUR
 #undef DATA
 
 void
-mgc_sim_update_tiles(struct mgc_sim_chunk *chunk, size_t start_z, size_t num_layers, bool clock)
+mgc_sim_update_tiles(struct mgc_sim_chunk *chunk, struct mgc_material_table *materials, size_t start_z, size_t num_layers, bool clock)
 {
 	size_t start_i = start_z*CHUNK_LAYER_NUM_TILES;
 	size_t end_i = (start_z+num_layers)*CHUNK_LAYER_NUM_TILES;
@@ -241,125 +664,388 @@ mgc_sim_update_tiles(struct mgc_sim_chunk *chunk, size_t start_z, size_t num_lay
 	struct mgc_sim_context sim_ctx = {0};
 	sim_ctx.chunks = chunk;
 	sim_ctx.clock = clock;
+	sim_ctx.materials = materials->props;
+	sim_ctx.powder_materials = materials->powder_materials;
+	sim_ctx.liquid_materials = materials->liquid_materials;
 
 	chunk_dirty_mask_t changed[NEIGHBOURHOOD_SIZE] = {0};
 	sim_ctx.changed = changed;
 
-	for (size_t i = start_i; i < end_i;) {
-		size_t strip_start = i;
-		size_t strip_end = i + RENDER_CHUNK_WIDTH;
-		for (; i < strip_end; i++) {
+	chunk_dirty_mask_t awake_changed[NEIGHBOURHOOD_SIZE] = {0};
+	sim_ctx.awake_changed = awake_changed;
+
+	struct mgc_chunk_awake *chunk_awake = chunk->cache_entry[NEIGHBOURHOOD_CENTER_IDX]->awake;
+	u64 *awake = chunk_awake->tiles[clock];
+	// Only this job writes to the center chunk's tiles during the tick.
+	u64 *updated = chunk_awake->updated[clock];
+
+	for (size_t unit_i = start_i / 64; unit_i < end_i / 64; unit_i++) {
+		u64 unit = awake[unit_i];
+
+#if MGC_SIM_FAST_GRAVITY
+		if (unit) {
+			unit = mgc_sim_update_unit_fast(sim_ctx, unit_i, unit, updated[unit_i]);
+		}
+#endif
+
+		while (unit) {
+			size_t i = unit_i * 64 + mgc_sim_count_trailing_zeros(unit);
+			unit &= unit - 1;
+
+			// Skip tiles that were moved into this tick. Earlier tiles of
+			// the unit might have written to later ones, so check each tile
+			// as it is visited.
+			if ((updated[unit_i] >> (i % 64)) & 1) {
+				continue;
+			}
+
 			sim_ctx.coord = mgc_chunk_index_to_coord(i);
 
 			struct mgc_tile_ref tile = mgc_sim_get_tile(sim_ctx, V3i(0, 0, 0));
-			if (!!(tile.tile->material & 0x8000) != clock) {
-				tile.tile->material =
-					(clock ? 0x8000 : 0x0000) |
-					(tile.tile->material & 0x3fff);
-				mgc_sim_tile(sim_ctx, tile);
-			}
+			mgc_sim_tile(sim_ctx, tile);
 		}
-
-		u64 rchunk_idx = strip_start / RENDER_CHUNK_WIDTH;
-		u64 rchunk_x = rchunk_idx % RENDER_CHUNKS_PER_CHUNK_WIDTH;
-		u64 rchunk_y = (rchunk_idx / (RENDER_CHUNKS_PER_CHUNK_WIDTH * RENDER_CHUNK_WIDTH)) % RENDER_CHUNKS_PER_CHUNK_WIDTH;
-		u64 rchunk_z = (rchunk_idx / (RENDER_CHUNKS_PER_CHUNK_WIDTH * CHUNK_WIDTH * RENDER_CHUNK_WIDTH));
-		u64 rchunk_i = rchunk_x +
-			(rchunk_y * RENDER_CHUNKS_PER_CHUNK_WIDTH) +
-			(rchunk_z * RENDER_CHUNKS_PER_CHUNK_LAYER);
-		assert(rchunk_i < RENDER_CHUNKS_PER_CHUNK);
 	}
 
+	// Chunks in the same parity class share neighbours, so the masks must be
+	// merged atomically.
 	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
-		chunk->cache_entry[i]->dirty_mask |= changed[i];
+		if (changed[i]) {
+			mgc_atomic_fetch_or_u64(&chunk->cache_entry[i]->dirty_mask, changed[i]);
+		}
+		if (awake_changed[i]) {
+			mgc_atomic_fetch_or_u64(
+				&chunk->cache_entry[i]->awake->render_chunks[!clock],
+				awake_changed[i]
+			);
+		}
 	}
 }
 
-void
-mgc_sim_tick(
-		struct mgc_sim_buffer *buffer,
-		struct mgc_chunk_cache *cache,
-		struct mgc_registry *reg,
-		u64 sim_tick)
+struct mgc_sim_job_data {
+	struct mgc_sim_chunk *sim_chunks;
+	u32 *chunk_ids;
+	struct mgc_material_table *materials;
+	bool clock;
+};
+
+static void
+mgc_sim_chunk_job(void *data, size_t job_i, size_t worker_i)
 {
-	TracyCZone(trace, true);
+	struct mgc_sim_job_data *job = data;
+
+	struct mgc_sim_chunk *chunk;
+	chunk = &job->sim_chunks[job->chunk_ids[job_i]];
+
+	struct mgc_chunk_awake *awake;
+	awake = chunk->cache_entry[NEIGHBOURHOOD_CENTER_IDX]->awake;
+
+	u64 awake_rchunks = awake->render_chunks[job->clock];
+	if (!awake_rchunks) {
+		return;
+	}
+
+	for (size_t batch = 0; batch < CHUNK_HEIGHT/SIM_CHUNK_BATCH_SIZE_LAYERS; batch++) {
+		size_t rchunk_z = (batch * SIM_CHUNK_BATCH_SIZE_LAYERS) / RENDER_CHUNK_HEIGHT;
+		u64 layer_mask =
+			((1ULL << RENDER_CHUNKS_PER_CHUNK_LAYER) - 1)
+			<< (rchunk_z * RENDER_CHUNKS_PER_CHUNK_LAYER);
+		if (!(awake_rchunks & layer_mask)) {
+			continue;
+		}
 
-	memset(buffer, 0, sizeof(struct mgc_sim_buffer));
+		mgc_sim_update_tiles(
+			chunk,
+			job->materials,
+			batch*SIM_CHUNK_BATCH_SIZE_LAYERS,
+			SIM_CHUNK_BATCH_SIZE_LAYERS,
+			job->clock
+		);
+	}
+
+	// Writes only wake tiles in the other mask, so this tick's mask can be
+	// reused for the tick after the next.
+	memset(awake->tiles[job->clock], 0, sizeof(awake->tiles[job->clock]));
+	awake->render_chunks[job->clock] = 0;
+
+	// Nothing reads or writes the previous tick's updated mask any more.
+	// Every chunk that was written to last tick has awake tiles this tick,
+	// so the mask is cleared before it is used again.
+	memset(awake->updated[!job->clock], 0, sizeof(awake->updated[!job->clock]));
+}
+
+static inline size_t
+mgc_sim_chunk_parity(v3i coord)
+{
+	return (coord.x & 1) | ((coord.y & 1) << 1) | ((coord.z & 1) << 2);
+}
+
+// Static tiles, and tiles that are surrounded by tiles just like them, have
+// nothing to do. So neither does a uniform chunk of static tiles, or a chunk
+// whose whole neighbourhood is the same uniform tile, until it is written to.
+static bool
+mgc_sim_chunk_is_settled(struct mgc_sim_chunk *sim_chunk, struct mgc_material_props *materials)
+{
+	struct mgc_chunk_cache_entry *center;
+	center = sim_chunk->cache_entry[NEIGHBOURHOOD_CENTER_IDX];
+
+	if (!center->is_uniform) {
+		return false;
+	}
+
+	if (materials[center->uniform.material].behaviour == MGC_MAT_BEHAVIOUR_STATIC) {
+		return true;
+	}
+
+	for (size_t i = 0; i < NEIGHBOURHOOD_SIZE; i++) {
+		struct mgc_chunk_cache_entry *entry = sim_chunk->cache_entry[i];
+		if (!entry->is_uniform ||
+			entry->uniform.material != center->uniform.material ||
+			entry->uniform.data != center->uniform.data) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+mgc_sim_find_chunks(struct mgc_sim_buffer *buffer, struct mgc_chunk_cache *cache, struct mgc_material_props *materials)
+{
+	memset(buffer->sim_chunks, 0, sizeof(buffer->sim_chunks));
 	struct mgc_sim_chunk *sim_chunks = buffer->sim_chunks;
 	size_t sim_chunks_head = 0;
+	size_t num_settled = 0;
 
-	TracyCZoneN(trace_find_chunks, "find chunks to simulate", true);
 	struct mgc_aabbi sim_bounds, sim_chunk_bounds;
 	sim_bounds = mgc_aabbi_from_radius(cache->sim_center, MGC_SIM_RADIUS);
 	sim_chunk_bounds = mgc_coord_bounds_tile_to_chunk(sim_bounds);
 
-	// TODO: Using mgc_chunk_cache_find is quite expensive. Optimize.
+	// Look up every chunk in the sim bounds and the one chunk wide border
+	// around it once, instead of once per neighbour.
+	v3i lookup_min = V3i(
+		sim_chunk_bounds.min.x - 1,
+		sim_chunk_bounds.min.y - 1,
+		sim_chunk_bounds.min.z - 1
+	);
+	v3i lookup_dim = V3i(
+		sim_chunk_bounds.max.x - sim_chunk_bounds.min.x + 2,
+		sim_chunk_bounds.max.y - sim_chunk_bounds.min.y + 2,
+		sim_chunk_bounds.max.z - sim_chunk_bounds.min.z + 2
+	);
+	assert(lookup_dim.x * lookup_dim.y * lookup_dim.z <= SIM_LOOKUP_SIZE);
+
+	struct mgc_chunk_cache_entry **lookup = buffer->lookup;
+	for (int z = 0; z < lookup_dim.z; z++) {
+		for (int y = 0; y < lookup_dim.y; y++) {
+			for (int x = 0; x < lookup_dim.x; x++) {
+				v3i coord = v3i_add(lookup_min, V3i(x, y, z));
+				size_t lookup_i = x + (y + z * lookup_dim.y) * lookup_dim.x;
+				lookup[lookup_i] = NULL;
+
+				isize chunk_i = mgc_chunk_cache_find(cache, coord);
+				if (chunk_i < 0) {
+					continue;
+				}
+
+				struct mgc_chunk_cache_entry *chunk_entry;
+				chunk_entry = &cache->entries[chunk_i];
+
+				enum mgc_chunk_cache_entry_state state;
+				state = mgc_chunk_cache_entry_state(chunk_entry);
+
+				if (state != MGC_CHUNK_CACHE_LOADED &&
+					state != MGC_CHUNK_CACHE_MESHED &&
+					state != MGC_CHUNK_CACHE_DIRTY) {
+					continue;
+				}
+
+#if MGC_CHUNK_CACHE_COMPRESS_IDLE
+				mgc_chunk_cache_expand(cache, chunk_entry);
+#endif
+
+				assert(chunk_entry->chunk || chunk_entry->is_uniform);
+				lookup[lookup_i] = chunk_entry;
+			}
+		}
+	}
+
 	for (int z = sim_chunk_bounds.min.z; z < sim_chunk_bounds.max.z; z++) {
 		for (int y = sim_chunk_bounds.min.y; y < sim_chunk_bounds.max.y; y++) {
 			for (int x = sim_chunk_bounds.min.x; x < sim_chunk_bounds.max.x; x++) {
 				assert(sim_chunks_head < NUM_SIM_CHUNKS);
 				v3i chunk_coord = V3i(x, y, z);
+				struct mgc_sim_chunk *sim_chunk = &sim_chunks[sim_chunks_head];
 
-				for (size_t neighbour_i = 0; neighbour_i < sizeof(neighbourhood)/sizeof(neighbourhood[0]); neighbour_i++) {
-					v3i offset = neighbourhood[neighbour_i];
-					isize chunk_i = mgc_chunk_cache_find(cache, v3i_add(chunk_coord, offset));
-
-					if (chunk_i < 0) {
-						continue;
-					}
+				size_t num_neighbours = 0;
+				for (size_t neighbour_i = 0; neighbour_i < NEIGHBOURHOOD_SIZE; neighbour_i++) {
+					v3i coord = v3i_add(chunk_coord, neighbourhood[neighbour_i]);
+					size_t lookup_i =
+						  (coord.x - lookup_min.x)
+						+ ((coord.y - lookup_min.y)
+						+  (coord.z - lookup_min.z) * lookup_dim.y) * lookup_dim.x;
 
 					struct mgc_chunk_cache_entry *chunk_entry;
-					chunk_entry = &cache->entries[chunk_i];
-
-					if (chunk_entry->state != MGC_CHUNK_CACHE_LOADED &&
-						chunk_entry->state != MGC_CHUNK_CACHE_MESHED && 
-						chunk_entry->state != MGC_CHUNK_CACHE_DIRTY) {
+					chunk_entry = lookup[lookup_i];
+					if (!chunk_entry) {
 						continue;
 					}
 
-					assert(chunk_entry->chunk);
-
+					sim_chunk->cache_entry[neighbour_i] = chunk_entry;
+					num_neighbours += 1;
+				}
 
-					sim_chunks[sim_chunks_head].cache_entry[neighbour_i] = chunk_entry;
-					sim_chunks[sim_chunks_head].neighbours[neighbour_i] =
-						mgc_chunk_make_ref(chunk_entry->chunk);
+				// Tiles at the edge of the chunk read from and write to the
+				// neighbouring chunks, so only simulate chunks whose whole
+				// neighbourhood is loaded. Chunks are loaded in the
+				// background, so this is not always the case.
+				if (num_neighbours != NEIGHBOURHOOD_SIZE) {
+					memset(sim_chunk, 0, sizeof(struct mgc_sim_chunk));
+					continue;
 				}
 
-				// The center chunk was not loaded, so don't try simulating it.
-				if (!sim_chunks[sim_chunks_head].cache_entry[NEIGHBOURHOOD_CENTER_IDX]) {
-					memset(&sim_chunks[sim_chunks_head], 0, sizeof(struct mgc_sim_chunk));
+				if (mgc_sim_chunk_is_settled(sim_chunk, materials)) {
+					buffer->settled_chunks[num_settled] =
+						sim_chunk->cache_entry[NEIGHBOURHOOD_CENTER_IDX];
+					num_settled += 1;
+					memset(sim_chunk, 0, sizeof(struct mgc_sim_chunk));
 					continue;
 				}
 
+				for (size_t neighbour_i = 0; neighbour_i < NEIGHBOURHOOD_SIZE; neighbour_i++) {
+					struct mgc_chunk_cache_entry *chunk_entry;
+					chunk_entry = sim_chunk->cache_entry[neighbour_i];
+
+					mgc_chunk_cache_materialise(cache, chunk_entry);
+					sim_chunk->neighbours[neighbour_i] =
+						mgc_chunk_make_ref(chunk_entry->chunk);
+				}
+
 				sim_chunks_head += 1;
 			}
 		}
 	}
-	TracyCZoneEnd(trace_find_chunks);
 
-	// TODO: Paralellize by splitting the chunk into layers. We could update
-	// multiple chunks at the same time by only updating alternating layers
-	// that are not adjacent to any other layer that is currently being
-	// updated.
+	// Chunks are simulated in 8 passes, one for each parity class of their
+	// coordinate. Tiles only read and write within one tile of themselves, so
+	// chunks in the same class never touch the same tiles, and can be
+	// simulated in parallel.
+	size_t *class_begin = buffer->class_begin;
+	memset(buffer->class_begin, 0, sizeof(buffer->class_begin));
 
-	bool clock = (sim_tick % 2) == 1;
+	for (size_t chunk_i = 0; chunk_i < sim_chunks_head; chunk_i++) {
+		v3i coord = sim_chunks[chunk_i].cache_entry[NEIGHBOURHOOD_CENTER_IDX]->coord;
+		class_begin[mgc_sim_chunk_parity(coord) + 1] += 1;
+	}
+
+	for (size_t class_i = 1; class_i < 9; class_i++) {
+		class_begin[class_i] += class_begin[class_i - 1];
+	}
+
+	size_t class_head[8];
+	memcpy(class_head, class_begin, sizeof(class_head));
 
-	TracyCZoneN(trace_sim, "simulate chunks", true);
-	// Update said chunks
 	for (size_t chunk_i = 0; chunk_i < sim_chunks_head; chunk_i++) {
-		struct mgc_sim_chunk *chunk;
-		chunk = &sim_chunks[chunk_i];
-
-		for (size_t batch = 0; batch < CHUNK_HEIGHT/SIM_CHUNK_BATCH_SIZE_LAYERS; batch++) {
-			mgc_sim_update_tiles(
-				chunk,
-				batch*SIM_CHUNK_BATCH_SIZE_LAYERS,
-				SIM_CHUNK_BATCH_SIZE_LAYERS,
-				clock
-			);
+		v3i coord = sim_chunks[chunk_i].cache_entry[NEIGHBOURHOOD_CENTER_IDX]->coord;
+		size_t class_i = mgc_sim_chunk_parity(coord);
+		buffer->scheduled_chunks[class_head[class_i]] = chunk_i;
+		class_head[class_i] += 1;
+	}
+
+	buffer->num_sim_chunks = sim_chunks_head;
+	buffer->num_settled_chunks = num_settled;
+
+	buffer->num_uniform_chunks = 0;
+	for (size_t lookup_i = 0; lookup_i < (size_t)(lookup_dim.x * lookup_dim.y * lookup_dim.z); lookup_i++) {
+		struct mgc_chunk_cache_entry *entry = lookup[lookup_i];
+		if (entry && entry->is_uniform && entry->chunk) {
+			buffer->uniform_chunks[buffer->num_uniform_chunks] = entry;
+			buffer->num_uniform_chunks += 1;
+		}
+	}
+
+	// Chunks that were not part of the sim at the last rebuild may have
+	// missed wake ups while outside it, so start them fully awake.
+	buffer->epoch += 1;
+	for (size_t chunk_i = 0; chunk_i < sim_chunks_head; chunk_i++) {
+		struct mgc_chunk_cache_entry *entry;
+		entry = sim_chunks[chunk_i].cache_entry[NEIGHBOURHOOD_CENTER_IDX];
+
+		if (entry->sim_epoch == 0 || entry->sim_epoch + 1 != buffer->epoch) {
+			mgc_chunk_awake_wake_all(entry->awake);
 		}
+		entry->sim_epoch = buffer->epoch;
+	}
+
+	// Settled chunks are part of the sim too, they just have nothing to do.
+	// Their tiles only wake when something next to them changes.
+	for (size_t chunk_i = 0; chunk_i < num_settled; chunk_i++) {
+		buffer->settled_chunks[chunk_i]->sim_epoch = buffer->epoch;
+	}
+}
+
+void
+mgc_sim_tick(
+		struct mgc_sim_buffer *buffer,
+		struct mgc_chunk_cache *cache,
+		struct mgc_registry *reg,
+		struct mgc_job_pool *pool,
+		u64 sim_tick)
+{
+	TracyCZone(trace, true);
+
+	TracyCZoneN(trace_find_chunks, "find chunks to simulate", true);
+	// The table of chunks to simulate only changes when the sim center moves
+	// or a chunk is loaded or evicted, so only rebuild it then.
+	u64 generation = mgc_atomic_load_u64(&cache->sim_generation);
+	if (generation != buffer->generation) {
+		mgc_sim_find_chunks(buffer, cache, reg->materials.props);
+		buffer->generation = generation;
+	}
+	TracyCZoneEnd(trace_find_chunks);
+
+	struct mgc_sim_chunk *sim_chunks = buffer->sim_chunks;
+	size_t *class_begin = buffer->class_begin;
+	bool clock = (sim_tick % 2) == 1;
+
+	TracyCZoneN(trace_sim, "simulate chunks", true);
+	for (size_t class_i = 0; class_i < 8; class_i++) {
+		struct mgc_sim_job_data job = {0};
+		job.sim_chunks = sim_chunks;
+		job.chunk_ids = &buffer->scheduled_chunks[class_begin[class_i]];
+		job.materials = &reg->materials;
+		job.clock = clock;
+
+		mgc_job_pool_run(
+			pool,
+			mgc_sim_chunk_job,
+			&job,
+			class_begin[class_i + 1] - class_begin[class_i]
+		);
 	}
 	TracyCZoneEnd(trace_sim);
 
+	// Once a uniform chunk is written to, the chunks around it are no longer
+	// settled, and have to be simulated from the next tick on. Their woken
+	// tiles are only visited then. Written tiles mark their render chunk
+	// dirty, so only those chunks need to be checked.
+	for (size_t i = 0; i < buffer->num_uniform_chunks; i++) {
+		struct mgc_chunk_cache_entry *entry = buffer->uniform_chunks[i];
+		if (!entry->is_uniform || !entry->dirty_mask) {
+			continue;
+		}
+
+		u64 *updated = entry->awake->updated[clock];
+		for (size_t unit_i = 0; unit_i < CHUNK_AWAKE_MASK_UNITS; unit_i++) {
+			if (updated[unit_i]) {
+				entry->is_uniform = false;
+				mgc_atomic_fetch_add_u64(&cache->sim_generation, 1);
+				break;
+			}
+		}
+	}
+
+	TracyCPlot("sim chunks", (double)buffer->num_sim_chunks);
+	TracyCPlot("settled sim chunks", (double)buffer->num_settled_chunks);
+
 	TracyCZoneEnd(trace);
 }
@@ -8,6 +8,7 @@
 #define NEIGHBOURHOOD_WIDTH 3
 #define NEIGHBOURHOOD_SIZE (NEIGHBOURHOOD_WIDTH*NEIGHBOURHOOD_WIDTH*NEIGHBOURHOOD_WIDTH)
 #define NEIGHBOURHOOD_CENTER_IDX 13
+#define NEIGHBOURHOOD_BELOW_IDX 4
 
 #if (RENDER_CHUNKS_PER_CHUNK <= 8)
 typedef u8 chunk_dirty_mask_t;
@@ -28,15 +29,55 @@ struct mgc_sim_chunk {
 };
 
 
+#define SIM_LOOKUP_SIZE ((NUM_SIM_CHUNKS_WIDTH+2)*(NUM_SIM_CHUNKS_WIDTH+2)*(NUM_SIM_CHUNKS_HEIGHT+2))
+
+// The buffer caches the table of chunks to simulate between ticks. It is
+// rebuilt when the chunk cache's sim_generation changes.
 struct mgc_sim_buffer {
+	u64 generation;
+	// Incremented on every rebuild.
+	u64 epoch;
+
 	struct mgc_sim_chunk sim_chunks[NUM_SIM_CHUNKS];
+	size_t num_sim_chunks;
+
+	// Indices into sim_chunks, grouped by parity class. The chunks of class
+	// i are in [class_begin[i], class_begin[i+1]).
+	u32 scheduled_chunks[NUM_SIM_CHUNKS];
+	size_t class_begin[9];
+
+	// Uniform chunks that are not simulated, as they have nothing to do
+	// until they are written to (see mgc_sim_chunk_is_settled).
+	struct mgc_chunk_cache_entry *settled_chunks[NUM_SIM_CHUNKS];
+	size_t num_settled_chunks;
+
+	// Uniform chunks in the neighbourhood of simulated chunks, which might
+	// be written to.
+	struct mgc_chunk_cache_entry *uniform_chunks[SIM_LOOKUP_SIZE];
+	size_t num_uniform_chunks;
+
+	// Scratch space used while rebuilding.
+	struct mgc_chunk_cache_entry *lookup[SIM_LOOKUP_SIZE];
 };
 
+// Simulates the awake tiles in layers [start_z, start_z+num_layers) of the
+// chunk at the center of the neighbourhood.
+void
+mgc_sim_update_tiles(
+		struct mgc_sim_chunk *chunk,
+		struct mgc_material_table *materials,
+		size_t start_z,
+		size_t num_layers,
+		bool clock);
+
+struct mgc_job_pool;
+
 void
 mgc_sim_tick(
 		struct mgc_sim_buffer *,
 		struct mgc_chunk_cache *cache,
 		struct mgc_registry *reg,
+		struct mgc_job_pool *pool,
 		u64 sim_tick);
 
 #endif
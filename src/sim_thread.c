@@ -1,111 +1,49 @@
 #include "sim_thread.h"
 #include "sim.h"
 
-#ifdef _WIN32
-#include <windows.h>
-#include <process.h>
-#include <processthreadapi.h>
-#include <intrin.h>
+#include "thread.h"
+#include "utils.h"
+#include "config.h"
 
-struct mgc_sim_thread_handle {
-	size_t id;
-	uintptr_t handle;
-	struct mgc_sim_thread *ctx;
-};
-#else
-
-#include <pthread.h>
-#include <signal.h>
 
 struct mgc_sim_thread_handle {
 	size_t id;
-	pthread_t handle;
+	struct mgc_thread thread;
 	struct mgc_sim_thread *ctx;
 };
-#endif
 
 static void
 mgc_sim_thread_fn(struct mgc_sim_thread *thread, size_t id)
 {
 	size_t tick = 0;
 	while (!thread->should_quit) {
-		if (thread->chunk_cache->update_state == MGC_CHUNK_CACHE_UPDATE_SIM) {
-			mgc_sim_tick(
-				thread->sim_buffer,
-				thread->chunk_cache,
-				thread->registry,
-				tick
-			);
-
-			// TODO: Re-run meshing in case we ran out of buffer-space last tick.
-			mgc_chunk_cache_mesh(
-				thread->chunk_cache
-			);
-			tick += 1;
-
-			thread->chunk_cache->update_state = MGC_CHUNK_CACHE_UPDATE_RENDER;
+		mgc_chunk_cache_sim_begin(thread->chunk_cache);
+
+		mgc_sim_tick(
+			thread->sim_buffer,
+			thread->chunk_cache,
+			thread->registry,
+			&thread->pool,
+			tick
+		);
+
+		mgc_chunk_cache_mesh(
+			thread->chunk_cache,
+			&thread->pool
+		);
+		tick += 1;
+
+		if (!mgc_chunk_cache_sim_end(thread->chunk_cache)) {
+			break;
 		}
 	}
 }
 
-#ifdef _WIN32
-static int __cdecl
-mgc_sim_thread_entry(void *data)
-{
-	struct mgc_sim_thread_handle *handle = data;
-	mgc_sim_thread_fn(handle->ctx, handle->id);
-	return -1;
-}
-#else
-static void *
+static void
 mgc_sim_thread_entry(void *data)
 {
 	struct mgc_sim_thread_handle *handle = data;
 	mgc_sim_thread_fn(handle->ctx, handle->id);
-	return NULL;
-}
-#endif
-
-static int
-mgc_spawn_thread(struct mgc_sim_thread_handle *handle)
-{
-#ifdef _WIN32
-	handle->handle = _beginthreadex(
-		NULL,
-		0,
-		mgc_sim_thread_entry,
-		handle,
-		0,
-		NULL
-	);
-	if (handle->handle == -1) {
-		return -1;
-	}
-#else
-	return pthread_create(
-		&handle->handle,
-		NULL,
-		mgc_sim_thread_entry,
-		handle
-	);
-#endif
-
-	return 0;
-}
-
-static int
-mgc_kill_thread(struct mgc_sim_thread_handle *handle)
-{
-#ifdef _WIN32
-	BOOL ok;
-	ok = TerminateThread(handle->handle, -1);
-	if (!ok) {
-		return -1;
-	}
-	return 0;
-#else
-	return pthread_kill(handle->handle, SIGKILL);
-#endif
 }
 
 int
@@ -117,6 +55,18 @@ mgc_sim_thread_start(
 {
 	thread->num_threads = 1;
 
+	// The sim thread itself also simulates chunks, and the render thread
+	// needs a core of its own.
+	size_t num_cpus = mgc_num_cpus();
+	size_t num_workers = num_cpus > 1 ? num_cpus - 1 : 1;
+	num_workers = min(num_workers, MGC_SIM_MAX_THREADS);
+
+	int err;
+	err = mgc_job_pool_init(&thread->pool, num_workers - 1);
+	if (err) {
+		print_error("sim", "Failed to start all sim worker threads.");
+	}
+
 	thread->chunk_cache = chunk_cache;
 	thread->registry = registry;
 	thread->sim_buffer = arena_alloc(arena, sizeof(struct mgc_sim_buffer));
@@ -124,48 +74,35 @@ mgc_sim_thread_start(
 	thread->thread_handles = arena_allocn(arena, sizeof(struct mgc_sim_thread_handle), thread->num_threads);
 	for (size_t thread_i = 0; thread_i < thread->num_threads; thread_i++) {
 		struct mgc_sim_thread_handle *handle = &thread->thread_handles[thread_i];
+		handle->id = thread_i;
 		handle->ctx = thread;
 
-		int err;
-		err = mgc_spawn_thread(handle);
+		err = mgc_thread_spawn(&handle->thread, mgc_sim_thread_entry, handle);
 		if (err) {
 			for (size_t i = 0; i < thread_i; i++) {
-				mgc_kill_thread(handle);
+				mgc_thread_kill(&thread->thread_handles[i].thread);
 			}
 			return -1;
 		}
 	}
 
-	return -1;
+	return 0;
 }
 
 int
 mgc_sim_thread_stop(struct mgc_sim_thread *thread)
 {
 	thread->should_quit = true;
+	mgc_chunk_cache_sim_quit(thread->chunk_cache);
 
 	for (size_t i = 0; i < thread->num_threads; i++) {
-#ifdef _WIN32
-		WaitForSingleObject((HANDLE)thread->thread_handles[i].handle, INFINITE);
-#else
-		int err;
-		err = pthread_join(thread->thread_handles[i].handle, NULL);
-		if (err) {
-			printf("Join failed: %s\n", strerror(err));
-			thread->thread_handles[i].handle = 0;
-			continue;
-		}
-#endif
-	}
-
-#ifdef _WIN32
-	for (size_t i = 0; i < thread->num_threads; i++) {
-		CloseHandle((HANDLE)thread->thread_handles[i].handle);
+		mgc_thread_join(&thread->thread_handles[i].thread);
 	}
-#endif
 
 	thread->num_threads = 0;
 
+	mgc_job_pool_destroy(&thread->pool);
+
 	return 0;
 }
 
@@ -2,6 +2,7 @@
 #define MAGIC_SIM_THREAD_H
 
 #include "types.h"
+#include "thread.h"
 
 struct arena;
 struct mgc_chunk_cache;
@@ -17,6 +18,9 @@ struct mgc_sim_thread {
 	size_t num_threads;
 	struct mgc_sim_thread_handle *thread_handles;
 
+	// Workers that simulate and mesh chunks in parallel with the sim thread.
+	struct mgc_job_pool pool;
+
 	volatile int should_quit;
 };
 
@@ -0,0 +1,392 @@
+#include "thread.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+#ifdef _WIN32
+static unsigned __stdcall
+mgc_thread_entry(void *data)
+{
+	struct mgc_thread *thread = data;
+	thread->fn(thread->data);
+	return 0;
+}
+#else
+static void *
+mgc_thread_entry(void *data)
+{
+	struct mgc_thread *thread = data;
+	thread->fn(thread->data);
+	return NULL;
+}
+#endif
+
+int
+mgc_thread_spawn(struct mgc_thread *thread, mgc_thread_fn fn, void *data)
+{
+	thread->fn = fn;
+	thread->data = data;
+
+#ifdef _WIN32
+	thread->handle = _beginthreadex(
+		NULL,
+		0,
+		mgc_thread_entry,
+		thread,
+		0,
+		NULL
+	);
+	if (thread->handle == 0) {
+		return -1;
+	}
+	return 0;
+#else
+	int err;
+	err = pthread_create(
+		&thread->handle,
+		NULL,
+		mgc_thread_entry,
+		thread
+	);
+	if (err) {
+		print_error("thread", "Failed to spawn thread: %s", strerror(err));
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+int
+mgc_thread_join(struct mgc_thread *thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject((HANDLE)thread->handle, INFINITE);
+	CloseHandle((HANDLE)thread->handle);
+	thread->handle = 0;
+	return 0;
+#else
+	int err;
+	err = pthread_join(thread->handle, NULL);
+	if (err) {
+		print_error("thread", "Join failed: %s", strerror(err));
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+int
+mgc_thread_kill(struct mgc_thread *thread)
+{
+#ifdef _WIN32
+	BOOL ok;
+	ok = TerminateThread((HANDLE)thread->handle, -1);
+	if (!ok) {
+		return -1;
+	}
+	CloseHandle((HANDLE)thread->handle);
+	thread->handle = 0;
+	return 0;
+#else
+	return pthread_kill(thread->handle, SIGKILL);
+#endif
+}
+
+size_t
+mgc_num_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+	long result;
+	result = sysconf(_SC_NPROCESSORS_ONLN);
+	return result > 0 ? (size_t)result : 1;
+#endif
+}
+
+u64
+mgc_time_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, counter;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (u64)((counter.QuadPart / freq.QuadPart) * 1000000000ULL +
+		((counter.QuadPart % freq.QuadPart) * 1000000000ULL) / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+#endif
+}
+
+void
+mgc_mutex_init(struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	InitializeSRWLock(&mtx->lock);
+#else
+	pthread_mutex_init(&mtx->lock, NULL);
+#endif
+}
+
+void
+mgc_mutex_destroy(struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	// SRW locks do not need to be destroyed.
+#else
+	pthread_mutex_destroy(&mtx->lock);
+#endif
+}
+
+void
+mgc_mutex_lock(struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&mtx->lock);
+#else
+	pthread_mutex_lock(&mtx->lock);
+#endif
+}
+
+bool
+mgc_mutex_try_lock(struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	return TryAcquireSRWLockExclusive(&mtx->lock) != 0;
+#else
+	return pthread_mutex_trylock(&mtx->lock) == 0;
+#endif
+}
+
+void
+mgc_mutex_unlock(struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&mtx->lock);
+#else
+	pthread_mutex_unlock(&mtx->lock);
+#endif
+}
+
+void
+mgc_cond_init(struct mgc_cond *cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(&cond->cond);
+#else
+	pthread_cond_init(&cond->cond, NULL);
+#endif
+}
+
+void
+mgc_cond_destroy(struct mgc_cond *cond)
+{
+#ifdef _WIN32
+	// Condition variables do not need to be destroyed.
+#else
+	pthread_cond_destroy(&cond->cond);
+#endif
+}
+
+void
+mgc_cond_wait(struct mgc_cond *cond, struct mgc_mutex *mtx)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW(&cond->cond, &mtx->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&cond->cond, &mtx->lock);
+#endif
+}
+
+void
+mgc_cond_signal(struct mgc_cond *cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(&cond->cond);
+#else
+	pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void
+mgc_cond_broadcast(struct mgc_cond *cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&cond->cond);
+#else
+	pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+// Claims and runs jobs from the pool's current batch until there are none
+// left. Returns the number of jobs that were run.
+static size_t
+mgc_job_pool_work(struct mgc_job_pool *pool, mgc_job_fn fn, void *data, size_t num_jobs, size_t worker_i)
+{
+	size_t num_done = 0;
+	while (true) {
+		u32 job_i = mgc_atomic_fetch_add_u32(&pool->next_job, 1);
+		if (job_i >= num_jobs) {
+			break;
+		}
+
+		fn(data, job_i, worker_i);
+		num_done += 1;
+	}
+
+	return num_done;
+}
+
+struct mgc_job_pool_thread_data {
+	struct mgc_job_pool *pool;
+	size_t worker_i;
+};
+
+static void
+mgc_job_pool_thread(void *data)
+{
+	struct mgc_job_pool_thread_data *thread_data = data;
+	struct mgc_job_pool *pool = thread_data->pool;
+	size_t worker_i = thread_data->worker_i;
+	free(thread_data);
+
+	u64 generation = 0;
+
+	mgc_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->generation == generation && !pool->should_quit) {
+			mgc_cond_wait(&pool->work_cond, &pool->lock);
+		}
+
+		if (pool->should_quit) {
+			break;
+		}
+
+		generation = pool->generation;
+		mgc_job_fn fn = pool->fn;
+		void *fn_data = pool->data;
+		size_t num_jobs = pool->num_jobs;
+		pool->num_busy += 1;
+		mgc_mutex_unlock(&pool->lock);
+
+		size_t num_done;
+		num_done = mgc_job_pool_work(pool, fn, fn_data, num_jobs, worker_i);
+
+		mgc_mutex_lock(&pool->lock);
+		pool->num_done += num_done;
+		pool->num_busy -= 1;
+		if (pool->num_busy == 0 && pool->num_done == pool->num_jobs) {
+			mgc_cond_signal(&pool->done_cond);
+		}
+	}
+	mgc_mutex_unlock(&pool->lock);
+}
+
+int
+mgc_job_pool_init(struct mgc_job_pool *pool, size_t num_threads)
+{
+	memset(pool, 0, sizeof(struct mgc_job_pool));
+
+	mgc_mutex_init(&pool->lock);
+	mgc_cond_init(&pool->work_cond);
+	mgc_cond_init(&pool->done_cond);
+
+	pool->threads = calloc(num_threads, sizeof(struct mgc_thread));
+
+	for (size_t i = 0; i < num_threads; i++) {
+		struct mgc_job_pool_thread_data *thread_data;
+		thread_data = calloc(1, sizeof(struct mgc_job_pool_thread_data));
+		thread_data->pool = pool;
+		thread_data->worker_i = i + 1;
+
+		int err;
+		err = mgc_thread_spawn(&pool->threads[i], mgc_job_pool_thread, thread_data);
+		if (err) {
+			free(thread_data);
+			return -1;
+		}
+
+		pool->num_threads += 1;
+	}
+
+	return 0;
+}
+
+void
+mgc_job_pool_destroy(struct mgc_job_pool *pool)
+{
+	mgc_mutex_lock(&pool->lock);
+	pool->should_quit = true;
+	mgc_cond_broadcast(&pool->work_cond);
+	mgc_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->num_threads; i++) {
+		mgc_thread_join(&pool->threads[i]);
+	}
+
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->num_threads = 0;
+
+	mgc_cond_destroy(&pool->done_cond);
+	mgc_cond_destroy(&pool->work_cond);
+	mgc_mutex_destroy(&pool->lock);
+}
+
+void
+mgc_job_pool_run(struct mgc_job_pool *pool, mgc_job_fn fn, void *data, size_t num_jobs)
+{
+	if (num_jobs == 0) {
+		return;
+	}
+
+	if (pool->num_threads == 0 || num_jobs == 1) {
+		for (size_t i = 0; i < num_jobs; i++) {
+			fn(data, i, 0);
+		}
+		return;
+	}
+
+	mgc_mutex_lock(&pool->lock);
+
+	// Threads that woke up late for the previous batch might still be
+	// claiming jobs from it.
+	while (pool->num_busy > 0) {
+		mgc_cond_wait(&pool->done_cond, &pool->lock);
+	}
+
+	pool->fn = fn;
+	pool->data = data;
+	pool->num_jobs = num_jobs;
+	pool->num_done = 0;
+	mgc_atomic_store_u32(&pool->next_job, 0);
+	pool->generation += 1;
+	mgc_cond_broadcast(&pool->work_cond);
+
+	pool->num_busy += 1;
+	mgc_mutex_unlock(&pool->lock);
+
+	size_t num_done;
+	num_done = mgc_job_pool_work(pool, fn, data, num_jobs, 0);
+
+	mgc_mutex_lock(&pool->lock);
+	pool->num_done += num_done;
+	pool->num_busy -= 1;
+	while (pool->num_busy > 0 || pool->num_done < pool->num_jobs) {
+		mgc_cond_wait(&pool->done_cond, &pool->lock);
+	}
+	mgc_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,137 @@
+#ifndef MAGIC_THREAD_H
+#define MAGIC_THREAD_H
+
+#include "intdef.h"
+#include "types.h"
+#include "atomic.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef void (*mgc_thread_fn)(void *data);
+
+struct mgc_thread {
+#ifdef _WIN32
+	uintptr_t handle;
+#else
+	pthread_t handle;
+#endif
+	mgc_thread_fn fn;
+	void *data;
+};
+
+struct mgc_mutex {
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+struct mgc_cond {
+#ifdef _WIN32
+	CONDITION_VARIABLE cond;
+#else
+	pthread_cond_t cond;
+#endif
+};
+
+// The thread struct must stay at the same address until the thread has been
+// joined.
+int
+mgc_thread_spawn(struct mgc_thread *, mgc_thread_fn fn, void *data);
+
+int
+mgc_thread_join(struct mgc_thread *);
+
+int
+mgc_thread_kill(struct mgc_thread *);
+
+// Returns the number of logical processors available, or 1 if it could not be
+// determined.
+size_t
+mgc_num_cpus(void);
+
+// Returns a monotonic timestamp in nanoseconds.
+u64
+mgc_time_ns(void);
+
+void
+mgc_mutex_init(struct mgc_mutex *);
+
+void
+mgc_mutex_destroy(struct mgc_mutex *);
+
+void
+mgc_mutex_lock(struct mgc_mutex *);
+
+bool
+mgc_mutex_try_lock(struct mgc_mutex *);
+
+void
+mgc_mutex_unlock(struct mgc_mutex *);
+
+void
+mgc_cond_init(struct mgc_cond *);
+
+void
+mgc_cond_destroy(struct mgc_cond *);
+
+void
+mgc_cond_wait(struct mgc_cond *, struct mgc_mutex *);
+
+void
+mgc_cond_signal(struct mgc_cond *);
+
+void
+mgc_cond_broadcast(struct mgc_cond *);
+
+typedef void (*mgc_job_fn)(void *data, size_t job_i, size_t worker_i);
+
+// A fork-join pool. mgc_job_pool_run hands out jobs to the pool's threads and
+// the calling thread, and returns once all jobs have completed.
+struct mgc_job_pool {
+	struct mgc_thread *threads;
+	size_t num_threads;
+
+	struct mgc_mutex lock;
+	struct mgc_cond work_cond;
+	struct mgc_cond done_cond;
+
+	mgc_job_fn fn;
+	void *data;
+	size_t num_jobs;
+	volatile u32 next_job;
+	size_t num_done;
+	// Number of threads that have joined the current batch and not yet left
+	// it.
+	size_t num_busy;
+	u64 generation;
+
+	bool should_quit;
+};
+
+// Starts a pool with num_threads threads in addition to the calling thread.
+// num_threads may be 0, in which case all jobs run on the calling thread.
+int
+mgc_job_pool_init(struct mgc_job_pool *, size_t num_threads);
+
+void
+mgc_job_pool_destroy(struct mgc_job_pool *);
+
+// The number of distinct worker_i values passed to jobs.
+static inline size_t
+mgc_job_pool_num_workers(struct mgc_job_pool *pool)
+{
+	return pool->num_threads + 1;
+}
+
+// Runs fn(data, job_i, worker_i) for every job_i in [0, num_jobs). Must only
+// be called from one thread at a time.
+void
+mgc_job_pool_run(struct mgc_job_pool *, mgc_job_fn fn, void *data, size_t num_jobs);
+
+#endif
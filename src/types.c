@@ -93,6 +93,77 @@ mgc_aabbi_intersect_bounds(struct mgc_aabbi lhs, struct mgc_aabbi rhs)
 	return result;
 }
 
+bool
+mgc_aabbi_contains(struct mgc_aabbi b, v3i p)
+{
+	return
+		p.x >= b.min.x && p.x < b.max.x &&
+		p.y >= b.min.y && p.y < b.max.y &&
+		p.z >= b.min.z && p.z < b.max.z;
+}
+
+size_t
+mgc_aabbi_subtract(struct mgc_aabbi lhs, struct mgc_aabbi rhs, struct mgc_aabbi out[6])
+{
+	if (lhs.min.x >= lhs.max.x ||
+		lhs.min.y >= lhs.max.y ||
+		lhs.min.z >= lhs.max.z) {
+		return 0;
+	}
+
+	struct mgc_aabbi inner = mgc_aabbi_intersect_bounds(lhs, rhs);
+	if (inner.min.x >= inner.max.x ||
+		inner.min.y >= inner.max.y ||
+		inner.min.z >= inner.max.z) {
+		out[0] = lhs;
+		return 1;
+	}
+
+	size_t num_out = 0;
+	struct mgc_aabbi rest = lhs;
+
+	// Cut off the slabs below and above inner along z, then the rows along
+	// y, then the spans along x.
+	if (rest.min.z < inner.min.z) {
+		out[num_out] = rest;
+		out[num_out].max.z = inner.min.z;
+		num_out += 1;
+	}
+	if (inner.max.z < rest.max.z) {
+		out[num_out] = rest;
+		out[num_out].min.z = inner.max.z;
+		num_out += 1;
+	}
+	rest.min.z = inner.min.z;
+	rest.max.z = inner.max.z;
+
+	if (rest.min.y < inner.min.y) {
+		out[num_out] = rest;
+		out[num_out].max.y = inner.min.y;
+		num_out += 1;
+	}
+	if (inner.max.y < rest.max.y) {
+		out[num_out] = rest;
+		out[num_out].min.y = inner.max.y;
+		num_out += 1;
+	}
+	rest.min.y = inner.min.y;
+	rest.max.y = inner.max.y;
+
+	if (rest.min.x < inner.min.x) {
+		out[num_out] = rest;
+		out[num_out].max.x = inner.min.x;
+		num_out += 1;
+	}
+	if (inner.max.x < rest.max.x) {
+		out[num_out] = rest;
+		out[num_out].min.x = inner.max.x;
+		num_out += 1;
+	}
+
+	return num_out;
+}
+
 struct mgc_hexbounds
 mgc_hexbounds_union(struct mgc_hexbounds lhs, struct mgc_hexbounds rhs)
 {
@@ -161,6 +161,14 @@ mgc_aabbi_extend_bounds(struct mgc_aabbi lhs, struct mgc_aabbi rhs);
 struct mgc_aabbi
 mgc_aabbi_intersect_bounds(struct mgc_aabbi lhs, struct mgc_aabbi rhs);
 
+bool
+mgc_aabbi_contains(struct mgc_aabbi b, v3i p);
+
+// Splits the part of lhs that is not in rhs into at most 6 non-empty,
+// disjoint boxes. Returns the number of boxes written to out.
+size_t
+mgc_aabbi_subtract(struct mgc_aabbi lhs, struct mgc_aabbi rhs, struct mgc_aabbi out[6]);
+
 struct mgc_hexbounds {
 	v2i center;
 	int radius;
@@ -4,17 +4,36 @@
 void
 mgc_world_init_world_def(struct mgc_world *world, struct mgc_world_init_context *init_ctx)
 {
+	world->src = MGC_WORLD_SRC_WORLD_DEF;
 	mgc_world_src_world_def_init(&world->world_def, init_ctx);
 }
 
 void
-mgc_world_init_precomputed(struct mgc_world *world, struct mgc_world_init_context *init_ctx)
+mgc_world_init_precomputed(struct mgc_world *world, struct mgc_world_init_context *init_ctx, const char *archive_path)
 {
-	mgc_world_src_precomputed_init(&world->precomputed, init_ctx);
+	world->src = MGC_WORLD_SRC_PRECOMPUTED;
+	mgc_world_src_precomputed_init(&world->precomputed, init_ctx, archive_path);
+}
+
+void
+mgc_world_destroy(struct mgc_world *world)
+{
+	switch (world->src) {
+		case MGC_WORLD_SRC_WORLD_DEF:
+			break;
+
+		case MGC_WORLD_SRC_PRECOMPUTED:
+			mgc_world_src_precomputed_destroy(&world->precomputed);
+			break;
+
+		default:
+			panic("Invalid world source.");
+			break;
+	}
 }
 
 int
-mgc_world_load_chunk(struct mgc_world *world, struct mgc_chunk *chunk, v3i coord)
+mgc_world_load_chunk(struct mgc_world *world, struct mgc_chunk *chunk, v3i coord, struct mgc_tile *uniform)
 {
 	TracyCZone(trace, true);
 
@@ -22,11 +41,11 @@ mgc_world_load_chunk(struct mgc_world *world, struct mgc_chunk *chunk, v3i coord
 
 	switch (world->src) {
 		case MGC_WORLD_SRC_WORLD_DEF:
-			err = mgc_world_src_world_def_load_chunk(&world->world_def, chunk, coord);
+			err = mgc_world_src_world_def_load_chunk(&world->world_def, chunk, coord, uniform);
 			break;
 
 		case MGC_WORLD_SRC_PRECOMPUTED:
-			err = mgc_world_src_precomputed_load_chunk(&world->precomputed, chunk, coord);
+			err = mgc_world_src_precomputed_load_chunk(&world->precomputed, chunk, coord, uniform);
 			break;
 
 		default:
@@ -39,11 +39,21 @@ struct mgc_world_init_context {
 void
 mgc_world_init_world_def(struct mgc_world *, struct mgc_world_init_context *);
 
+// Loads chunks from the chunk archive at archive_path.
 void
-mgc_world_init_precomputed(struct mgc_world *, struct mgc_world_init_context *);
+mgc_world_init_precomputed(struct mgc_world *, struct mgc_world_init_context *, const char *archive_path);
 
+void
+mgc_world_destroy(struct mgc_world *);
+
+// Returned by mgc_world_load_chunk when every tile of the chunk is the same.
+#define MGC_WORLD_LOAD_UNIFORM 2
+
+// Writes every tile of the chunk at coord. If they are all the same, sets
+// *uniform instead and returns MGC_WORLD_LOAD_UNIFORM without writing them.
+// Returns -1 on failure.
 int
-mgc_world_load_chunk(struct mgc_world *, struct mgc_chunk *, v3i coord);
+mgc_world_load_chunk(struct mgc_world *, struct mgc_chunk *, v3i coord, struct mgc_tile *uniform);
 
 void
 mgc_world_tick(struct mgc_world *);
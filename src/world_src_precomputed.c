@@ -1,26 +1,54 @@
 #include "world_src_precomputed.h"
+#include "world.h"
+#include "registry.h"
 #include "utils.h"
 
-#define NOT_IMPLEMENTED panic("TODO: Precomputed world not implemented")
+#include <string.h>
 
 void
-mgc_world_src_precomputed_init(struct mgc_world_src_precomputed *world, struct mgc_world_init_context *init_ctx)
+mgc_world_src_precomputed_init(
+		struct mgc_world_src_precomputed *world,
+		struct mgc_world_init_context *init_ctx,
+		const char *archive_path)
 {
-	NOT_IMPLEMENTED;
+	int err;
+	err = mgc_chunk_archive_open(
+		&world->archive, archive_path, &init_ctx->registry->materials);
+	world->loaded = err == 0;
+}
+
+void
+mgc_world_src_precomputed_destroy(struct mgc_world_src_precomputed *world)
+{
+	if (world->loaded) {
+		mgc_chunk_archive_close(&world->archive);
+		world->loaded = false;
+	}
 }
 
 int
 mgc_world_src_precomputed_load_chunk(
 		struct mgc_world_src_precomputed *world,
 		struct mgc_chunk *chunk,
-		v3i coord)
+		v3i coord,
+		struct mgc_tile *uniform)
 {
-	NOT_IMPLEMENTED;
-	return -1;
+	chunk->location = coord;
+	if (!world->loaded) {
+		return -1;
+	}
+
+	if (mgc_chunk_archive_chunk_is_uniform(&world->archive, coord, uniform)) {
+		return MGC_WORLD_LOAD_UNIFORM;
+	}
+
+	// Chunks read from the archive must be cleared beforehand.
+	memset(chunk, 0, sizeof(struct mgc_chunk));
+	return mgc_chunk_archive_read_chunk(&world->archive, chunk, coord);
 }
 
 void
 mgc_world_src_precomputed_tick(struct mgc_world_src_precomputed *world)
 {
-	NOT_IMPLEMENTED;
+	// The archive never changes while it is mapped.
 }
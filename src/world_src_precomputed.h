@@ -3,21 +3,30 @@
 
 #include "types.h"
 #include "chunk.h"
+#include "chunk_archive.h"
 
 struct mgc_world_src_precomputed {
-	// TODO: Implement precomputed chunks.
-	int _dc;
+	struct mgc_chunk_archive archive;
+	// False if the archive failed to open. Every chunk then fails to load.
+	bool loaded;
 };
 
 struct mgc_world_init_context;
 void
-mgc_world_src_precomputed_init(struct mgc_world_src_precomputed *, struct mgc_world_init_context *);
+mgc_world_src_precomputed_init(
+		struct mgc_world_src_precomputed *,
+		struct mgc_world_init_context *,
+		const char *archive_path);
+
+void
+mgc_world_src_precomputed_destroy(struct mgc_world_src_precomputed *);
 
 int
 mgc_world_src_precomputed_load_chunk(
 		struct mgc_world_src_precomputed *world,
 		struct mgc_chunk *chunk,
-		v3i coord);
+		v3i coord,
+		struct mgc_tile *uniform);
 
 void
 mgc_world_src_precomputed_tick(struct mgc_world_src_precomputed *world);
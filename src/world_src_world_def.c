@@ -39,14 +39,17 @@ int
 mgc_world_src_world_def_load_chunk(
 		struct mgc_world_src_world_def *world,
 		struct mgc_chunk *chunk,
-		v3i coord)
+		v3i coord,
+		struct mgc_tile *uniform)
 {
 	chunk->location = coord;
 	if (!world->terrain) {
 		return -1;
 	}
 
-	mgc_area_apply(world->terrain, chunk);
+	if (mgc_area_apply(world->terrain, chunk, uniform)) {
+		return MGC_WORLD_LOAD_UNIFORM;
+	}
 
 	return 0;
 }
@@ -30,6 +30,7 @@ int
 mgc_world_src_world_def_load_chunk(
 		struct mgc_world_src_world_def *world,
 		struct mgc_chunk *chunk,
-		v3i coord);
+		v3i coord,
+		struct mgc_tile *uniform);
 
 #endif